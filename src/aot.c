@@ -0,0 +1,320 @@
+#include <string.h>
+#include "aot.h"
+#include "compiling.h"
+#include "folding.h"
+#include "context.h"
+
+#define AOT_EMIT(aot, format, ...) do { sprintf_s((aot)->line, AOT_LINE_LEN, format, __VA_ARGS__); aot_line(aot, (aot)->line); } while (FALSE)
+
+const char *aot_ops[] = { "rt_add", "rt_sub", "rt_mul", "rt_div" }; // NOTE: in the same order as op_Addition through op_Division
+
+void aot_init(Aot *aot, Compiler *compiler) {
+    aot->compiler = compiler;
+    stack_init(&aot->body, sizeof (u8));
+}
+
+void aot_deinit(Aot *aot) {
+    stack_deinit(&aot->body);
+}
+
+void aot_append(Stack *stack, const char *text, u64 len) {
+    stack_ensure(stack, stack->len + len);
+    memcpy(stack->arr + stack->len, text, len);
+    stack->len += len;
+}
+
+// NOTE: appends a line of `main` at the current nesting
+void aot_line(Aot *aot, const char *text) {
+    for (u64 i = 0; i <= aot->depth; ++i) {
+        aot_append(&aot->body, "    ", 4);
+    }
+
+    aot_append(&aot->body, text, strlen(text));
+    stack_push_byte(&aot->body, '\n');
+}
+
+void aot_open(Aot *aot, const char *text) {
+    aot_line(aot, text);
+    aot->depth += 1;
+}
+
+void aot_close(Aot *aot) {
+    aot->depth -= 1;
+    aot_line(aot, "}");
+}
+
+u64 aot_temp(Aot *aot) {
+    return aot->temps++;
+}
+
+RESULT aot_expr(Aot *aot, Expression *expr, u64 *result);
+
+RESULT aot_while(Aot *aot, Statement *statement) {
+    u64 cond;
+    u64 value;
+
+    aot_open(aot, "for (;;) {");
+    CHECK(aot_expr(aot, &statement->while_condition, &cond));
+    AOT_EMIT(aot, "if (!rt_truth(t%llu)) break;", cond);
+    CHECK(aot_expr(aot, &statement->while_body, &value));
+    aot_close(aot);
+
+    return FALSE;
+}
+
+RESULT aot_statement(Aot *aot, Statement *statement) {
+    u64 value;
+
+    switch (statement->type) {
+    case st_Expression:
+    case st_Send: // NOTE: blocks and the top level handle their own sends, this only evaluates
+        CHECK(aot_expr(aot, &statement->expr, &value));
+        break;
+    case st_Print:
+        CHECK(aot_expr(aot, &statement->expr, &value));
+        AOT_EMIT(aot, "rt_print(t%llu);", value);
+        break;
+    case st_While:
+        CHECK(aot_while(aot, statement));
+        break;
+    }
+
+    return FALSE;
+}
+
+// NOTE: a send leaves for the end of the block with what it sent, the statements after it are still translated
+// for their errors
+RESULT aot_block(Aot *aot, Expression *expr, u64 *result) {
+    u64 sent = aot->labels++;
+    bool sends = FALSE;
+    u64 value;
+
+    *result = aot_temp(aot);
+    AOT_EMIT(aot, "RtObject t%llu;", *result);
+    aot_open(aot, "{");
+    compiler_scope(aot->compiler, FALSE);
+
+    for (u64 i = 0; i < expr->num_statements; ++i) {
+        Statement *statement = expr->statements + i;
+
+        if (statement->type != st_Send) {
+            CHECK(aot_statement(aot, statement));
+            continue;
+        }
+
+        CHECK(aot_expr(aot, &statement->expr, &value));
+        AOT_EMIT(aot, "t%llu = t%llu;", *result, value);
+        AOT_EMIT(aot, "goto sent%llu;", sent);
+        sends = TRUE;
+    }
+
+    compiler_exit(aot->compiler);
+    AOT_EMIT(aot, "t%llu = rt_none();", *result);
+    aot_close(aot);
+
+    if (sends) {
+        AOT_EMIT(aot, "sent%llu:;", sent);
+    }
+
+    return FALSE;
+}
+
+// NOTE: the else branch is translated first, like compile_expr compiles it, so both report the same error first
+RESULT aot_if_else(Aot *aot, Expression *expr, u64 *result) {
+    u64 cond;
+    u64 value;
+
+    CHECK(aot_expr(aot, expr->condition, &cond));
+    *result = aot_temp(aot);
+    AOT_EMIT(aot, "RtObject t%llu;", *result);
+
+    sprintf_s(aot->line, AOT_LINE_LEN, "if (!rt_truth(t%llu)) {", cond);
+    aot_open(aot, aot->line);
+
+    if (expr->on_false) {
+        CHECK(aot_expr(aot, expr->on_false, &value));
+        AOT_EMIT(aot, "t%llu = t%llu;", *result, value);
+    }
+    else {
+        AOT_EMIT(aot, "t%llu = rt_none();", *result);
+    }
+
+    aot_close(aot);
+    aot_open(aot, "else {");
+    CHECK(aot_expr(aot, expr->on_true, &value));
+    AOT_EMIT(aot, "t%llu = t%llu;", *result, value);
+    aot_close(aot);
+
+    return FALSE;
+}
+
+// NOTE: mirrors compile_assignment, including which error is reported first
+RESULT aot_assignment(Aot *aot, Expression *expr, bool reassign, u64 *result) {
+    Compiler *compiler = aot->compiler;
+    u64 ptr;
+    u64 depth;
+
+    switch (expr->lhs->type) {
+    case ex_Identifier:
+        CHECK(aot_expr(aot, expr->rhs, result));
+
+        if (reassign) {
+            if (scope_get(compiler, expr->lhs->symbol, &ptr, &depth)) {
+                DISPATCH_ERROR_FMT(compiler->context, expr->lhs->line, "Variable not already defined `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->lhs->symbol)));
+                return TRUE;
+            }
+        }
+        else {
+            ptr = scope_assign(compiler, expr->lhs->symbol);
+        }
+
+        AOT_EMIT(aot, "s%llu = t%llu;", ptr, *result);
+        break;
+    default:
+        DISPATCH_ERROR(compiler->context, expr->lhs->line, "Invalid left-hand side of assignment");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// NOTE: every value gets a temporary of its own, which keeps the order things are evaluated and fail in the same
+// as the VM's where nested calls wouldn't
+RESULT aot_expr(Aot *aot, Expression *expr, u64 *result) {
+    Compiler *compiler = aot->compiler;
+
+    switch (expr->type) {
+        u64 op_sstr;
+        u64 ptr;
+        u64 depth;
+        u64 lhs;
+        u64 rhs;
+        i64 integer;
+
+    case ex_Integer:
+        integer = (i64) expr->integer;
+        *result = aot_temp(aot);
+
+        if (integer >= 0 && integer <= INT32_MAX) {
+            AOT_EMIT(aot, "RtObject t%llu = rt_int(%lld);", *result, integer);
+        }
+        else {
+            AOT_EMIT(aot, "RtObject t%llu = rt_int(0x%llxULL);", *result, (u64) integer);
+        }
+
+        break;
+    case ex_Null:
+        fprintf(stderr, FATAL "Got null expression");
+        exit(-1);
+    case ex_Identifier:
+        if (scope_get(compiler, expr->symbol, &ptr, &depth)) {
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Undefined variable `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->symbol)));
+            return TRUE;
+        }
+
+        *result = aot_temp(aot);
+        AOT_EMIT(aot, "RtObject t%llu = s%llu;", *result, ptr);
+        break;
+    case ex_BinaryOperation:
+        if (expr->bin_op == op_Assignment || expr->bin_op == op_Reassignment) {
+            CHECK(aot_assignment(aot, expr, expr->bin_op == op_Reassignment, result));
+            break;
+        }
+
+        CHECK(aot_expr(aot, expr->lhs, &lhs));
+        CHECK(aot_expr(aot, expr->rhs, &rhs));
+        *result = aot_temp(aot);
+        AOT_EMIT(aot, "RtObject t%llu = %s(t%llu, t%llu);", *result, aot_ops[expr->bin_op - op_Addition], lhs, rhs);
+        break;
+    case ex_UnaryOperation:
+        switch (expr->un_op) {
+        case op_Subtraction:
+            CHECK(aot_expr(aot, expr->oprand, &rhs));
+            *result = aot_temp(aot);
+            AOT_EMIT(aot, "RtObject t%llu = rt_neg(t%llu);", *result, rhs);
+            break;
+        default:
+            op_sstr = op_to_sstr(expr->un_op);
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Invalid unary operator `%s`", (char *) &op_sstr);
+            return TRUE;
+        }
+
+        break;
+    case ex_Block:
+        CHECK(aot_block(aot, expr, result));
+        break;
+    case ex_IfElse:
+        CHECK(aot_if_else(aot, expr, result));
+        break;
+    case ex_Function:
+        fprintf(stderr, FATAL "Function compilation");
+        exit(-1);
+        break;
+    }
+
+    return FALSE;
+}
+
+// NOTE: like compile_program, statements are parsed, folded and translated one at a time, each one in a C block
+// of its own so its temporaries don't outlive it, and a send at the top level ends the program
+RESULT aot_translate(Aot *aot) {
+    Compiler *compiler = aot->compiler;
+    Parser *parser = &compiler->context->parser;
+    Arena *arena = &compiler->context->arena;
+    u64 value;
+
+    aot->body.len = 0;
+    aot->labels = 0;
+    aot->depth = 0;
+    aot->sends = FALSE;
+
+    compiler_scope(compiler, TRUE);
+
+    while (!parser_done(parser)) {
+        ArenaMark mark = arena_mark(arena);
+
+        CHECK(parser_next(parser));
+        fold_statement(&parser->statement);
+
+        aot->temps = 0;
+        aot_open(aot, "{");
+
+        if (parser->statement.type == st_Send) {
+            if (aot_expr(aot, &parser->statement.expr, &value)) {
+                return parser_finish(parser);
+            }
+
+            aot_line(aot, "goto done;");
+            aot->sends = TRUE;
+        }
+        else if (aot_statement(aot, &parser->statement)) {
+            return parser_finish(parser);
+        }
+
+        aot_close(aot);
+        arena_rewind(arena, mark);
+    }
+
+    aot->slots = compiler->scope->size;
+    compiler_exit(compiler);
+
+    return FALSE;
+}
+
+// NOTE: the slots are only known once every statement is translated, so `main` is put together here
+void aot_write(Aot *aot, FILE *file) {
+    fprintf(file, "#include \"runtime.h\"\n\nint main(void) {\n");
+
+    for (u64 i = 0; i < aot->slots; ++i) {
+        fprintf(file, "    RtObject s%llu = RT_ZERO;\n", i);
+    }
+
+    fprintf(file, "\n");
+    fwrite(aot->body.arr, sizeof (u8), aot->body.len, file);
+
+    if (aot->sends) {
+        fprintf(file, "\ndone:\n");
+    }
+
+    fprintf(file, "    return 0;\n}\n");
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "stack.h"
+#include "parsing.h"
+
+typedef struct __Compiler__ Compiler;
+
+#define AOT_LINE_LEN 128
+
+// NOTE: translates programs to C that includes runtime.h, variables of the program's frame become locals of
+// `main` by slot and every value a temporary, so the C compiler sees plain dataflow and control flow
+typedef struct {
+    Compiler *compiler;
+    Stack body; // NOTE: `main` past its declarations, which aren't known until every statement is translated
+
+    u64 slots;
+    u64 temps;
+    u64 labels;
+    u64 depth;
+    bool sends;
+    char line[AOT_LINE_LEN];
+} Aot;
+
+void aot_init(Aot *aot, Compiler *compiler);
+void aot_deinit(Aot *aot);
+RESULT aot_translate(Aot *aot);
+void aot_write(Aot *aot, FILE *file);
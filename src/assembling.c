@@ -1,70 +1,240 @@
+#include <string.h>
 #include "assembling.h"
 
+#define UNDEFINED ((u64) -1)
+
 void assembler_init(Assembler *assembler) {
-    stack_init(&assembler->atoms, sizeof (Atom));
     stack_init(&assembler->bytecode, sizeof (u64));
+    stack_init(&assembler->lookup, sizeof (u64));
+    stack_init(&assembler->fixups, sizeof (Fixup));
     assembler->uid = 0;
+    assembler->operands = 0;
+    assembler->operand_bytes = 0;
 }
 
 void assembler_deinit(Assembler *assembler) {
-    stack_deinit(&assembler->atoms);
     stack_deinit(&assembler->bytecode);
+    stack_deinit(&assembler->lookup);
+    stack_deinit(&assembler->fixups);
+}
+
+u64 uint_size(u64 value) {
+    u64 size = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+
+    return size;
+}
+
+u64 int_size(i64 value) {
+    u64 size = 1;
+
+    while (value < -0x40 || value >= 0x40) {
+        value >>= 7;
+        ++size;
+    }
+
+    return size;
+}
+
+// NOTE: values shorter than `size` are padded with continuation bytes, longer ones would be cut off
+void encode_uint(u8 *dst, u64 value, u64 size) {
+    for (u64 i = 0; i + 1 < size; ++i) {
+        *dst++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    ASSERT(value < 0x80);
+    *dst = value & 0x7F;
+}
+
+void encode_int(u8 *dst, i64 value, u64 size) {
+    for (u64 i = 0; i + 1 < size; ++i) {
+        *dst++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    ASSERT(value >= -0x40 && value < 0x40);
+    *dst = value & 0x7F;
 }
 
-void assembler_emit(Assembler *assembler, Atom atom) {
-    stack_push(&assembler->atoms, &atom);
+u64 decode_uint(u8 *program, u64 *pc) {
+    u64 value = 0;
+    u64 shift = 0;
+    u8 byte;
+
+    do {
+        byte = program[(*pc)++];
+        value |= (u64) (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return value;
+}
+
+i64 decode_int(u8 *program, u64 *pc) {
+    u64 value = 0;
+    u64 shift = 0;
+    u8 byte;
+
+    do {
+        byte = program[(*pc)++];
+
+        if (shift < 64) {
+            value |= (u64) (byte & 0x7F) << shift;
+        }
+
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (shift < 64 && (byte & 0x40)) {
+        value |= ~(u64) 0 << shift;
+    }
+
+    return (i64) value;
+}
+
+u8 *assembler_reserve(Assembler *assembler, u64 size) {
+    for (u64 i = 0; i < size; ++i) {
+        stack_push_byte(&assembler->bytecode, 0);
+    }
+
+    ++assembler->operands;
+    assembler->operand_bytes += size;
+
+    return assembler->bytecode.arr + assembler->bytecode.len - size;
 }
 
 u64 assembler_get_next(Assembler *assembler) {
+    u64 undefined = UNDEFINED;
+
+    stack_push(&assembler->lookup, &undefined);
+
     return assembler->uid++;
 }
 
+void assembler_emit_byte(Assembler *assembler, u8 byte) {
+    stack_push_byte(&assembler->bytecode, byte);
+}
+
+void assembler_emit_uint(Assembler *assembler, u64 number) {
+    u64 size = uint_size(number);
+    encode_uint(assembler_reserve(assembler, size), number, size);
+}
+
+void assembler_emit_int(Assembler *assembler, i64 integer) {
+    u64 size = int_size(integer);
+    encode_int(assembler_reserve(assembler, size), integer, size);
+}
+
+void assembler_emit_label_def(Assembler *assembler, u64 label) {
+    *(u64 *) stack_index(&assembler->lookup, label) = assembler->bytecode.len;
+}
+
+void assembler_emit_var_def(Assembler *assembler, u64 var, u64 val) {
+    *(u64 *) stack_index(&assembler->lookup, var) = val;
+}
+
+// NOTE: backward jumps are fixed up too, since the padding between them and their target is removed later
+void assembler_emit_label_ref(Assembler *assembler, u64 label) {
+    Fixup fixup = { assembler->bytecode.len, label, 0, 0, TRUE };
+
+    stack_push(&assembler->fixups, &fixup);
+    assembler_reserve(assembler, FIXUP_WIDTH);
+}
+
+void assembler_emit_var_ref(Assembler *assembler, u64 var) {
+    Fixup fixup = { assembler->bytecode.len, var, 0, 0, FALSE };
+
+    stack_push(&assembler->fixups, &fixup);
+    assembler_reserve(assembler, FIXUP_WIDTH);
+}
+
+// NOTE: where a position from before assembling ends up, fixups are in the order they were emitted so the last one
+// before it says how much padding was removed ahead of it
+u64 assembler_moved(Assembler *assembler, u64 pos) {
+    Fixup *fixups = (Fixup *) assembler->fixups.arr;
+    u64 lo = 0;
+    u64 hi = stack_len(&assembler->fixups);
+
+    while (lo < hi) {
+        u64 mid = (lo + hi) / 2;
+
+        if (fixups[mid].pos < pos) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == 0) {
+        return pos;
+    }
+
+    return pos - (fixups[lo - 1].pos + FIXUP_WIDTH) + fixups[lo - 1].new_pos + fixups[lo - 1].size;
+}
+
+i64 fixup_offset(Assembler *assembler, Fixup *fixup) {
+    u64 target = *(u64 *) stack_index(&assembler->lookup, fixup->id);
+
+    return (i64) (assembler_moved(assembler, target) - (fixup->new_pos + fixup->size));
+}
+
+// NOTE: variables take the size of their value, jump offsets start at a byte and grow until every one fits, since
+// a jump over operands that shrink gets shorter and only ever needs more room when a jump it spans grows. Then the
+// bytecode is closed up in place, nothing moves later than where it started
 void assembler_assemble(Assembler *assembler) {
-    u64 *lookup = heap_alloc(assembler->uid, sizeof (u64));
-    u64 pc = 0;
-
-    for (u64 i = 0; i < stack_len(&assembler->atoms); ++i) {
-        Atom *atom = stack_index(&assembler->atoms, i);
-
-        switch (atom->type) {
-        case at_Byte:
-            pc += 1;
-            break;
-        case at_LabelRef:
-        case at_VarRef:
-        case at_Number:
-            pc += 8;
-            break;
-        case at_LabelDef:
-            lookup[atom->label] = pc;
-            break;
-        case at_VarDef:
-            lookup[atom->var] = atom->val;
-            break;
+    Fixup *fixups = (Fixup *) assembler->fixups.arr;
+    u64 count = stack_len(&assembler->fixups);
+    u8 *code = assembler->bytecode.arr;
+    u64 from = 0;
+    u64 to = 0;
+    bool grew = TRUE;
+
+    for (u64 i = 0; i < count; ++i) {
+        u64 value = *(u64 *) stack_index(&assembler->lookup, fixups[i].id);
+
+        ASSERT(value != UNDEFINED);
+        fixups[i].size = fixups[i].label ? 1 : uint_size(value);
+    }
+
+    while (grew) {
+        u64 removed = 0;
+        grew = FALSE;
+
+        for (u64 i = 0; i < count; ++i) {
+            ASSERT(fixups[i].size <= FIXUP_WIDTH);
+            fixups[i].new_pos = fixups[i].pos - removed;
+            removed += FIXUP_WIDTH - fixups[i].size;
+        }
+
+        for (u64 i = 0; i < count; ++i) {
+            if (fixups[i].label && int_size(fixup_offset(assembler, fixups + i)) > fixups[i].size) {
+                fixups[i].size = int_size(fixup_offset(assembler, fixups + i));
+                grew = TRUE;
+            }
         }
     }
 
-    for (u64 i = 0; i < stack_len(&assembler->atoms); ++i) {
-        Atom *atom = stack_index(&assembler->atoms, i);
-
-        switch (atom->type) {
-        case at_Byte:
-            stack_push_byte(&assembler->bytecode, atom->byte);
-            break;
-        case at_LabelRef:
-            stack_push(&assembler->bytecode, lookup + atom->label);
-            break;
-        case at_VarRef:
-            stack_push(&assembler->bytecode, lookup + atom->var_ref);
-            break;
-        case at_Number:
-            stack_push(&assembler->bytecode, &atom->number);
-            break;
-        case at_LabelDef:
-        case at_VarDef:
-            break;
+    for (u64 i = 0; i < count; ++i) {
+        Fixup *fixup = fixups + i;
+
+        memmove(code + to, code + from, fixup->pos - from);
+        to = fixup->new_pos;
+
+        if (fixup->label) {
+            encode_int(code + to, fixup_offset(assembler, fixup), fixup->size);
         }
+        else {
+            encode_uint(code + to, *(u64 *) stack_index(&assembler->lookup, fixup->id), fixup->size);
+        }
+
+        to += fixup->size;
+        from = fixup->pos + FIXUP_WIDTH;
     }
 
-    heap_dealloc(lookup);
+    memmove(code + to, code + from, assembler->bytecode.len - from);
+    assembler->operand_bytes -= from - to;
+    assembler->bytecode.len -= from - to;
+    assembler->fixups.len = 0;
 }
@@ -3,41 +3,43 @@
 #include "auxiliary.h"
 #include "stack.h"
 
-typedef enum {
-    at_LabelDef,
-    at_LabelRef,
-    at_VarDef,
-    at_VarRef,
-    at_Byte,
-    at_Number,
-} AtomType;
+#define FIXUP_WIDTH 5 // NOTE: references get this many bytes while compiling, assembling shrinks them to fit
 
 typedef struct {
-    AtomType type;
-
-    union {
-        u64 label;
-        u64 var_ref;
-
-        struct {
-            u64 var;
-            u64 val;
-        };
-
-        u8 byte;
-        u64 number;
-    };
-} Atom;
+    u64 pos;
+    u64 id;
+    u64 new_pos; // NOTE: where the operand ends up once the padding before it is removed
+    u64 size;
+    bool label;
+} Fixup;
 
 typedef struct {
-    Stack atoms;
     Stack bytecode;
+    Stack lookup;
+    Stack fixups;
     u64 uid;
+
+    u64 operands;
+    u64 operand_bytes;
 } Assembler;
 
 void assembler_init(Assembler *assembler);
 void assembler_deinit(Assembler *assembler);
 
-void assembler_emit(Assembler *assembler, Atom atom);
 u64 assembler_get_next(Assembler *assembler);
+void assembler_emit_byte(Assembler *assembler, u8 byte);
+void assembler_emit_uint(Assembler *assembler, u64 number);
+void assembler_emit_int(Assembler *assembler, i64 integer);
+void assembler_emit_label_def(Assembler *assembler, u64 label);
+void assembler_emit_label_ref(Assembler *assembler, u64 label);
+void assembler_emit_var_def(Assembler *assembler, u64 var, u64 val);
+void assembler_emit_var_ref(Assembler *assembler, u64 var);
 void assembler_assemble(Assembler *assembler);
+
+// NOTE: operands are LEB128, unsigned for slots and sizes, signed for immediates, registers and jump offsets relative to the end of the operand
+u64 uint_size(u64 value);
+u64 int_size(i64 value);
+void encode_uint(u8 *dst, u64 value, u64 size);
+void encode_int(u8 *dst, i64 value, u64 size);
+u64 decode_uint(u8 *program, u64 *pc);
+i64 decode_int(u8 *program, u64 *pc);
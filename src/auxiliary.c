@@ -1,14 +1,78 @@
+#include <string.h>
 #include "auxiliary.h"
 #include "hashmap.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 void *check_ptr(void *ptr) {
     if (ptr) return ptr;
     fprintf(stderr, FATAL "Out of memory\n");
     exit(-1);
 }
 
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN 16
+#define ARENA_HEADER ((sizeof (ArenaChunk) + ARENA_ALIGN - 1) & ~(u64) (ARENA_ALIGN - 1))
+
+#ifdef EBUG_ALLOCATIONS
+// NOTE: every heap block carries its size in front of it so the tracked byte counts stay exact across frees
+#define HEADER_SIZE 16
+
+typedef struct {
+    bool enabled;
+    u64 allocations;
+    u64 reallocations;
+    u64 deallocations;
+    u64 bytes;
+    u64 peak_bytes;
+    u64 arena_allocations;
+    u64 arena_bytes;
+} Tracking;
+
+Tracking tracking = { 0 };
+
+void begin_tracking() {
+    memset(&tracking, 0, sizeof (Tracking));
+    tracking.enabled = TRUE;
+}
+
+void tracking_diagnostics() {
+    fprintf(stderr, "memory: %llu allocations, %llu reallocations, %llu deallocations, %llu bytes peak, %llu bytes live\n",
+        tracking.allocations, tracking.reallocations, tracking.deallocations, tracking.peak_bytes, tracking.bytes);
+    fprintf(stderr, "memory: %llu arena allocations, %llu arena bytes\n", tracking.arena_allocations, tracking.arena_bytes);
+}
+
+void track(u64 freed, u64 allocated) {
+    tracking.bytes += allocated - freed;
+
+    if (tracking.bytes > tracking.peak_bytes) {
+        tracking.peak_bytes = tracking.bytes;
+    }
+}
+#endif
+
 void *heap_alloc(u64 count, u64 size) {
+#ifdef EBUG_ALLOCATIONS
+    u8 *block = check_ptr(malloc(HEADER_SIZE + count * size));
+    void *ptr_res = block + HEADER_SIZE;
+
+    *(u64 *) block = count * size;
+
+    if (tracking.enabled) {
+        ++tracking.allocations;
+        track(0, count * size);
+    }
+#else
     void *ptr_res = check_ptr(malloc(count * size));
+#endif
 
 #ifdef EBUG_MEMORY
     printf("* _ -> %016llX\n", ptr_res);
@@ -18,7 +82,22 @@ void *heap_alloc(u64 count, u64 size) {
 }
 
 void *heap_realloc(void *ptr, u64 count, u64 size) {
+#ifdef EBUG_ALLOCATIONS
+    u8 *block = ptr ? (u8 *) ptr - HEADER_SIZE : NULL;
+    u64 old_size = block ? *(u64 *) block : 0;
+
+    block = check_ptr(realloc(block, HEADER_SIZE + count * size));
+    *(u64 *) block = count * size;
+
+    void *ptr_res = block + HEADER_SIZE;
+
+    if (tracking.enabled) {
+        ++tracking.reallocations;
+        track(old_size, count * size);
+    }
+#else
     void *ptr_res = check_ptr(realloc(ptr, count * size));
+#endif
 
 #ifdef EBUG_MEMORY
     printf("* %016llX -> %016llX\n", ptr, ptr_res);
@@ -32,10 +111,79 @@ void heap_dealloc(void *ptr) {
     printf("* %016llX -> _\n", ptr);
 #endif
 
+#ifdef EBUG_ALLOCATIONS
+    if (ptr == NULL) return;
+
+    u8 *block = (u8 *) ptr - HEADER_SIZE;
+
+    if (tracking.enabled) {
+        ++tracking.deallocations;
+        track(*(u64 *) block, 0);
+    }
+
+    free(block);
+#else
     free(ptr);
+#endif
+}
+
+void arena_init(Arena *arena) {
+    arena->chunk = NULL;
+}
+
+void arena_deinit(Arena *arena) {
+    while (arena->chunk) {
+        ArenaChunk *prev = arena->chunk->prev;
+        heap_dealloc(arena->chunk);
+        arena->chunk = prev;
+    }
+}
+
+void *arena_alloc(Arena *arena, u64 count, u64 size) {
+    u64 bytes = (count * size + ARENA_ALIGN - 1) & ~(u64) (ARENA_ALIGN - 1);
+    ArenaChunk *chunk = arena->chunk;
+
+    if (chunk == NULL || chunk->top + bytes > chunk->end) {
+        u64 data = bytes > ARENA_CHUNK_SIZE ? bytes : ARENA_CHUNK_SIZE;
+
+        chunk = heap_alloc(1, ARENA_HEADER + data);
+        chunk->prev = arena->chunk;
+        chunk->top = (u8 *) chunk + ARENA_HEADER;
+        chunk->end = chunk->top + data;
+        arena->chunk = chunk;
+    }
+
+    void *ptr = chunk->top;
+    chunk->top += bytes;
+
+#ifdef EBUG_ALLOCATIONS
+    if (tracking.enabled) {
+        ++tracking.arena_allocations;
+        tracking.arena_bytes += bytes;
+    }
+#endif
+
+    return ptr;
+}
+
+ArenaMark arena_mark(Arena *arena) {
+    ArenaMark mark = { arena->chunk, arena->chunk ? arena->chunk->top : NULL };
+    return mark;
 }
 
-char *read_file(const char *path) {
+void arena_rewind(Arena *arena, ArenaMark mark) {
+    while (arena->chunk != mark.chunk) {
+        ArenaChunk *prev = arena->chunk->prev;
+        heap_dealloc(arena->chunk);
+        arena->chunk = prev;
+    }
+
+    if (arena->chunk) {
+        arena->chunk->top = mark.top;
+    }
+}
+
+char *read_file(const char *path, u64 *len) {
     FILE *file = fopen(path, "rb");
 
     if (file == NULL) {
@@ -45,13 +193,131 @@ char *read_file(const char *path) {
 
     ASSERT(fseek(file, 0, SEEK_END) == 0);
 
-    u64 len = ftell(file);
-    char *contents = heap_alloc(len + 1, sizeof (char));
-    contents[len] = 0;
+    *len = ftell(file);
+    char *contents = heap_alloc(*len + FILE_PADDING, sizeof (char));
+    memset(contents + *len, 0, FILE_PADDING);
     rewind(file);
-    u64 written = fread(contents, sizeof (char), len, file);
+    u64 written = fread(contents, sizeof (char), *len, file);
 
-    ASSERT(written == len);
+    ASSERT(written == *len);
+    fclose(file);
 
     return contents;
 }
+
+// NOTE: maps the file read-only so that only the pages that are touched are ever read, falling back
+// to read_file when the padding can't be guaranteed
+RESULT source_map(SourceFile *file, const char *path) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        return TRUE;
+    }
+
+    LARGE_INTEGER size;
+    SYSTEM_INFO info;
+
+    ASSERT(GetFileSizeEx(handle, &size));
+    GetSystemInfo(&info);
+
+    u64 len = size.QuadPart;
+    u64 page = info.dwPageSize;
+    u64 mapped = (len + page - 1) / page * page;
+
+    // NOTE: a view can't reach past the end of the file, so the padding has to fit in the zeroed tail of the last page
+    if (len > 0 && mapped - len >= FILE_PADDING) {
+        HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+
+        if (view) {
+            CloseHandle(handle);
+            file->data = view;
+            file->len = len;
+            file->mapped = mapped;
+            return FALSE;
+        }
+    }
+
+    CloseHandle(handle);
+#else
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return TRUE;
+    }
+
+    struct stat st;
+
+    ASSERT(fstat(fd, &st) == 0);
+
+    u64 len = st.st_size;
+    u64 page = sysconf(_SC_PAGESIZE);
+    u64 mapped = (len + FILE_PADDING + page - 1) / page * page;
+
+    // NOTE: reserves zeroed pages for the file and its padding, then maps the file over the start of them
+    if (S_ISREG(st.st_mode) && len > 0) {
+        char *base = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base != MAP_FAILED && mmap(base, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED) {
+            close(fd);
+            file->data = base;
+            file->len = len;
+            file->mapped = mapped;
+            return FALSE;
+        }
+
+        if (base != MAP_FAILED) {
+            munmap(base, mapped);
+        }
+    }
+
+    close(fd);
+#endif
+
+    file->data = read_file(path, &file->len);
+    file->mapped = 0;
+
+    return FALSE;
+}
+
+void source_open(SourceFile *file, const char *path) {
+    if (source_map(file, path)) {
+        fprintf(stderr, FATAL "Cannot open file\n");
+        exit(-1);
+    }
+}
+
+void source_close(SourceFile *file) {
+    if (file->mapped == 0) {
+        heap_dealloc(file->data);
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+#else
+    munmap(file->data, file->mapped);
+#endif
+}
+
+u64 time_ns() {
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (u64) (counter.QuadPart / frequency.QuadPart * 1000000000 + counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (u64) ts.tv_sec * 1000000000 + (u64) ts.tv_nsec;
+#endif
+}
@@ -5,7 +5,10 @@
 #include <stdlib.h>
 
 typedef int64_t i64;
+typedef int32_t i32;
+typedef int8_t i8;
 typedef uint64_t u64;
+typedef uint32_t u32;
 typedef uint16_t u16;
 typedef uint8_t u8;
 typedef char bool;
@@ -35,6 +38,17 @@ typedef char bool;
 
 #define RESULT WARN_UNUSED bool
 
+typedef struct __ArenaChunk__ {
+    struct __ArenaChunk__ *prev;
+    u8 *top;
+    u8 *end;
+} ArenaChunk;
+
+// NOTE: everything allocated from an arena is freed at once by arena_deinit
+typedef struct {
+    ArenaChunk *chunk;
+} Arena;
+
 void begin_tracking();
 void tracking_diagnostics();
 void *check_ptr(void *ptr);
@@ -42,4 +56,38 @@ void *heap_alloc(u64 count, u64 size);
 void *heap_realloc(void *ptr, u64 count, u64 size);
 void heap_dealloc(void *ptr);
 
-char *read_file(const char *path);
+// NOTE: rewinding to a mark frees everything allocated after it was taken
+typedef struct {
+    ArenaChunk *chunk;
+    u8 *top;
+} ArenaMark;
+
+void arena_init(Arena *arena);
+void arena_deinit(Arena *arena);
+void *arena_alloc(Arena *arena, u64 count, u64 size);
+ArenaMark arena_mark(Arena *arena);
+void arena_rewind(Arena *arena, ArenaMark mark);
+
+// NOTE: the contents are followed by FILE_PADDING zero bytes so that scanners can load whole vectors near the end
+#define FILE_PADDING 32
+
+// NOTE: a borrowed, unterminated string, usually pointing into the source
+typedef struct {
+    const char *str;
+    u64 len;
+} View;
+
+#define VIEW_ARGS(view) (int) (view).len, (view).str
+
+// NOTE: `mapped` is the size of the mapping, or 0 when the file had to be read into the heap instead
+typedef struct {
+    char *data;
+    u64 len;
+    u64 mapped;
+} SourceFile;
+
+char *read_file(const char *path, u64 *len);
+RESULT source_map(SourceFile *file, const char *path);
+void source_open(SourceFile *file, const char *path);
+void source_close(SourceFile *file);
+u64 time_ns();
@@ -0,0 +1,129 @@
+#include <string.h>
+#include "cache.h"
+#include "context.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// NOTE: hashes a word at a time since it runs over the whole source on every cached start, the
+// source is zero padded so the last partial word can be read whole
+u64 hash_source(const char *data, u64 len) {
+    u64 hash = len * 0x9E3779B97F4A7C15ULL;
+
+    for (u64 i = 0; i < len; i += sizeof (u64)) {
+        u64 word;
+
+        memcpy(&word, data + i, sizeof (u64));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
+
+u32 cache_flags(Context *context) {
+    u32 flags = 0;
+
+#ifdef TAGGED_VALUES
+    flags |= CACHE_TAGGED_VALUES;
+#endif
+#ifdef EBUG_HEAP_SCOPES
+    flags |= CACHE_HEAP_SCOPES;
+#endif
+
+    if (context->flags & CONTEXT_REGISTERS) {
+        flags |= CACHE_REGISTERS;
+    }
+
+    if (context->flags & CONTEXT_OPTIMIZE) {
+        flags |= CACHE_OPTIMIZED;
+    }
+
+    return flags;
+}
+
+// NOTE: the cache lives next to the source, with a `c` appended to its name
+char *cache_path(Context *context, const char *suffix) {
+    u64 len = strlen(context->path) + strlen(suffix) + 32;
+    char *path = heap_alloc(len, sizeof (char));
+
+    sprintf_s(path, len, "%sc%s", context->path, suffix);
+
+    return path;
+}
+
+// NOTE: leaves `context->cache.data` NULL unless the cache matches, in which case the VM runs straight
+// out of the mapping until context_deinit
+void cache_load(Context *context) {
+    char *path = cache_path(context, "");
+    bool missing = source_map(&context->cache, path);
+
+    heap_dealloc(path);
+
+    if (missing) {
+        context->cache.data = NULL;
+        return;
+    }
+
+    CacheHeader *header = (CacheHeader *) context->cache.data;
+
+    if (context->cache.len < sizeof (CacheHeader) ||
+        header->magic != CACHE_MAGIC ||
+        header->version != CACHE_VERSION ||
+        header->flags != cache_flags(context) ||
+        header->source_len != context->source.len ||
+        header->bytecode_len != context->cache.len - sizeof (CacheHeader) ||
+        header->source_hash != hash_source(context->source.data, context->source.len)) {
+        source_close(&context->cache);
+        context->cache.data = NULL;
+        return;
+    }
+
+    context->vm.program = (u8 *) (header + 1);
+    context->vm.program_len = header->bytecode_len;
+}
+
+// NOTE: writes to a temporary file and renames it over the cache, so a reader never sees a partial one,
+// failing to write it is not an error
+void cache_store(Context *context) {
+    CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .source_hash = hash_source(context->source.data, context->source.len),
+        .source_len = context->source.len,
+        .flags = cache_flags(context),
+        .padding = 0,
+        .bytecode_len = context->compiler.assembler.bytecode.len,
+    };
+
+    char suffix[32];
+    sprintf_s(suffix, sizeof (suffix), ".%d.tmp", (int) getpid());
+
+    char *path = cache_path(context, "");
+    char *tmp = cache_path(context, suffix);
+    FILE *file = fopen(tmp, "wb");
+
+    if (file) {
+        bool written =
+            fwrite(&header, sizeof (CacheHeader), 1, file) == 1 &&
+            fwrite(context->compiler.bytecode, sizeof (u8), header.bytecode_len, file) == header.bytecode_len;
+
+        written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+        if (!written || !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING)) {
+#else
+        if (!written || rename(tmp, path) != 0) {
+#endif
+            remove(tmp);
+        }
+    }
+
+    heap_dealloc(path);
+    heap_dealloc(tmp);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "auxiliary.h"
+
+typedef struct __Context__ Context;
+
+#define CACHE_MAGIC     0x0063796A // NOTE: "jyc\0" when read as bytes
+#define CACHE_VERSION   1          // NOTE: must change with the instruction set or the operand encoding
+
+#define CACHE_TAGGED_VALUES (1 << 0)
+#define CACHE_REGISTERS     (1 << 1)
+#define CACHE_HEAP_SCOPES   (1 << 2)
+#define CACHE_OPTIMIZED     (1 << 3)
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u64 source_hash;
+    u64 source_len;
+    u32 flags;
+    u32 padding;
+    u64 bytecode_len;
+} CacheHeader;
+
+void cache_load(Context *context);
+void cache_store(Context *context);
@@ -1,137 +1,232 @@
 #include "compiling.h"
 #include "parsing.h"
+#include "folding.h"
+#include "peephole.h"
+#include "optimizing.h"
 #include "context.h"
 #include "vm.h"
 
-#define INST_PUSH_INT   0x00 // NOTE: inst_names, instructions, and NUM_INSTRUCTIONS must change if this does
-#define INST_PUSH_NONE  0x01
-#define INST_PUSH       0x02
-#define INST_ADD        0x03
-#define INST_SUB        0x04
-#define INST_MUL        0x05
-#define INST_DIV        0x06
-#define INST_NEG        0x07
-#define INST_POP        0x08
-#define INST_PULL_TO    0x09
-#define INST_HALT       0x0A
-#define INST_SCOPE      0x0B
-#define INST_EXIT       0x0C
-#define INST_PRINT      0x0D
-#define INST_JUMP       0x0E
-#define INST_BRANCH     0x0F
-#define INST_BRANCH_F   0x10
-
 #define OP_OFFSET INST_ADD
 
-void compiler_scope(Compiler *compiler) {
-    Scope *scope = heap_alloc(1, sizeof (Scope));
+// NOTE: a frame owns a runtime VmScope, every other scope is laid out inside its enclosing frame
+void compiler_scope(Compiler *compiler, bool frame) {
+    Scope *scope = arena_alloc(&compiler->context->arena, 1, sizeof (Scope));
 
-    hashmap_init(&scope->vars);
     scope->parent = compiler->scope;
-    scope->ptr = 0;
+    scope->bindings = stack_len(&compiler->bindings);
+    scope->level = (scope->parent ? scope->parent->level : 0) + frame;
+
+    if (frame) {
+        scope->ptr = 0;
+        scope->size = 0;
+        scope->frame = scope;
+    }
+    else {
+        scope->ptr = scope->parent->ptr;
+        scope->frame = scope->parent->frame;
+    }
 
     compiler->scope = scope;
 }
 
-void compiler_exit(Compiler *compiler) {
-    Scope *scope = compiler->scope;
-    compiler->scope = compiler->scope->parent;
+u32 *innermost(Compiler *compiler, Symbol symbol) {
+    u32 none = NO_BINDING;
+
+    while (stack_len(&compiler->innermost) <= symbol) {
+        stack_push(&compiler->innermost, &none);
+    }
 
-    hashmap_deinit(&scope->vars);
-    heap_dealloc(scope);
+    return stack_index(&compiler->innermost, symbol);
 }
 
-u64 scope_assign(Scope *scope, const char *ident) {
-    u64 ptr;
+void compiler_exit(Compiler *compiler) {
+    while (stack_len(&compiler->bindings) > compiler->scope->bindings) {
+        Binding binding;
 
-    if (hashmap_get_or_put(&scope->vars, ident, scope->ptr, &ptr)) {
-        ++scope->ptr;
+        stack_pop(&compiler->bindings, &binding);
+        *innermost(compiler, binding.symbol) = binding.shadowed;
     }
 
-    return ptr;
+    compiler->scope = compiler->scope->parent;
 }
 
-RESULT scope_get(Scope *scope, const char *ident, u64 *ptr, u64 *depth) {
-    for (u64 i = 0; scope; scope = scope->parent, ++i) {
-        if (!hashmap_get(&scope->vars, ident, ptr)) {
-            *depth = i;
-            return FALSE;
+u64 scope_assign(Compiler *compiler, Symbol symbol) {
+    Scope *scope = compiler->scope;
+    u32 *top = innermost(compiler, symbol);
+
+    if (*top != NO_BINDING) {
+        Binding *binding = stack_index(&compiler->bindings, *top);
+
+        if (binding->scope == scope) {
+            return binding->ptr;
         }
     }
 
-    return TRUE;
+    Binding binding = { symbol, *top, scope->ptr++, scope };
+
+    *top = stack_len(&compiler->bindings);
+    stack_push(&compiler->bindings, &binding);
+
+    if (scope->ptr > scope->frame->size) {
+        scope->frame->size = scope->ptr;
+    }
+
+    return binding.ptr;
+}
+
+// NOTE: depth counts the frames between the current scope and the one the symbol is bound in
+RESULT scope_get(Compiler *compiler, Symbol symbol, u64 *ptr, u64 *depth) {
+    u32 top = *innermost(compiler, symbol);
+
+    if (top == NO_BINDING) {
+        return TRUE;
+    }
+
+    Binding *binding = stack_index(&compiler->bindings, top);
+
+    *ptr = binding->ptr;
+    *depth = compiler->scope->level - binding->scope->level;
+
+    return FALSE;
+}
+
+View symbol_name(Compiler *compiler, Symbol symbol) {
+    return symbols_name(&compiler->context->lexer.symbols, symbol);
 }
 
 void compiler_init(Compiler *compiler, Context *context) {
     compiler->context = context;
-    compiler->scope = heap_alloc(1, sizeof (Scope));
+    compiler->scope = NULL;
     compiler->uid_counter = 0;
+    stack_init(&compiler->bindings, sizeof (Binding));
+    stack_init(&compiler->innermost, sizeof (u32));
+    compiler->registers = FALSE;
+    compiler->optimize = FALSE;
+    compiler->temps = 0;
+    compiler->max_temps = 0;
 
     assembler_init(&compiler->assembler);
-    compiler->scope = NULL;
+    ir_init(&compiler->ir, compiler);
+    lowering_init(&compiler->lowering);
+    aot_init(&compiler->aot, compiler);
 }
 
 void compiler_deinit(Compiler *compiler) {
     assembler_deinit(&compiler->assembler);
-
-    if (compiler->scope) {
-        hashmap_deinit(&compiler->scope->vars);
-        heap_dealloc(compiler->scope);
-    }
+    ir_deinit(&compiler->ir);
+    lowering_deinit(&compiler->lowering);
+    aot_deinit(&compiler->aot);
+    stack_deinit(&compiler->bindings);
+    stack_deinit(&compiler->innermost);
 }
 
 void compiler_emit_instruction(Compiler *compiler, u8 instruction) {
-    assembler_emit(&compiler->assembler, (Atom) { at_Byte, { .byte = instruction } });
+    assembler_emit_byte(&compiler->assembler, instruction);
 }
 
 void compiler_emit_byte(Compiler *compiler, u8 byte) {
-    assembler_emit(&compiler->assembler, (Atom) { at_Byte, { .byte = byte } });
+    assembler_emit_byte(&compiler->assembler, byte);
 }
 
-void compiler_emit_qword(Compiler *compiler, u64 number) {
-    assembler_emit(&compiler->assembler, (Atom) { at_Number, { .number = number } });
+void compiler_emit_uint(Compiler *compiler, u64 number) {
+    assembler_emit_uint(&compiler->assembler, number);
+}
+
+void compiler_emit_int(Compiler *compiler, i64 integer) {
+    assembler_emit_int(&compiler->assembler, integer);
 }
 
 void compiler_emit_label_def(Compiler *compiler, u64 label) {
-    assembler_emit(&compiler->assembler, (Atom) { at_LabelDef, { .label = label } });
+    assembler_emit_label_def(&compiler->assembler, label);
 }
 
 void compiler_emit_label_ref(Compiler *compiler, u64 label) {
-    assembler_emit(&compiler->assembler, (Atom) { at_LabelRef, { .label = label } });
+    assembler_emit_label_ref(&compiler->assembler, label);
 }
 
 void compiler_emit_var_ref(Compiler *compiler, u64 var) {
-    assembler_emit(&compiler->assembler, (Atom) { at_VarRef, { .var_ref = var } });
+    assembler_emit_var_ref(&compiler->assembler, var);
+}
+
+// NOTE: temporaries sit after every slot the frame's variables could take
+void compiler_emit_reg(Compiler *compiler, Reg reg) {
+    compiler_emit_uint(compiler, reg.temp ? compiler->temp_base + reg.index : reg.index);
 }
 
 void compiler_emit_var_def(Compiler *compiler, u64 var, u64 val) {
-    assembler_emit(&compiler->assembler, (Atom) { at_VarDef, { .var = var, .val = val  } });
+    assembler_emit_var_def(&compiler->assembler, var, val);
 }
 
 RESULT compile_expr(Compiler *compiler, Expression *expr);
 
-RESULT compile_assignment(Compiler *compiler, Expression *expr, bool reassign) {
+bool expr_captures(Expression *expr);
+
+bool statement_captures(Statement *statement) {
+    switch (statement->type) {
+    case st_Expression:
+    case st_Print:
+    case st_Send:
+        return expr_captures(&statement->expr);
+    case st_While:
+        return expr_captures(&statement->while_condition) || expr_captures(&statement->while_body);
+    }
+
+    UNREACHABLE();
+}
+
+// NOTE: a block is captured when a function inside it could outlive it, those get a heap scope
+bool expr_captures(Expression *expr) {
+#ifdef EBUG_HEAP_SCOPES
+    if (expr->type == ex_Block) return TRUE;
+#endif
+
+    switch (expr->type) {
+    case ex_BinaryOperation:
+        return expr_captures(expr->lhs) || expr_captures(expr->rhs);
+    case ex_UnaryOperation:
+        return expr_captures(expr->oprand);
+    case ex_Block:
+        for (u64 i = 0; i < expr->num_statements; ++i) {
+            if (statement_captures(expr->statements + i)) return TRUE;
+        }
+
+        return FALSE;
+    case ex_IfElse:
+        return expr_captures(expr->condition) || expr_captures(expr->on_true) || (expr->on_false && expr_captures(expr->on_false));
+    case ex_Function:
+        return TRUE;
+    case ex_Identifier:
+    case ex_Integer:
+    case ex_Null:
+        return FALSE;
+    }
+
+    UNREACHABLE();
+}
+
+// NOTE: a discarded assignment stores with store_pop instead of pull_to followed by pop
+RESULT compile_assignment(Compiler *compiler, Expression *expr, bool reassign, bool discard) {
     switch (expr->lhs->type) {
         u64 ptr;
         u64 depth;
 
     case ex_Identifier:
         CHECK(compile_expr(compiler, expr->rhs));
-        compiler_emit_instruction(compiler, INST_PULL_TO);
+        compiler_emit_instruction(compiler, discard ? INST_STORE_POP : INST_PULL_TO);
 
         if (reassign) {
-            if (scope_get(compiler->scope, expr->lhs->ident, &ptr, &depth)) {
-                DISPATCH_ERROR_FMT(compiler->context, expr->lhs->line, "Variable not already defined `%s`", expr->lhs->ident);
+            if (scope_get(compiler, expr->lhs->symbol, &ptr, &depth)) {
+                DISPATCH_ERROR_FMT(compiler->context, expr->lhs->line, "Variable not already defined `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->lhs->symbol)));
                 return TRUE;
             }
         }
         else {
-            ptr = scope_assign(compiler->scope, expr->lhs->ident);
+            ptr = scope_assign(compiler, expr->lhs->symbol);
             depth = 0;
         }
 
-        compiler_emit_qword(compiler, ptr);
-        compiler_emit_qword(compiler, depth);
+        compiler_emit_uint(compiler, ptr);
+        compiler_emit_uint(compiler, depth);
         break;
     default:
         DISPATCH_ERROR(compiler->context, expr->lhs->line, "Invalid left-hand side of assignment");
@@ -141,14 +236,42 @@ RESULT compile_assignment(Compiler *compiler, Expression *expr, bool reassign) {
     return FALSE;
 }
 
+// NOTE: emits an instruction whose first operands are the slot of the identifier `expr`
+RESULT compile_slot(Compiler *compiler, Expression *expr, u8 instruction) {
+    u64 ptr;
+    u64 depth;
+
+    if (scope_get(compiler, expr->symbol, &ptr, &depth)) {
+        DISPATCH_ERROR_FMT(compiler->context, expr->line, "Undefined variable `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->symbol)));
+        return TRUE;
+    }
+
+    compiler_emit_instruction(compiler, instruction);
+    compiler_emit_uint(compiler, ptr);
+    compiler_emit_uint(compiler, depth);
+
+    return FALSE;
+}
+
+// NOTE: compiles an expression whose value is never used
+RESULT compile_discarded(Compiler *compiler, Expression *expr) {
+    if (expr->type == ex_BinaryOperation && (expr->bin_op == op_Assignment || expr->bin_op == op_Reassignment)) {
+        return compile_assignment(compiler, expr, expr->bin_op == op_Reassignment, TRUE);
+    }
+
+    CHECK(compile_expr(compiler, expr));
+    compiler_emit_instruction(compiler, INST_POP);
+
+    return FALSE;
+}
+
 RESULT compile_statement(Compiler *compiler, Statement *statement) {
     switch (statement->type) {
         u64 loop;
         u64 end;
 
     case st_Expression:
-        CHECK(compile_expr(compiler, &statement->expr));
-        compiler_emit_instruction(compiler, INST_POP);
+        CHECK(compile_discarded(compiler, &statement->expr));
         break;
     case st_Print:
         CHECK(compile_expr(compiler, &statement->expr));
@@ -162,11 +285,17 @@ RESULT compile_statement(Compiler *compiler, Statement *statement) {
         end = assembler_get_next(&compiler->assembler);
 
         compiler_emit_label_def(compiler, loop);
-        CHECK(compile_expr(compiler, &statement->while_condition));
-        compiler_emit_instruction(compiler, INST_BRANCH_F);
+
+        if (statement->while_condition.type == ex_Identifier) {
+            CHECK(compile_slot(compiler, &statement->while_condition, INST_BRANCH_F_SLOT));
+        }
+        else {
+            CHECK(compile_expr(compiler, &statement->while_condition));
+            compiler_emit_instruction(compiler, INST_BRANCH_F);
+        }
+
         compiler_emit_label_ref(compiler, end);
-        CHECK(compile_expr(compiler, &statement->while_body));
-        compiler_emit_instruction(compiler, INST_POP);
+        CHECK(compile_discarded(compiler, &statement->while_body));
         compiler_emit_instruction(compiler, INST_JUMP);
         compiler_emit_label_ref(compiler, loop);
         compiler_emit_label_def(compiler, end);
@@ -181,34 +310,32 @@ RESULT compile_expr(Compiler *compiler, Expression *expr) {
         u64 exit_point;
         u64 scope_size;
         u64 op_sstr;
-        u64 ptr;
-        u64 depth;
         u64 on_if;
         u64 end;
+        bool frame;
+        bool captured;
+        bool sends;
 
     case ex_Integer:
         compiler_emit_instruction(compiler, INST_PUSH_INT);
-        compiler_emit_qword(compiler, expr->integer);
+        compiler_emit_int(compiler, expr->integer);
         break;
     case ex_Null:
         fprintf(stderr, FATAL "Got null expression");
         exit(-1);
     case ex_Identifier:
-        if (scope_get(compiler->scope, expr->ident, &ptr, &depth)) {
-            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Undefined variable `%s`", expr->ident);
-            return TRUE;
-        }
-
-        compiler_emit_instruction(compiler, INST_PUSH);
-        compiler_emit_qword(compiler, ptr);
-        compiler_emit_qword(compiler, depth);
+        CHECK(compile_slot(compiler, expr, INST_PUSH));
         break;
     case ex_BinaryOperation:
         if (expr->bin_op == op_Assignment) {
-            CHECK(compile_assignment(compiler, expr, FALSE));
+            CHECK(compile_assignment(compiler, expr, FALSE, FALSE));
         }
         else if (expr->bin_op == op_Reassignment) {
-            CHECK(compile_assignment(compiler, expr, TRUE));
+            CHECK(compile_assignment(compiler, expr, TRUE, FALSE));
+        }
+        else if (expr->lhs->type == ex_Identifier && expr->rhs->type == ex_Integer && expr->bin_op < op_Division) {
+            CHECK(compile_slot(compiler, expr->lhs, INST_ADD_SLOT_IMM + expr->bin_op));
+            compiler_emit_int(compiler, expr->rhs->integer);
         }
         else {
             CHECK(compile_expr(compiler, expr->lhs));
@@ -222,7 +349,7 @@ RESULT compile_expr(Compiler *compiler, Expression *expr) {
 
         switch (expr->un_op) {
         case op_Subtraction:
-            compiler_emit_instruction(compiler, INST_SUB);
+            compiler_emit_instruction(compiler, INST_NEG);
             break;
         default:
             op_sstr = op_to_sstr(expr->un_op);
@@ -232,12 +359,19 @@ RESULT compile_expr(Compiler *compiler, Expression *expr) {
 
         break;
     case ex_Block:
+        captured = expr_captures(expr);
+        frame = compiler->scope == NULL || captured;
+        sends = FALSE;
         exit_point = assembler_get_next(&compiler->assembler);
-        scope_size = assembler_get_next(&compiler->assembler);
 
-        compiler_emit_instruction(compiler, INST_SCOPE);
-        compiler_emit_var_ref(compiler, scope_size);
-        compiler_scope(compiler);
+        scope_size = frame ? assembler_get_next(&compiler->assembler) : 0;
+
+        if (frame) {
+            compiler_emit_instruction(compiler, captured ? INST_SCOPE_HEAP : INST_SCOPE);
+            compiler_emit_var_ref(compiler, scope_size);
+        }
+
+        compiler_scope(compiler, frame);
 
         for (u64 i = 0; i < expr->num_statements; ++i) {
             CHECK(compile_statement(compiler, expr->statements + i));
@@ -246,16 +380,27 @@ RESULT compile_expr(Compiler *compiler, Expression *expr) {
             case st_Send:
                 compiler_emit_instruction(compiler, INST_JUMP);
                 compiler_emit_label_ref(compiler, exit_point);
+                sends = TRUE;
                 break;
             default:
                 break;
             }
         }
 
-        compiler_emit_instruction(compiler, INST_PUSH_NONE);
-        compiler_emit_label_def(compiler, exit_point);
-        compiler_emit_instruction(compiler, INST_EXIT);
-        compiler_emit_var_def(compiler, scope_size, compiler->scope->ptr);
+        if (frame && !sends) {
+            compiler_emit_instruction(compiler, INST_EXIT_NONE);
+        }
+        else {
+            compiler_emit_instruction(compiler, INST_PUSH_NONE);
+            compiler_emit_label_def(compiler, exit_point);
+
+            if (frame) compiler_emit_instruction(compiler, INST_EXIT);
+        }
+
+        if (frame) {
+            compiler_emit_var_def(compiler, scope_size, compiler->scope->size);
+        }
+
         compiler_exit(compiler);
         break;
     case ex_IfElse:
@@ -285,12 +430,508 @@ RESULT compile_expr(Compiler *compiler, Expression *expr) {
     return FALSE;
 }
 
+bool expr_assigns(Expression *expr);
+
+bool statement_assigns(Statement *statement) {
+    switch (statement->type) {
+    case st_Expression:
+    case st_Print:
+    case st_Send:
+        return expr_assigns(&statement->expr);
+    case st_While:
+        return expr_assigns(&statement->while_condition) || expr_assigns(&statement->while_body);
+    }
+
+    UNREACHABLE();
+}
+
+bool expr_assigns(Expression *expr) {
+    switch (expr->type) {
+    case ex_BinaryOperation:
+        return expr->bin_op == op_Assignment || expr->bin_op == op_Reassignment || expr_assigns(expr->lhs) || expr_assigns(expr->rhs);
+    case ex_UnaryOperation:
+        return expr_assigns(expr->oprand);
+    case ex_Block:
+        for (u64 i = 0; i < expr->num_statements; ++i) {
+            if (statement_assigns(expr->statements + i)) return TRUE;
+        }
+
+        return FALSE;
+    case ex_IfElse:
+        return expr_assigns(expr->condition) || expr_assigns(expr->on_true) || (expr->on_false && expr_assigns(expr->on_false));
+    case ex_Function:
+    case ex_Identifier:
+    case ex_Integer:
+    case ex_Null:
+        return FALSE;
+    }
+
+    UNREACHABLE();
+}
+
+u64 expr_declarations(Expression *expr);
+
+u64 statement_declarations(Statement *statement) {
+    switch (statement->type) {
+    case st_Expression:
+    case st_Print:
+    case st_Send:
+        return expr_declarations(&statement->expr);
+    case st_While:
+        return expr_declarations(&statement->while_condition) + expr_declarations(&statement->while_body);
+    }
+
+    UNREACHABLE();
+}
+
+// NOTE: an upper bound on the slots a frame's variables take, sibling blocks actually share theirs
+u64 expr_declarations(Expression *expr) {
+    u64 count = 0;
+
+    switch (expr->type) {
+    case ex_BinaryOperation:
+        return (expr->bin_op == op_Assignment) + expr_declarations(expr->lhs) + expr_declarations(expr->rhs);
+    case ex_UnaryOperation:
+        return expr_declarations(expr->oprand);
+    case ex_Block:
+        for (u64 i = 0; i < expr->num_statements; ++i) {
+            count += statement_declarations(expr->statements + i);
+        }
+
+        return count;
+    case ex_IfElse:
+        return expr_declarations(expr->condition) + expr_declarations(expr->on_true) + (expr->on_false ? expr_declarations(expr->on_false) : 0);
+    case ex_Function:
+    case ex_Identifier:
+    case ex_Integer:
+    case ex_Null:
+        return 0;
+    }
+
+    UNREACHABLE();
+}
+
+bool reg_eq(Reg a, Reg b) {
+    return a.temp == b.temp && a.index == b.index;
+}
+
+Reg reg_temp(Compiler *compiler) {
+    Reg reg = { TRUE, compiler->temps++ };
+
+    if (compiler->temps > compiler->max_temps) {
+        compiler->max_temps = compiler->temps;
+    }
+
+    return reg;
+}
+
+void compiler_emit_move(Compiler *compiler, Reg dst, Reg src) {
+    if (!reg_eq(dst, src)) {
+        compiler_emit_instruction(compiler, RINST_MOVE);
+        compiler_emit_reg(compiler, dst);
+        compiler_emit_reg(compiler, src);
+    }
+}
+
+RESULT compile_reg_expr(Compiler *compiler, Expression *expr, Reg *hint, Reg *result);
+
+RESULT compile_reg_assignment(Compiler *compiler, Expression *expr, bool reassign, Reg *result) {
+    switch (expr->lhs->type) {
+        u64 ptr;
+        u64 depth;
+        Reg value;
+        Reg var;
+
+    case ex_Identifier:
+        if (reassign) {
+            // NOTE: the variable is only looked up first for the hint, the right-hand side can declare it and its
+            // errors come first like they do in compile_assignment
+            if (!scope_get(compiler, expr->lhs->symbol, &ptr, &depth)) {
+                var = (Reg) { FALSE, ptr };
+                CHECK(compile_reg_expr(compiler, expr->rhs, &var, &value));
+            }
+            else {
+                CHECK(compile_reg_expr(compiler, expr->rhs, NULL, &value));
+
+                if (scope_get(compiler, expr->lhs->symbol, &ptr, &depth)) {
+                    DISPATCH_ERROR_FMT(compiler->context, expr->lhs->line, "Variable not already defined `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->lhs->symbol)));
+                    return TRUE;
+                }
+
+                var = (Reg) { FALSE, ptr };
+            }
+        }
+        else {
+            CHECK(compile_reg_expr(compiler, expr->rhs, NULL, &value));
+            var = (Reg) { FALSE, scope_assign(compiler, expr->lhs->symbol) };
+        }
+
+        compiler_emit_move(compiler, var, value);
+        *result = var;
+        break;
+    default:
+        DISPATCH_ERROR(compiler->context, expr->lhs->line, "Invalid left-hand side of assignment");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+RESULT compile_reg_statement(Compiler *compiler, Statement *statement) {
+    u64 mark = compiler->temps;
+
+    switch (statement->type) {
+        u64 loop;
+        u64 end;
+        Reg reg;
+
+    case st_Expression:
+        CHECK(compile_reg_expr(compiler, &statement->expr, NULL, &reg));
+        break;
+    case st_Print:
+        CHECK(compile_reg_expr(compiler, &statement->expr, NULL, &reg));
+        compiler_emit_instruction(compiler, RINST_PRINT);
+        compiler_emit_reg(compiler, reg);
+        break;
+    case st_Send:
+        CHECK(compile_reg_expr(compiler, &statement->expr, &compiler->send_target, &reg));
+        compiler_emit_move(compiler, compiler->send_target, reg);
+        break;
+    case st_While:
+        loop = assembler_get_next(&compiler->assembler);
+        end = assembler_get_next(&compiler->assembler);
+
+        compiler_emit_label_def(compiler, loop);
+        CHECK(compile_reg_expr(compiler, &statement->while_condition, NULL, &reg));
+        compiler_emit_instruction(compiler, RINST_BRANCH_F);
+        compiler_emit_reg(compiler, reg);
+        compiler_emit_label_ref(compiler, end);
+        compiler->temps = mark;
+        CHECK(compile_reg_expr(compiler, &statement->while_body, NULL, &reg));
+        compiler_emit_instruction(compiler, RINST_JUMP);
+        compiler_emit_label_ref(compiler, loop);
+        compiler_emit_label_def(compiler, end);
+        break;
+    }
+
+    compiler->temps = mark;
+
+    return FALSE;
+}
+
+// NOTE: the result is left in `hint` when one is given and writing it early is safe, otherwise in a temporary or a variable
+RESULT compile_reg_expr(Compiler *compiler, Expression *expr, Reg *hint, Reg *result) {
+    switch (expr->type) {
+        u64 exit_point;
+        u64 scope_size;
+        u64 op_sstr;
+        u64 ptr;
+        u64 depth;
+        u64 on_true;
+        u64 end;
+        u64 mark;
+        bool frame;
+        Reg lhs;
+        Reg rhs;
+        Reg saved_target;
+
+    case ex_Integer:
+        *result = hint ? *hint : reg_temp(compiler);
+        compiler_emit_instruction(compiler, RINST_LOAD_INT);
+        compiler_emit_reg(compiler, *result);
+        compiler_emit_int(compiler, expr->integer);
+        break;
+    case ex_Null:
+        fprintf(stderr, FATAL "Got null expression");
+        exit(-1);
+    case ex_Identifier:
+        if (scope_get(compiler, expr->symbol, &ptr, &depth)) {
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Undefined variable `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->symbol)));
+            return TRUE;
+        }
+
+        *result = (Reg) { FALSE, ptr };
+        break;
+    case ex_BinaryOperation:
+        if (expr->bin_op == op_Assignment) {
+            CHECK(compile_reg_assignment(compiler, expr, FALSE, result));
+            break;
+        }
+
+        if (expr->bin_op == op_Reassignment) {
+            CHECK(compile_reg_assignment(compiler, expr, TRUE, result));
+            break;
+        }
+
+        mark = compiler->temps;
+        CHECK(compile_reg_expr(compiler, expr->lhs, NULL, &lhs));
+
+        // NOTE: a variable read on the left must not observe an assignment made on the right
+        if (!lhs.temp && expr_assigns(expr->rhs)) {
+            Reg copy = reg_temp(compiler);
+            compiler_emit_move(compiler, copy, lhs);
+            lhs = copy;
+        }
+
+        CHECK(compile_reg_expr(compiler, expr->rhs, NULL, &rhs));
+        compiler->temps = mark;
+
+        *result = hint ? *hint : reg_temp(compiler);
+        compiler_emit_instruction(compiler, RINST_ADD + expr->bin_op);
+        compiler_emit_reg(compiler, *result);
+        compiler_emit_reg(compiler, lhs);
+        compiler_emit_reg(compiler, rhs);
+        break;
+    case ex_UnaryOperation:
+        switch (expr->un_op) {
+        case op_Subtraction:
+            mark = compiler->temps;
+            CHECK(compile_reg_expr(compiler, expr->oprand, NULL, &rhs));
+            compiler->temps = mark;
+
+            *result = hint ? *hint : reg_temp(compiler);
+            compiler_emit_instruction(compiler, RINST_NEG);
+            compiler_emit_reg(compiler, *result);
+            compiler_emit_reg(compiler, rhs);
+            break;
+        default:
+            op_sstr = op_to_sstr(expr->un_op);
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Invalid unary operator `%s`", (char *) &op_sstr);
+            return TRUE;
+        }
+
+        break;
+    case ex_Block:
+        frame = compiler->scope == NULL;
+        exit_point = assembler_get_next(&compiler->assembler);
+
+        if (frame) {
+            scope_size = assembler_get_next(&compiler->assembler);
+            compiler->temp_base = expr_declarations(expr);
+            compiler_emit_instruction(compiler, RINST_SCOPE);
+            compiler_emit_var_ref(compiler, scope_size);
+        }
+
+        *result = hint ? *hint : reg_temp(compiler);
+        saved_target = compiler->send_target;
+        compiler->send_target = *result;
+        compiler_scope(compiler, frame);
+
+        for (u64 i = 0; i < expr->num_statements; ++i) {
+            CHECK(compile_reg_statement(compiler, expr->statements + i));
+
+            switch (expr->statements[i].type) {
+            case st_Send:
+                compiler_emit_instruction(compiler, RINST_JUMP);
+                compiler_emit_label_ref(compiler, exit_point);
+                break;
+            default:
+                break;
+            }
+        }
+
+        compiler_emit_instruction(compiler, RINST_LOAD_NONE);
+        compiler_emit_reg(compiler, *result);
+        compiler_emit_label_def(compiler, exit_point);
+
+        if (frame) {
+            compiler_emit_instruction(compiler, RINST_EXIT);
+            compiler_emit_var_def(compiler, scope_size, compiler->temp_base + compiler->max_temps);
+        }
+
+        compiler->send_target = saved_target;
+        compiler_exit(compiler);
+        break;
+    case ex_IfElse:
+        // NOTE: laid out like compile_expr's, else branch first, so both report the same error first
+        on_true = assembler_get_next(&compiler->assembler);
+        end = assembler_get_next(&compiler->assembler);
+
+        *result = hint ? *hint : reg_temp(compiler);
+        mark = compiler->temps;
+
+        CHECK(compile_reg_expr(compiler, expr->condition, NULL, &rhs));
+        compiler_emit_instruction(compiler, RINST_BRANCH);
+        compiler_emit_reg(compiler, rhs);
+        compiler_emit_label_ref(compiler, on_true);
+        compiler->temps = mark;
+
+        if (expr->on_false) {
+            CHECK(compile_reg_expr(compiler, expr->on_false, result, &rhs));
+            compiler_emit_move(compiler, *result, rhs);
+            compiler->temps = mark;
+        }
+        else {
+            compiler_emit_instruction(compiler, RINST_LOAD_NONE);
+            compiler_emit_reg(compiler, *result);
+        }
+
+        compiler_emit_instruction(compiler, RINST_JUMP);
+        compiler_emit_label_ref(compiler, end);
+        compiler_emit_label_def(compiler, on_true);
+
+        CHECK(compile_reg_expr(compiler, expr->on_true, result, &rhs));
+        compiler_emit_move(compiler, *result, rhs);
+        compiler->temps = mark;
+
+        compiler_emit_label_def(compiler, end);
+        break;
+    case ex_Function:
+        fprintf(stderr, FATAL "Function compilation");
+        exit(-1);
+        break;
+    }
+
+    return FALSE;
+}
+
+// NOTE: the top-level frame is compiled a statement at a time, rewinding the arena after each one so only the
+// AST of the statement being compiled is ever held, it never exits before the program halts so it stays on the stack,
+// syntax errors are still reported ahead of compile errors since parser_finish parses the rest after one
+RESULT compile_program(Compiler *compiler) {
+    Parser *parser = &compiler->context->parser;
+    Arena *arena = &compiler->context->arena;
+    u64 exit_point = assembler_get_next(&compiler->assembler);
+    u64 scope_size = assembler_get_next(&compiler->assembler);
+    bool sends = FALSE;
+
+#ifdef EBUG_HEAP_SCOPES
+    compiler_emit_instruction(compiler, INST_SCOPE_HEAP);
+#else
+    compiler_emit_instruction(compiler, INST_SCOPE);
+#endif
+
+    compiler_emit_var_ref(compiler, scope_size);
+    compiler_scope(compiler, TRUE);
+
+    while (!parser_done(parser)) {
+        ArenaMark mark = arena_mark(arena);
+
+        CHECK(parser_next(parser));
+        fold_statement(&parser->statement);
+
+        if (compile_statement(compiler, &parser->statement)) {
+            return parser_finish(parser);
+        }
+
+        if (parser->statement.type == st_Send) {
+            compiler_emit_instruction(compiler, INST_JUMP);
+            compiler_emit_label_ref(compiler, exit_point);
+            sends = TRUE;
+        }
+
+        arena_rewind(arena, mark);
+    }
+
+    if (sends) {
+        compiler_emit_instruction(compiler, INST_PUSH_NONE);
+        compiler_emit_label_def(compiler, exit_point);
+        compiler_emit_instruction(compiler, INST_EXIT);
+    }
+    else {
+        compiler_emit_instruction(compiler, INST_EXIT_NONE);
+    }
+
+    compiler_emit_instruction(compiler, INST_POP);
+    compiler_emit_var_def(compiler, scope_size, compiler->scope->size);
+    compiler_exit(compiler);
+
+    return FALSE;
+}
+
+// NOTE: temporaries only live within a statement, so each top-level statement places them above every variable
+// declared so far or by itself, and the frame is as large as the largest of those
+RESULT compile_reg_program(Compiler *compiler) {
+    Parser *parser = &compiler->context->parser;
+    Arena *arena = &compiler->context->arena;
+    u64 exit_point = assembler_get_next(&compiler->assembler);
+    u64 scope_size = assembler_get_next(&compiler->assembler);
+    u64 frame_size;
+
+    compiler_emit_instruction(compiler, RINST_SCOPE);
+    compiler_emit_var_ref(compiler, scope_size);
+    compiler_scope(compiler, TRUE);
+
+    compiler->send_target = (Reg) { FALSE, compiler->scope->ptr++ };
+    frame_size = compiler->scope->size = compiler->scope->ptr;
+
+    while (!parser_done(parser)) {
+        ArenaMark mark = arena_mark(arena);
+
+        CHECK(parser_next(parser));
+        fold_statement(&parser->statement);
+
+        compiler->temp_base = compiler->scope->ptr + statement_declarations(&parser->statement);
+        compiler->max_temps = 0;
+
+        if (compiler->optimize) {
+            if (ir_build(&compiler->ir, &parser->statement)) {
+                return parser_finish(parser);
+            }
+
+            ir_optimize(&compiler->ir);
+            ir_lower(&compiler->ir, &compiler->lowering);
+        }
+        else if (compile_reg_statement(compiler, &parser->statement)) {
+            return parser_finish(parser);
+        }
+
+        if (parser->statement.type == st_Send) {
+            compiler_emit_instruction(compiler, RINST_JUMP);
+            compiler_emit_label_ref(compiler, exit_point);
+        }
+
+        if (compiler->temp_base + compiler->max_temps > frame_size) {
+            frame_size = compiler->temp_base + compiler->max_temps;
+        }
+
+        arena_rewind(arena, mark);
+    }
+
+    compiler_emit_instruction(compiler, RINST_LOAD_NONE);
+    compiler_emit_reg(compiler, compiler->send_target);
+    compiler_emit_label_def(compiler, exit_point);
+    compiler_emit_instruction(compiler, RINST_EXIT);
+
+    if (compiler->scope->size > frame_size) {
+        frame_size = compiler->scope->size;
+    }
+
+    compiler_emit_var_def(compiler, scope_size, frame_size);
+    compiler_exit(compiler);
+
+    return FALSE;
+}
+
 RESULT compiler_compile(Compiler *compiler) {
-    CHECK(parser_next(&compiler->context->parser));
-    CHECK(compile_statement(compiler, &compiler->context->parser.statement));
-    compiler_emit_instruction(compiler, INST_HALT);
+    if (compiler->registers) {
+        CHECK(compile_reg_program(compiler));
+        compiler_emit_instruction(compiler, RINST_HALT);
+    }
+    else {
+        CHECK(compile_program(compiler));
+        compiler_emit_instruction(compiler, INST_HALT);
+    }
+
     assembler_assemble(&compiler->assembler);
+
+#ifdef EBUG_BYTECODE
+    PeepholeStats peephole = peephole_optimize(&compiler->assembler, compiler->registers);
+    printf("peephole: %llu of %llu instructions eliminated\n", peephole.eliminated, peephole.instructions);
+#else
+    peephole_optimize(&compiler->assembler, compiler->registers);
+#endif
+
     compiler->bytecode = compiler->assembler.bytecode.arr;
 
+#ifdef EBUG_BYTECODE
+    if (compiler->optimize) {
+        printf("ir: %llu of %llu instructions eliminated\n", compiler->ir.stats.eliminated, compiler->ir.stats.instructions);
+    }
+
+    printf("bytecode: %llu bytes, %llu with fixed 8 byte operands\n", compiler->assembler.bytecode.len,
+        compiler->assembler.bytecode.len + compiler->assembler.operands * 8 - compiler->assembler.operand_bytes);
+#endif
+
     return FALSE;
 }
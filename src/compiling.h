@@ -4,25 +4,116 @@
 #include "stack.h"
 #include "hashmap.h"
 #include "assembling.h"
+#include "symbols.h"
+#include "ir.h"
+#include "lowering.h"
+#include "aot.h"
+
+#define INST_PUSH_INT   0x00 // NOTE: inst_names, the dispatch table in vm_run, and NUM_INSTRUCTIONS must change if this does
+#define INST_PUSH_NONE  0x01
+#define INST_PUSH       0x02
+#define INST_ADD        0x03
+#define INST_SUB        0x04
+#define INST_MUL        0x05
+#define INST_DIV        0x06
+#define INST_NEG        0x07
+#define INST_POP        0x08
+#define INST_PULL_TO    0x09
+#define INST_HALT       0x0A
+#define INST_SCOPE      0x0B
+#define INST_EXIT       0x0C
+#define INST_PRINT      0x0D
+#define INST_JUMP       0x0E
+#define INST_BRANCH     0x0F
+#define INST_BRANCH_F   0x10
+#define INST_SCOPE_HEAP 0x11
+
+#define INST_STORE_POP     0x12 // NOTE: superinstructions, each one stands for a common sequence of the ones above
+#define INST_ADD_SLOT_IMM  0x13
+#define INST_SUB_SLOT_IMM  0x14
+#define INST_MUL_SLOT_IMM  0x15
+#define INST_EXIT_NONE     0x16
+#define INST_BRANCH_F_SLOT 0x17
+
+#define NUM_INSTRUCTIONS 24
+
+#define RINST_LOAD_INT  0x00 // NOTE: reg_inst_names, the dispatch table in vm_run_registers, and NUM_REG_INSTRUCTIONS must change if this does
+#define RINST_LOAD_NONE 0x01
+#define RINST_MOVE      0x02
+#define RINST_ADD       0x03
+#define RINST_SUB       0x04
+#define RINST_MUL       0x05
+#define RINST_DIV       0x06
+#define RINST_NEG       0x07
+#define RINST_HALT      0x08
+#define RINST_SCOPE     0x09
+#define RINST_EXIT      0x0A
+#define RINST_PRINT     0x0B
+#define RINST_JUMP      0x0C
+#define RINST_BRANCH    0x0D
+#define RINST_BRANCH_F  0x0E
+
+#define NUM_REG_INSTRUCTIONS 15
 
 typedef struct __Context__ Context;
 
 typedef struct __Scope__ {
-    HashMap vars;
+    u64 bindings;
+    u64 level;
     u64 ptr;
+    u64 size;
 
     struct __Scope__ *parent;
+    struct __Scope__ *frame;
 } Scope;
 
+#define NO_BINDING ((u32) -1)
+
+// NOTE: `shadowed` is the binding of the same symbol this one hides until its scope exits
 typedef struct {
+    Symbol symbol;
+    u32 shadowed;
+    u64 ptr;
+    Scope *scope;
+} Binding;
+
+typedef struct {
+    bool temp;
+    u64 index;
+} Reg;
+
+typedef struct __Compiler__ {
     Context *context;
     Scope *scope;
+    Stack bindings;
+    Stack innermost;
     Assembler assembler;
     u8 *bytecode;
 
+    bool registers;
+    bool optimize;
+    u64 temp_base;
+    u64 temps;
+    u64 max_temps;
+    Reg send_target;
+
+    Ir ir;
+    Lowering lowering;
+    Aot aot;
+
     u64 uid_counter;
 } Compiler;
 
 void compiler_init(Compiler *compiler, Context *context);
 void compiler_deinit(Compiler *compiler);
 RESULT compiler_compile(Compiler *compiler);
+void compiler_scope(Compiler *compiler, bool frame);
+void compiler_exit(Compiler *compiler);
+u64 scope_assign(Compiler *compiler, Symbol symbol);
+RESULT scope_get(Compiler *compiler, Symbol symbol, u64 *ptr, u64 *depth);
+View symbol_name(Compiler *compiler, Symbol symbol);
+void compiler_emit_instruction(Compiler *compiler, u8 instruction);
+void compiler_emit_int(Compiler *compiler, i64 integer);
+void compiler_emit_label_def(Compiler *compiler, u64 label);
+void compiler_emit_label_ref(Compiler *compiler, u64 label);
+void compiler_emit_reg(Compiler *compiler, Reg reg);
@@ -10,12 +10,33 @@ void handle_error(Context *context, bool error) {
     }
 }
 
-void context_init(Context *context, const char *path) {
-    context->program = read_file(path);
+// NOTE: for errors in the bytecode itself, which the verifier reports by offset as there's no line to blame
+void handle_bytecode_error(Context *context, bool error) {
+    if (error) {
+        context_deinit(context);
+        fprintf(stderr, ERR "%s\n", context->error_msg);
+        exit(1);
+    }
+}
+
+void context_init(Context *context, const char *path, u64 flags) {
+    source_open(&context->source, path);
+    context->path = path;
+    context->program = context->source.data;
+    context->cache.data = NULL;
+    context->flags = flags;
+    arena_init(&context->arena);
     parser_init(&context->parser, context);
     compiler_init(&context->compiler, context);
+    context->compiler.registers = (flags & CONTEXT_REGISTERS) != 0;
+    context->compiler.optimize = (flags & CONTEXT_OPTIMIZE) != 0;
     vm_init(&context->vm, context);
+    context->vm.jit.enabled = (flags & CONTEXT_JIT) && !(flags & CONTEXT_REGISTERS); // NOTE: only stack bytecode is compiled
     handle_error(context, lexer_init(&context->lexer, context));
+
+    if (flags & CONTEXT_CACHE) {
+        cache_load(context);
+    }
 }
 
 void context_deinit(Context *context) {
@@ -23,13 +44,83 @@ void context_deinit(Context *context) {
     parser_deinit(&context->parser);
     compiler_deinit(&context->compiler);
     vm_deinit(&context->vm);
-    heap_dealloc(context->program);
+    arena_deinit(&context->arena);
+    source_close(&context->source);
+
+    if (context->cache.data) {
+        source_close(&context->cache);
+    }
+}
+
+#ifdef EBUG_LEXER
+// NOTE: lexes the whole program once up front with a throwaway lexer, including interning into its own symbol table
+void lexer_benchmark(Context *context) {
+    Lexer lexer;
+    u64 tokens = 0;
+    u64 start = time_ns();
+
+    handle_error(context, lexer_init(&lexer, context));
+
+    while (lexer.token_type != tt_Eof) {
+        handle_error(context, lexer_next(&lexer));
+        tokens += 1;
+    }
+
+    double seconds = (time_ns() - start) / 1e9;
+    fprintf(stderr, "lexed %llu bytes, %llu tokens in %.3fs (%.1f MB/s)\n", lexer.index, tokens, seconds, lexer.index / seconds / 1e6);
+
+    lexer_deinit(&lexer);
+}
+#endif
+
+RESULT context_verify(Context *context) {
+    if (context->flags & CONTEXT_REGISTERS) {
+        return verify_reg_program(context, context->vm.program, context->vm.program_len, &context->verified);
+    }
+
+    return verify_program(context, context->vm.program, context->vm.program_len, &context->verified);
 }
 
+// NOTE: every program is verified before it runs, which is what lets the VM skip its own checks
 void context_run(Context *context) {
-    handle_error(context, compiler_compile(&context->compiler));
-    context->vm.program = context->compiler.bytecode;
+#ifdef EBUG_LEXER
+    lexer_benchmark(context);
+#endif
+
+#ifdef EBUG_HASHMAP
+    hashmap_benchmark();
+#endif
+
+    if (context->flags & CONTEXT_AOT) {
+        handle_error(context, aot_translate(&context->compiler.aot));
+        aot_write(&context->compiler.aot, stdout);
+        return;
+    }
+
+    // NOTE: a cache that matches its source but fails verification is corrupt, so it's compiled and written again
+    if (context->cache.data && context_verify(context)) {
+        source_close(&context->cache);
+        context->cache.data = NULL;
+    }
+
+    if (context->cache.data == NULL) {
+        handle_error(context, compiler_compile(&context->compiler));
+        arena_deinit(&context->arena);
+        context->vm.program = context->compiler.bytecode;
+        context->vm.program_len = context->compiler.assembler.bytecode.len;
+        handle_bytecode_error(context, context_verify(context));
+
+        if (context->flags & CONTEXT_CACHE) {
+            cache_store(context);
+        }
+    }
+
+    if (context->flags & CONTEXT_REGISTERS) {
+        handle_error(context, vm_run_registers(&context->vm));
+    }
+    else {
+        handle_error(context, vm_run(&context->vm));
+    }
 
-    handle_error(context, vm_run(&context->vm));
     ASSERT(context->vm.op_stack.len == 0);
 }
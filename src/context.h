@@ -4,11 +4,19 @@
 #include "parsing.h"
 #include "compiling.h"
 #include "vm.h"
+#include "cache.h"
+#include "verifier.h"
 #include "string.h"
 
 #define ERROR_MSG_LEN 512
 
 #define DISPATCH_ERROR_FMT(context, line, format, ...) do { context->error_line = line; sprintf_s(context->error_msg, ERROR_MSG_LEN, format, __VA_ARGS__); } while (FALSE)
+#define CONTEXT_REGISTERS (1 << 0)
+#define CONTEXT_CACHE     (1 << 1)
+#define CONTEXT_OPTIMIZE  (1 << 2)
+#define CONTEXT_JIT       (1 << 3)
+#define CONTEXT_AOT       (1 << 4)
+
 #define DISPATCH_ERROR(context, line, str) do { context->error_line = line; strcpy_s(context->error_msg, ERROR_MSG_LEN, str); } while (FALSE)
 
 typedef struct __Context__ {
@@ -16,13 +24,19 @@ typedef struct __Context__ {
     Parser parser;
     Compiler compiler;
     Vm vm;
+    Arena arena; // NOTE: the AST and compiler scopes, freed as soon as compilation ends
 
-    char *program;
+    const char *path;
+    SourceFile source;
+    SourceFile cache; // NOTE: the mapped bytecode cache, `data` is NULL unless it was loaded
+    Verified verified;
+    const char *program; // NOTE: the source's data, which the lexer reads past the end of up to FILE_PADDING bytes
+    u64 flags;
 
     u64 error_line;
     char error_msg[ERROR_MSG_LEN];
 } Context;
 
-void context_init(Context *context, const char *path);
+void context_init(Context *context, const char *path, u64 flags);
 void context_deinit(Context *context);
 void context_run(Context *context);
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include "folding.h"
+
+// NOTE: arithmetic either produces an integer or stops the program, so these never evaluate to anything else
+bool is_integer(Expression *expr) {
+    switch (expr->type) {
+    case ex_Integer:
+    case ex_UnaryOperation:
+        return TRUE;
+    case ex_BinaryOperation:
+        return expr->bin_op <= op_Division;
+    default:
+        return FALSE;
+    }
+}
+
+bool is_literal(Expression *expr, i64 value) {
+    return expr->type == ex_Integer && (i64) expr->integer == value;
+}
+
+void make_literal(Expression *expr, i64 value) {
+    expr->type = ex_Integer;
+    expr->integer = (u64) value;
+}
+
+// NOTE: computes exactly what inst_add and friends would, division by zero and INT64_MIN / -1 trap there, so
+// they're left for the VM
+bool fold_arithmetic(OperatorType op, i64 lhs, i64 rhs, i64 *result) {
+    switch (op) {
+    case op_Addition:       *result = (i64) ((u64) lhs + (u64) rhs); return TRUE;
+    case op_Subtraction:    *result = (i64) ((u64) lhs - (u64) rhs); return TRUE;
+    case op_Multiplication: *result = (i64) ((u64) lhs * (u64) rhs); return TRUE;
+    case op_Division:
+        if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) return FALSE;
+
+        *result = lhs / rhs;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+void fold_expr(Expression *expr);
+
+// NOTE: identities only drop an operation when the operand is known to be an integer, since with anything else
+// the operation is what reports the type error
+void fold_binary(Expression *expr) {
+    Expression *lhs = expr->lhs;
+    Expression *rhs = expr->rhs;
+    i64 result;
+
+    fold_expr(lhs);
+    fold_expr(rhs);
+
+    if (lhs->type == ex_Integer && rhs->type == ex_Integer) {
+        if (fold_arithmetic(expr->bin_op, (i64) lhs->integer, (i64) rhs->integer, &result)) {
+            make_literal(expr, result);
+        }
+
+        return;
+    }
+
+    switch (expr->bin_op) {
+    case op_Addition:
+        if (is_literal(rhs, 0) && is_integer(lhs)) *expr = *lhs;
+        else if (is_literal(lhs, 0) && is_integer(rhs)) *expr = *rhs;
+        break;
+    case op_Subtraction:
+        if (is_literal(rhs, 0) && is_integer(lhs)) {
+            *expr = *lhs;
+        }
+        else if (is_literal(lhs, 0) && is_integer(rhs)) {
+            expr->type = ex_UnaryOperation;
+            expr->un_op = op_Subtraction;
+            expr->oprand = rhs;
+        }
+        break;
+    case op_Multiplication:
+        if (is_literal(rhs, 1) && is_integer(lhs)) *expr = *lhs;
+        else if (is_literal(lhs, 1) && is_integer(rhs)) *expr = *rhs;
+        break;
+    case op_Division:
+        if (is_literal(rhs, 1) && is_integer(lhs)) *expr = *lhs;
+        break;
+    default:
+        break;
+    }
+}
+
+void fold_unary(Expression *expr) {
+    Expression *oprand = expr->oprand;
+
+    fold_expr(oprand);
+
+    if (expr->un_op != op_Subtraction) {
+        return;
+    }
+
+    if (oprand->type == ex_Integer) {
+        make_literal(expr, (i64) (~oprand->integer + 1));
+    }
+    else if (oprand->type == ex_UnaryOperation && oprand->un_op == op_Subtraction && is_integer(oprand->oprand)) {
+        *expr = *oprand->oprand;
+    }
+}
+
+void fold_expr(Expression *expr) {
+    switch (expr->type) {
+    case ex_BinaryOperation:
+        fold_binary(expr);
+        break;
+    case ex_UnaryOperation:
+        fold_unary(expr);
+        break;
+    case ex_Block:
+        for (u64 i = 0; i < expr->num_statements; ++i) {
+            fold_statement(expr->statements + i);
+        }
+        break;
+    case ex_IfElse:
+        fold_expr(expr->condition);
+        fold_expr(expr->on_true);
+        if (expr->on_false) fold_expr(expr->on_false);
+        break;
+    case ex_Function:
+        fold_expr(expr->body);
+        break;
+    case ex_Identifier:
+    case ex_Integer:
+    case ex_Null:
+        break;
+    }
+}
+
+// NOTE: rewrites the tree in place, so it runs on each statement between parsing and compiling
+void fold_statement(Statement *statement) {
+    switch (statement->type) {
+    case st_Expression:
+    case st_Print:
+    case st_Send:
+        fold_expr(&statement->expr);
+        break;
+    case st_While:
+        fold_expr(&statement->while_condition);
+        fold_expr(&statement->while_body);
+        break;
+    }
+}
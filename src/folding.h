@@ -0,0 +1,7 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "parsing.h"
+
+bool fold_arithmetic(OperatorType op, i64 lhs, i64 rhs, i64 *result);
+void fold_statement(Statement *statement);
@@ -1,52 +1,347 @@
+#include <string.h>
 #include "gc.h"
 #include "vm.h"
 
-void dealloc(Object *obj) {
-    switch (obj->type) {
-    default:
-        break;
-    }
+#define GC_INITIAL_THRESHOLD (1 << 20)
+#define NURSERY_SIZE (256 << 10)
+#define NURSERY_MAX_OBJECT (NURSERY_SIZE / 4)
+
+u64 scope_bytes(VmScope *scope) {
+    return sizeof (VmScope) + scope->size * sizeof (Object);
+}
+
+void dealloc(Gc *gc, VmScope *scope) {
+    gc->allocated -= scope_bytes(scope);
+    heap_dealloc(scope->stack);
+    heap_dealloc(scope);
 }
 
 void gc_init(Gc *gc) {
-    stack_init(&gc->allocations, sizeof (Object));
+    stack_init(&gc->allocations, sizeof (VmScope *));
+    stack_init(&gc->boxes, sizeof (IntBox *));
+    stack_init(&gc->gray, sizeof (VmScope *));
+    stack_init(&gc->remembered, sizeof (VmScope *));
     gc->mark = 0;
+
+    gc->nursery = heap_alloc(NURSERY_SIZE, sizeof (u8));
+    gc->nursery_top = gc->nursery;
+    gc->nursery_end = gc->nursery + NURSERY_SIZE;
+
+    gc->allocated = 0;
+    gc->threshold = GC_INITIAL_THRESHOLD;
+    memset(&gc->stats, 0, sizeof (GcStats));
 }
 
 void gc_deinit(Gc *gc) {
+#ifdef EBUG_GC
+    printf("gc: %llu minor collections, %llu bytes promoted, %.3fms total minor pause, %.3fms max minor pause\n",
+        gc->stats.minor_collections, gc->stats.bytes_promoted, gc->stats.minor_pause_ns / 1e6, gc->stats.max_minor_pause_ns / 1e6);
+    printf("gc: %llu collections, %llu bytes freed, %.3fms total pause, %.3fms max pause\n",
+        gc->stats.collections, gc->stats.bytes_freed, gc->stats.pause_ns / 1e6, gc->stats.max_pause_ns / 1e6);
+#endif
+
     for (u64 i = 0; i < stack_len(&gc->allocations); ++i) {
-        Object *obj = stack_index(&gc->allocations, i);
-        dealloc(obj);
+        dealloc(gc, *(VmScope **) stack_index(&gc->allocations, i));
+    }
+
+    for (u64 i = 0; i < stack_len(&gc->boxes); ++i) {
+        heap_dealloc(*(IntBox **) stack_index(&gc->boxes, i));
     }
 
+    heap_dealloc(gc->nursery);
     stack_deinit(&gc->allocations);
+    stack_deinit(&gc->boxes);
+    stack_deinit(&gc->gray);
+    stack_deinit(&gc->remembered);
+}
+
+VmScope *gc_alloc_old(Gc *gc, u64 size) {
+    VmScope *scope = heap_alloc(1, sizeof (VmScope));
+
+    scope->stack = heap_alloc(size, sizeof (Object));
+    scope->parent = NULL;
+    scope->size = size;
+    scope->heap = TRUE;
+    scope->young = FALSE;
+    scope->remembered = FALSE;
+    scope->mark = gc->mark;
+    scope->forward = NULL;
+
+    stack_push(&gc->allocations, &scope);
+    gc->allocated += scope_bytes(scope);
+
+    return scope;
+}
+
+void gc_write_barrier(Gc *gc, VmScope *scope) {
+    if (!scope->remembered) {
+        scope->remembered = TRUE;
+        stack_push(&gc->remembered, &scope);
+    }
+}
+
+// NOTE: small scopes are bump allocated in the nursery, large ones go straight to the old space
+VmScope *gc_alloc_scope(Gc *gc, Vm *vm, u64 size) {
+    u64 bytes = sizeof (VmScope) + size * sizeof (Object);
+    VmScope *scope;
+
+    if (bytes > NURSERY_MAX_OBJECT) {
+        if (gc->allocated >= gc->threshold) {
+            gc_collect(gc, vm);
+        }
+
+        scope = gc_alloc_old(gc, size);
+        scope->parent = vm->scope;
+        memset(scope->stack, 0, size * sizeof (Object));
+
+        if (scope->parent && scope->parent->young) {
+            gc_write_barrier(gc, scope);
+        }
+
+        return scope;
+    }
+
+    if (gc->nursery_top + bytes > gc->nursery_end) {
+        gc_minor(gc, vm);
+
+        if (gc->allocated >= gc->threshold) {
+            gc_collect(gc, vm);
+        }
+    }
+
+    scope = (VmScope *) gc->nursery_top;
+    gc->nursery_top += bytes;
+
+    scope->stack = (Object *) (scope + 1);
+    scope->parent = vm->scope;
+    scope->size = size;
+    scope->heap = TRUE;
+    scope->young = TRUE;
+    scope->remembered = FALSE;
+    scope->mark = gc->mark;
+    scope->forward = NULL;
+    memset(scope->stack, 0, size * sizeof (Object));
+
+    return scope;
+}
+
+// NOTE: boxes are never young, they go straight to the old space and only a full collection frees them
+IntBox *gc_alloc_box(Gc *gc, Vm *vm, i64 value) {
+    if (gc->allocated >= gc->threshold) {
+        gc_collect(gc, vm);
+    }
+
+    IntBox *box = heap_alloc(1, sizeof (IntBox));
+
+    box->value = value;
+    box->mark = gc->mark;
+
+    stack_push(&gc->boxes, &box);
+    gc->allocated += sizeof (IntBox);
+
+    return box;
+}
+
+VmScope *gc_evacuate(Gc *gc, VmScope *scope) {
+    if (scope == NULL || !scope->young) {
+        return scope;
+    }
+
+    if (scope->forward) {
+        return scope->forward;
+    }
+
+    VmScope *promoted = gc_alloc_old(gc, scope->size);
+
+    memcpy(promoted->stack, scope->stack, scope->size * sizeof (Object));
+    promoted->parent = scope->parent;
+    scope->forward = promoted;
+
+    stack_push(&gc->gray, &promoted);
+    gc->stats.bytes_promoted += scope_bytes(promoted);
+
+    return promoted;
+}
+
+void gc_evacuate_object(Gc *gc, Object *obj) {
+    switch (OBJ_TYPE(*obj)) {
+    case obj_Scope:
+        *obj = MAKE_SCOPE(gc_evacuate(gc, OBJ_SCOPE(*obj)));
+        break;
+    default:
+        break;
+    }
+}
+
+void gc_evacuate_slots(Gc *gc, VmScope *scope) {
+    for (u64 i = 0; i < scope->size; ++i) {
+        gc_evacuate_object(gc, scope->stack + i);
+    }
+
+    scope->parent = gc_evacuate(gc, scope->parent);
+}
+
+FrameChunk *first_chunk(Vm *vm) {
+    FrameChunk *chunk = vm->frames;
+
+    while (chunk && chunk->prev) {
+        chunk = chunk->prev;
+    }
+
+    return chunk;
+}
+
+// NOTE: survivors are promoted straight to the old space, so the pause only depends on the roots and what survives
+void gc_minor(Gc *gc, Vm *vm) {
+    u64 start = time_ns();
+
+    for (u64 i = 0; i < stack_len(&vm->op_stack); ++i) {
+        gc_evacuate_object(gc, stack_index(&vm->op_stack, i));
+    }
+
+    for (FrameChunk *chunk = first_chunk(vm); chunk; chunk = chunk->next) {
+        for (u8 *ptr = (u8 *) (chunk + 1); ptr < chunk->top; ptr += scope_bytes((VmScope *) ptr)) {
+            gc_evacuate_slots(gc, (VmScope *) ptr);
+        }
+    }
+
+    for (u64 i = 0; i < stack_len(&gc->remembered); ++i) {
+        VmScope *scope = *(VmScope **) stack_index(&gc->remembered, i);
+
+        scope->remembered = FALSE;
+        gc_evacuate_slots(gc, scope);
+    }
+
+    gc->remembered.len = 0;
+    vm->scope = gc_evacuate(gc, vm->scope);
+
+    while (gc->gray.len) {
+        VmScope *scope;
+        stack_pop(&gc->gray, &scope);
+        gc_evacuate_slots(gc, scope);
+    }
+
+    gc->nursery_top = gc->nursery;
+
+    u64 pause = time_ns() - start;
+
+    gc->stats.minor_collections += 1;
+    gc->stats.minor_pause_ns += pause;
+
+    if (pause > gc->stats.max_minor_pause_ns) {
+        gc->stats.max_minor_pause_ns = pause;
+    }
 }
 
-Object *gc_alloc(Gc *gc) {
-    Object *ptr = heap_alloc(1, sizeof (Object));
-    ptr->mark = gc->mark;
-    stack_push(&gc->allocations, &ptr);
-    return ptr;
+void gc_mark_scope(Gc *gc, VmScope *scope) {
+    if (scope == NULL || !scope->heap || scope->mark == gc->mark) {
+        return;
+    }
+
+    scope->mark = gc->mark;
+    stack_push(&gc->gray, &scope);
 }
 
-void gc_mark(Gc *gc, Object *obj) {
-    obj->mark = gc->mark;
+void gc_mark_object(Gc *gc, Object *obj) {
+    switch (OBJ_TYPE(*obj)) {
+#ifdef TAGGED_VALUES
+    case obj_Integer:
+        if (OBJ_BOXED(*obj)) {
+            OBJ_BOX(*obj)->mark = gc->mark;
+        }
 
-    switch (obj->type) {
+        break;
+#endif
+    case obj_Scope:
+        gc_mark_scope(gc, OBJ_SCOPE(*obj));
+        break;
     default:
         break;
     }
 }
 
-void gc_collect(Gc *gc, Object *base) {
+void gc_mark_slots(Gc *gc, VmScope *scope) {
+    for (u64 i = 0; i < scope->size; ++i) {
+        gc_mark_object(gc, scope->stack + i);
+    }
+
+    gc_mark_scope(gc, scope->parent);
+}
+
+// NOTE: frames on the frame stack are always live, so they are scanned but never marked
+void gc_mark_roots(Gc *gc, Vm *vm) {
+    for (u64 i = 0; i < stack_len(&vm->op_stack); ++i) {
+        gc_mark_object(gc, stack_index(&vm->op_stack, i));
+    }
+
+    for (FrameChunk *chunk = first_chunk(vm); chunk; chunk = chunk->next) {
+        for (u8 *ptr = (u8 *) (chunk + 1); ptr < chunk->top; ptr += scope_bytes((VmScope *) ptr)) {
+            gc_mark_slots(gc, (VmScope *) ptr);
+        }
+    }
+
+    gc_mark_scope(gc, vm->scope);
+}
+
+// NOTE: a full collection empties the nursery first, so only the old space is swept
+void gc_collect(Gc *gc, Vm *vm) {
+    if (gc->nursery_top != gc->nursery) {
+        gc_minor(gc, vm);
+    }
+
+    u64 start = time_ns();
+    u64 before = gc->allocated;
+
     gc->mark = !gc->mark;
-    gc_mark(gc, base);
+    gc_mark_roots(gc, vm);
+
+    while (gc->gray.len) {
+        VmScope *scope;
+        stack_pop(&gc->gray, &scope);
+        gc_mark_slots(gc, scope);
+    }
+
+    VmScope **allocations = (VmScope **) gc->allocations.arr;
+    u64 live = 0;
 
     for (u64 i = 0; i < stack_len(&gc->allocations); ++i) {
-        Object *obj = stack_index(&gc->allocations, i);
+        if (allocations[i]->mark == gc->mark) {
+            allocations[live++] = allocations[i];
+        }
+        else {
+            dealloc(gc, allocations[i]);
+        }
+    }
+
+    gc->allocations.len = live * sizeof (VmScope *);
+
+    IntBox **boxes = (IntBox **) gc->boxes.arr;
+    live = 0;
 
-        if (obj->mark != gc->mark) {
-            dealloc(obj);
+    for (u64 i = 0; i < stack_len(&gc->boxes); ++i) {
+        if (boxes[i]->mark == gc->mark) {
+            boxes[live++] = boxes[i];
+        }
+        else {
+            gc->allocated -= sizeof (IntBox);
+            heap_dealloc(boxes[i]);
         }
     }
+
+    gc->boxes.len = live * sizeof (IntBox *);
+    gc->threshold = gc->allocated * 2 > GC_INITIAL_THRESHOLD ? gc->allocated * 2 : GC_INITIAL_THRESHOLD;
+
+    u64 pause = time_ns() - start;
+
+    gc->stats.collections += 1;
+    gc->stats.bytes_freed += before - gc->allocated;
+    gc->stats.pause_ns += pause;
+
+    if (pause > gc->stats.max_pause_ns) {
+        gc->stats.max_pause_ns = pause;
+    }
+
+#ifdef EBUG_GC
+    printf("gc: collected %llu bytes in %.3fms, %llu bytes live\n", before - gc->allocated, pause / 1e6, gc->allocated);
+#endif
 }
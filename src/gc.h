@@ -4,13 +4,42 @@
 #include "stack.h"
 
 typedef struct __Object__ Object;
+typedef struct __VmScope__ VmScope;
+typedef struct __IntBox__ IntBox;
+typedef struct __Vm__ Vm;
+
+typedef struct {
+    u64 collections;
+    u64 pause_ns;
+    u64 max_pause_ns;
+    u64 bytes_freed;
+
+    u64 minor_collections;
+    u64 minor_pause_ns;
+    u64 max_minor_pause_ns;
+    u64 bytes_promoted;
+} GcStats;
 
 typedef struct {
     Stack allocations;
+    Stack boxes;
+    Stack gray;
+    Stack remembered;
     u8 mark;
+
+    u8 *nursery;
+    u8 *nursery_top;
+    u8 *nursery_end;
+
+    u64 allocated;
+    u64 threshold;
+    GcStats stats;
 } Gc;
 
 void gc_init(Gc *gc);
 void gc_deinit(Gc *gc);
-Object *gc_alloc(Gc *gc);
-void gc_collect(Gc *gc, Object *base);
+VmScope *gc_alloc_scope(Gc *gc, Vm *vm, u64 size);
+IntBox *gc_alloc_box(Gc *gc, Vm *vm, i64 value);
+void gc_write_barrier(Gc *gc, VmScope *scope);
+void gc_minor(Gc *gc, Vm *vm);
+void gc_collect(Gc *gc, Vm *vm);
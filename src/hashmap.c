@@ -2,141 +2,319 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define HASHMAP_SIZE 2
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define HASHMAP_SIZE GROUP_WIDTH
+#define CTRL_EMPTY 0x80
 #define OFFSET_BASIS 14695981039346656037UL
 #define PRIME 1099511628211
 
-u64 hash(const char *s) {
+u64 hash_len(const char *s, u64 len) {
+    u64 hash = OFFSET_BASIS;
+
+    for (u64 i = 0; i < len; ++i) {
+        hash ^= s[i];
+        hash *= PRIME;
+    }
+
+    return hash;
+}
+
+u64 hash_str(const char *s, u64 *len) {
     u64 hash = OFFSET_BASIS;
+    const char *start = s;
 
     for (; *s; ++s) {
         hash ^= *s;
         hash *= PRIME;
     }
 
+    *len = s - start;
     return hash;
 }
 
-void hashmap_init_len(HashMap *hm, u64 len) {
-    hm->map = heap_alloc(len, sizeof (Entry));
-    hm->len = len;
+// NOTE: the low 7 bits go in the control byte, the rest pick the starting group
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((u8) ((hash) & 0x7F))
 
-    for (u64 i = 0; i < hm->len; ++i) {
-        hm->map[i].token_type = et_Empty;
-    }
+// NOTE: GROUP_INDEX of the lowest set bit of the result is the first control byte in the group equal to `byte`
+#ifdef __SSE2__
+#define GROUP_INDEX(match) __builtin_ctzll(match)
+
+u64 group_match(const u8 *ctrl, u8 byte) {
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+}
+
+u64 group_match_empty(const u8 *ctrl) {
+    return (u32) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+#else
+#define GROUP_INDEX(match) (__builtin_ctzll(match) >> 3)
+#define LSB 0x0101010101010101ULL
+#define MSB 0x8080808080808080ULL
+
+// NOTE: may report a byte right after a true match, which only costs a hash compare
+u64 group_match(const u8 *ctrl, u8 byte) {
+    u64 group;
+    memcpy(&group, ctrl, sizeof (u64));
+
+    u64 diff = group ^ (LSB * byte);
+    return (diff - LSB) & ~diff & MSB;
+}
+
+u64 group_match_empty(const u8 *ctrl) {
+    u64 group;
+    memcpy(&group, ctrl, sizeof (u64));
+
+    return group & MSB;
+}
+#endif
+
+void hashmap_init_capacity(HashMap *hm, u64 capacity, Arena *arena) {
+    u64 bytes = capacity * sizeof (Entry) + capacity + GROUP_WIDTH;
+    u8 *block = arena ? arena_alloc(arena, bytes, sizeof (u8)) : heap_alloc(bytes, sizeof (u8));
+
+    hm->entries = (Entry *) block;
+    hm->ctrl = block + capacity * sizeof (Entry);
+    hm->capacity = capacity;
+    hm->len = 0;
+    hm->arena = arena;
+
+    memset(hm->ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
 }
 
 void hashmap_init(HashMap *hm) {
-    hashmap_init_len(hm, HASHMAP_SIZE);
+    hashmap_init_capacity(hm, HASHMAP_SIZE, NULL);
+}
+
+// NOTE: the map's storage belongs to the arena, so hashmap_deinit leaves it alone
+void hashmap_init_arena(HashMap *hm, Arena *arena) {
+    hashmap_init_capacity(hm, HASHMAP_SIZE, arena);
 }
 
 void hashmap_deinit(HashMap *hm) {
-    heap_dealloc(hm->map);
+    if (hm->arena == NULL) {
+        heap_dealloc(hm->entries);
+    }
+}
+
+void set_ctrl(HashMap *hm, u64 slot, u8 byte) {
+    hm->ctrl[slot] = byte;
+
+    if (slot < GROUP_WIDTH) {
+        hm->ctrl[hm->capacity + slot] = byte;
+    }
+}
+
+// NOTE: groups are probed triangularly, which visits every group once the capacity is a power of two
+u64 find_empty(HashMap *hm, u64 hash) {
+    u64 mask = hm->capacity - 1;
+    u64 pos = H1(hash) & mask;
+
+    for (u64 stride = GROUP_WIDTH;; stride += GROUP_WIDTH) {
+        u64 empty = group_match_empty(hm->ctrl + pos);
+
+        if (empty) {
+            return (pos + GROUP_INDEX(empty)) & mask;
+        }
+
+        pos = (pos + stride) & mask;
+    }
+}
+
+// NOTE: returns the entry holding the first `len` bytes of `key`, or NULL with `slot` set to where it would go
+Entry *find(HashMap *hm, const char *key, u64 len, u64 hash, u64 *slot) {
+    u64 mask = hm->capacity - 1;
+    u64 pos = H1(hash) & mask;
+    u8 h2 = H2(hash);
+
+    for (u64 stride = GROUP_WIDTH;; stride += GROUP_WIDTH) {
+        const u8 *group = hm->ctrl + pos;
+
+        for (u64 match = group_match(group, h2); match; match &= match - 1) {
+            Entry *entry = &hm->entries[(pos + GROUP_INDEX(match)) & mask];
+
+            if (entry->hash == hash && entry->len == len && memcmp(entry->key, key, len) == 0) {
+                return entry;
+            }
+        }
+
+        u64 empty = group_match_empty(group);
+
+        if (empty) {
+            *slot = (pos + GROUP_INDEX(empty)) & mask;
+            return NULL;
+        }
+
+        pos = (pos + stride) & mask;
+    }
 }
 
 void hashmap_rehash(HashMap *hm) {
     HashMap new;
 
-    hashmap_init_len(&new, hm->len * 2 + 1);
+    hashmap_init_capacity(&new, hm->capacity * 2, hm->arena);
 
-    for (u64 i = 0; i < hm->len; ++i) {
-        Entry entry = hm->map[i];
+    for (u64 i = 0; i < hm->capacity; ++i) {
+        if (hm->ctrl[i] != CTRL_EMPTY) {
+            Entry *entry = &hm->entries[i];
+            u64 slot = find_empty(&new, entry->hash);
 
-        if (entry.token_type == et_Occupied) {
-            hashmap_put(&new, entry.key, entry.value);
+            new.entries[slot] = *entry;
+            set_ctrl(&new, slot, H2(entry->hash));
         }
     }
 
+    new.len = hm->len;
     hashmap_deinit(hm);
+    *hm = new;
+}
+
+// NOTE: grows at 7/8 load, so `slot` may move
+Entry *insert(HashMap *hm, const char *key, u64 len, u64 hash, u64 value, u64 slot) {
+    if ((hm->len + 1) * 8 > hm->capacity * 7) {
+        hashmap_rehash(hm);
+        slot = find_empty(hm, hash);
+    }
+
+    Entry *entry = &hm->entries[slot];
 
-    hm->map = new.map;
-    hm->len = new.len;
+    entry->key = key;
+    entry->len = len;
+    entry->hash = hash;
+    entry->value = value;
+    set_ctrl(hm, slot, H2(hash));
+    hm->len += 1;
+
+    return entry;
 }
 
 RESULT hashmap_get(HashMap *hm, const char *key, u64 *value) {
-    u64 hash_val = hash(key) % hm->len;
-    u64 init_val = hash_val;
+    u64 len;
+    u64 hash_val = hash_str(key, &len);
+    u64 slot;
+    Entry *entry = find(hm, key, len, hash_val, &slot);
 
-    for (;;) {
-        Entry entry = hm->map[hash_val];
+    if (entry == NULL) {
+        return TRUE;
+    }
 
-        if (entry.token_type == et_Occupied) {
-            if (strcmp(entry.key, key) == 0) {
-                *value = entry.value;
-                return FALSE;
-            }
-        }
-        else {
-            return TRUE;
-        }
+    *value = entry->value;
+    return FALSE;
+}
 
-        hash_val += 1;
-        hash_val %= hm->len;
+// NOTE: looks up the first `len` bytes of `key`, which need not be terminated
+RESULT hashmap_get_len(HashMap *hm, const char *key, u64 len, u64 *value) {
+    u64 slot;
+    Entry *entry = find(hm, key, len, hash_len(key, len), &slot);
 
-        if (hash_val == init_val) {
-            return TRUE;
-        }
+    if (entry == NULL) {
+        return TRUE;
     }
-}
 
-void hashmap_put(HashMap *hm, const char *key, u64 value) {
-    u64 hash_val = hash(key) % hm->len;
-    u64 init_val = hash_val;
+    *value = entry->value;
+    return FALSE;
+}
 
-    for (;;) {
-        Entry *entry = &hm->map[hash_val];
+// NOTE: the map keeps `key` itself, so its first `len` bytes must outlive the map
+void hashmap_put_len(HashMap *hm, const char *key, u64 len, u64 value) {
+    u64 hash_val = hash_len(key, len);
+    u64 slot;
+    Entry *entry = find(hm, key, len, hash_val, &slot);
 
-        if (entry->token_type == et_Occupied) {
-            if (strcmp(entry->key, key) == 0) {
-                entry->value = value;
-                return;
-            }
-        }
-        else {
-            entry->key = key;
-            entry->value = value;
-            entry->token_type = et_Occupied;
-            return;
-        }
+    if (entry) {
+        entry->value = value;
+    }
+    else {
+        insert(hm, key, len, hash_val, value, slot);
+    }
+}
 
-        ++hash_val;
-        hash_val %= hm->len;
+void hashmap_put(HashMap *hm, const char *key, u64 value) {
+    u64 len;
+    u64 hash_val = hash_str(key, &len);
+    u64 slot;
+    Entry *entry = find(hm, key, len, hash_val, &slot);
 
-        if (hash_val == init_val) {
-            hashmap_rehash(hm);
-            hashmap_put(hm, key, value);
-            return;
-        }
+    if (entry) {
+        entry->value = value;
+    }
+    else {
+        insert(hm, key, len, hash_val, value, slot);
     }
 }
 
 bool hashmap_get_or_put(HashMap *hm, const char *key, u64 value, u64 *result) {
-    u64 hash_val = hash(key) % hm->len;
-    u64 init_val = hash_val;
+    u64 len;
+    u64 hash_val = hash_str(key, &len);
+    u64 slot;
+    Entry *entry = find(hm, key, len, hash_val, &slot);
 
-    for (;;) {
-        Entry *entry = &hm->map[hash_val];
+    if (entry) {
+        *result = entry->value;
+        return FALSE;
+    }
 
-        if (entry->token_type == et_Occupied) {
-            if (strcmp(entry->key, key) == 0) {
-                *result = entry->value;
-                return FALSE;
-            }
-        }
-        else {
-            entry->key = key;
-            entry->value = value;
-            entry->token_type = et_Occupied;
-            *result = entry->value;
-            return TRUE;
-        }
+    *result = insert(hm, key, len, hash_val, value, slot)->value;
+    return TRUE;
+}
 
-        hash_val += 1;
-        hash_val %= hm->len;
+#ifdef EBUG_HASHMAP
+#define BENCHMARK_KEY_LEN 16
+#define BENCHMARK_LOOKUPS 10000000
 
-        if (hash_val == init_val) {
-            hashmap_rehash(hm);
-            return hashmap_get_or_put(hm, key, value, result);
-        }
+// NOTE: keys look like identifiers, `ident_N` for the ones inserted and `other_N` for misses, every size does the same
+// number of lookups cycling through its keys so the rates compare across sizes
+void hashmap_benchmark_size(u64 size) {
+    char *hits = malloc(size * BENCHMARK_KEY_LEN);
+    char *misses = malloc(size * BENCHMARK_KEY_LEN);
+    u64 *lens = malloc(size * sizeof (u64));
+    u64 sum = 0;
+    u64 value;
+    HashMap hm;
+
+    for (u64 i = 0; i < size; ++i) {
+        lens[i] = sprintf_s(hits + i * BENCHMARK_KEY_LEN, BENCHMARK_KEY_LEN, "ident_%llu", i);
+        sprintf_s(misses + i * BENCHMARK_KEY_LEN, BENCHMARK_KEY_LEN, "other_%llu", i);
+    }
+
+    hashmap_init(&hm);
+
+    u64 start = time_ns();
+
+    for (u64 i = 0; i < size; ++i) {
+        hashmap_put_len(&hm, hits + i * BENCHMARK_KEY_LEN, lens[i], i);
     }
+
+    u64 inserted = time_ns();
+
+    for (u64 i = 0, key = 0; i < BENCHMARK_LOOKUPS; ++i, key = key + 1 == size ? 0 : key + 1) {
+        if (!hashmap_get_len(&hm, hits + key * BENCHMARK_KEY_LEN, lens[key], &value)) sum += value;
+    }
+
+    u64 hit = time_ns();
+
+    for (u64 i = 0, key = 0; i < BENCHMARK_LOOKUPS; ++i, key = key + 1 == size ? 0 : key + 1) {
+        if (!hashmap_get_len(&hm, misses + key * BENCHMARK_KEY_LEN, lens[key], &value)) sum += value;
+    }
+
+    u64 missed = time_ns();
+
+    fprintf(stderr, "hashmap %llu keys: insert all %.3fms, %.1fM hits/s, %.1fM misses/s (%llu)\n", size,
+            (inserted - start) / 1e6, BENCHMARK_LOOKUPS / ((hit - inserted) / 1e3), BENCHMARK_LOOKUPS / ((missed - hit) / 1e3), sum);
+
+    hashmap_deinit(&hm);
+    free(hits);
+    free(misses);
+    free(lens);
+}
+
+void hashmap_benchmark() {
+    hashmap_benchmark_size(10);
+    hashmap_benchmark_size(1000);
+    hashmap_benchmark_size(1000000);
 }
+#endif
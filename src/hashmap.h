@@ -2,24 +2,39 @@
 
 #include "auxiliary.h"
 
-typedef enum PACKED {
-    et_Occupied,
-    et_Empty,
-} EntryType;
+#ifdef __SSE2__
+#define GROUP_WIDTH 16
+#else
+#define GROUP_WIDTH 8
+#endif
 
+// NOTE: the full hash is kept per entry so that rehashing and most mismatches never touch the key
 typedef struct {
     const char *key;
+    u64 len;
+    u64 hash;
     u64 value;
-    EntryType token_type;
 } Entry;
 
+// NOTE: `ctrl` holds one byte per slot, either CTRL_EMPTY or the low 7 bits of the slot's hash,
+// followed by a copy of the first GROUP_WIDTH bytes so that a group can be loaded from any slot
 typedef struct {
-    Entry *map;
+    Entry *entries;
+    u8 *ctrl;
+    u64 capacity;
     u64 len;
+    Arena *arena;
 } HashMap;
 
 void hashmap_init(HashMap *hm);
+void hashmap_init_arena(HashMap *hm, Arena *arena);
 void hashmap_deinit(HashMap *hm);
 RESULT hashmap_get(HashMap *hm, const char *key, u64 *value);
+RESULT hashmap_get_len(HashMap *hm, const char *key, u64 len, u64 *value);
 void hashmap_put(HashMap *hm, const char *key, u64 value);
+void hashmap_put_len(HashMap *hm, const char *key, u64 len, u64 value);
 bool hashmap_get_or_put(HashMap *hm, const char *key, u64 value, u64 *result);
+
+#ifdef EBUG_HASHMAP
+void hashmap_benchmark();
+#endif
@@ -0,0 +1,802 @@
+#include <string.h>
+#include "ir.h"
+#include "folding.h"
+#include "context.h"
+
+#define IR_TABLE_SIZE 64
+
+void ir_table_init(IrTable *table) {
+    table->capacity = IR_TABLE_SIZE;
+    table->len = 0;
+    table->gen = 1;
+    table->slots = heap_alloc(table->capacity, sizeof (IrSlot));
+    memset(table->slots, 0, table->capacity * sizeof (IrSlot));
+}
+
+u64 ir_table_hash(u8 op, u64 key) {
+    u64 hash = (key ^ ((u64) op << 56)) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+// NOTE: returns the slot holding (op, key) in this generation, or the free slot it would be put in
+IrSlot *ir_table_find(IrTable *table, u8 op, u64 key) {
+    u64 mask = table->capacity - 1;
+
+    for (u64 i = ir_table_hash(op, key) & mask;; i = (i + 1) & mask) {
+        IrSlot *slot = table->slots + i;
+
+        if (slot->gen != table->gen || (slot->op == op && slot->key == key)) {
+            return slot;
+        }
+    }
+}
+
+void ir_table_grow(IrTable *table) {
+    IrSlot *old = table->slots;
+    u64 capacity = table->capacity;
+
+    table->capacity *= 2;
+    table->slots = heap_alloc(table->capacity, sizeof (IrSlot));
+    memset(table->slots, 0, table->capacity * sizeof (IrSlot));
+
+    for (u64 i = 0; i < capacity; ++i) {
+        if (old[i].gen == table->gen) {
+            *ir_table_find(table, old[i].op, old[i].key) = old[i];
+        }
+    }
+
+    heap_dealloc(old);
+}
+
+// NOTE: `slot` must have come from ir_table_find with the same op and key, with nothing put in between
+void ir_table_put(IrTable *table, IrSlot *slot, u8 op, u64 key, u32 value) {
+    if (slot->gen != table->gen) {
+        *slot = (IrSlot) { key, value, table->gen, op };
+
+        if (++table->len * 2 > table->capacity) {
+            ir_table_grow(table);
+        }
+    }
+    else {
+        slot->value = value;
+    }
+}
+
+void ir_table_clear(IrTable *table) {
+    table->gen += 1;
+    table->len = 0;
+}
+
+void ir_init(Ir *ir, Compiler *compiler) {
+    ir->compiler = compiler;
+    stack_init(&ir->insts, sizeof (IrInst));
+    stack_init(&ir->blocks, sizeof (IrBlock));
+    stack_init(&ir->loops, sizeof (IrLoop));
+    stack_init(&ir->defs, sizeof (IrDef));
+    stack_init(&ir->log, sizeof (IrWrite));
+    stack_init(&ir->scratch, sizeof (u32));
+    stack_init(&ir->stores, sizeof (u32));
+    stack_init(&ir->joins, sizeof (IrJoin));
+    ir_table_init(&ir->table);
+    ir->gen = 0;
+    ir->seen = 0;
+    memset(&ir->stats, 0, sizeof (IrStats));
+}
+
+void ir_deinit(Ir *ir) {
+    stack_deinit(&ir->insts);
+    stack_deinit(&ir->blocks);
+    stack_deinit(&ir->loops);
+    stack_deinit(&ir->defs);
+    stack_deinit(&ir->log);
+    stack_deinit(&ir->scratch);
+    stack_deinit(&ir->stores);
+    stack_deinit(&ir->joins);
+    heap_dealloc(ir->table.slots);
+}
+
+u32 ir_num_insts(Ir *ir) {
+    return stack_len(&ir->insts);
+}
+
+u32 ir_num_blocks(Ir *ir) {
+    return stack_len(&ir->blocks);
+}
+
+u32 ir_resolve(Ir *ir, u32 value) {
+    u32 root = value;
+
+    while (IR_INST(ir, root)->forward != IR_NONE) {
+        root = IR_INST(ir, root)->forward;
+    }
+
+    while (value != root) {
+        u32 next = IR_INST(ir, value)->forward;
+        IR_INST(ir, value)->forward = root;
+        value = next;
+    }
+
+    return root;
+}
+
+u32 *ir_alloc(Ir *ir, u32 count) {
+    return arena_alloc(&ir->compiler->context->arena, count ? count : 1, sizeof (u32));
+}
+
+u32 ir_block_new(Ir *ir, u32 idom, u32 num_preds) {
+    IrBlock *block = stack_reserve(&ir->blocks);
+
+    block->first = IR_NONE;
+    block->last = IR_NONE;
+    block->phis = IR_NONE;
+    block->num_preds = num_preds;
+    block->preds = ir_alloc(ir, num_preds);
+    block->succs[0] = IR_NONE;
+    block->succs[1] = IR_NONE;
+    block->cond = IR_NONE;
+    block->idom = idom;
+    block->loop = ir->loop;
+    block->term = ir_Return;
+    block->dead = FALSE;
+
+    return ir_num_blocks(ir) - 1;
+}
+
+u32 ir_block_after(Ir *ir, u32 pred) {
+    u32 block = ir_block_new(ir, pred, 1);
+
+    IR_BLOCK(ir, block)->preds[0] = pred;
+
+    return block;
+}
+
+void ir_jump(Ir *ir, u32 from, u32 to) {
+    IrBlock *block = IR_BLOCK(ir, from);
+
+    block->term = ir_Jump;
+    block->succs[0] = to;
+}
+
+u32 ir_inst_new(Ir *ir, IrOp op, u32 block, u32 lhs, u32 rhs, i64 value) {
+    IrInst *inst = stack_reserve(&ir->insts);
+
+    inst->op = op;
+    inst->integer = op <= ir_Neg || op == ir_Const;
+    inst->dead = FALSE;
+    inst->block = block;
+    inst->next = IR_NONE;
+    inst->forward = IR_NONE;
+    inst->uses = 0;
+    inst->reg = IR_NONE;
+    inst->args[0] = lhs;
+    inst->args[1] = rhs;
+    inst->value = value;
+
+    return ir_num_insts(ir) - 1;
+}
+
+void ir_append(Ir *ir, u32 block, u32 value) {
+    IrBlock *b = IR_BLOCK(ir, block);
+
+    if (b->last == IR_NONE) {
+        b->first = value;
+    }
+    else {
+        IR_INST(ir, b->last)->next = value;
+    }
+
+    b->last = value;
+}
+
+u32 ir_emit(Ir *ir, IrOp op, u32 lhs, u32 rhs, i64 value) {
+    u32 inst = ir_inst_new(ir, op, ir->block, lhs, rhs, value);
+
+    ir_append(ir, ir->block, inst);
+
+    return inst;
+}
+
+u32 ir_phi(Ir *ir, u32 block, u32 *operands, u32 key) {
+    u32 phi = ir_inst_new(ir, ir_Phi, block, IR_NONE, IR_NONE, key);
+    IrBlock *b = IR_BLOCK(ir, block);
+
+    IR_INST(ir, phi)->operands = operands;
+    IR_INST(ir, phi)->next = b->phis;
+    b->phis = phi;
+
+    return phi;
+}
+
+IrDef *ir_def(Ir *ir, u32 key) {
+    while (stack_len(&ir->defs) <= key) {
+        IrDef def = { IR_NONE, 0, IR_NONE, 0, 0, 0 };
+        stack_push(&ir->defs, &def);
+    }
+
+    IrDef *def = (IrDef *) ir->defs.arr + key;
+
+    if (def->gen != ir->gen) {
+        def->value = IR_NONE;
+        def->stamp = 0;
+        def->load = IR_NONE;
+        def->gen = ir->gen;
+    }
+
+    return def;
+}
+
+// NOTE: slots are only written back when the statement ends, so a load of one reads the same value
+// anywhere in the statement and sits at the top of the entry block
+u32 ir_load(Ir *ir, u32 key) {
+    IrDef *def = ir_def(ir, key);
+
+    if (def->load == IR_NONE) {
+        u32 load = ir_inst_new(ir, ir_Load, ir->entry, IR_NONE, IR_NONE, key);
+        IrBlock *entry = IR_BLOCK(ir, ir->entry);
+
+        IR_INST(ir, load)->next = entry->first;
+        entry->first = load;
+
+        if (entry->last == IR_NONE) {
+            entry->last = load;
+        }
+
+        ir_def(ir, key)->load = load;
+    }
+
+    return ir_def(ir, key)->load;
+}
+
+// NOTE: the value `key` has inside `loop` given it had `value` when the write `stamp` counts loops for happened,
+// anything from before a loop was entered reaches it through a phi in its header, made the first time it's asked for
+u32 ir_loop_value(Ir *ir, u32 loop, u32 key, u32 value, u32 stamp) {
+    if (loop == IR_NONE || loop < stamp) {
+        return value;
+    }
+
+    u64 table_key = (u64) loop << 32 | key;
+    IrSlot *slot = ir_table_find(&ir->table, ir_Phi, table_key);
+
+    if (slot->gen == ir->table.gen) {
+        return slot->value;
+    }
+
+    u32 outer = ir_loop_value(ir, IR_LOOP(ir, loop)->parent, key, value, stamp);
+    u32 *operands = ir_alloc(ir, 2);
+
+    operands[0] = outer;
+    operands[1] = IR_NONE;
+
+    u32 phi = ir_phi(ir, IR_LOOP(ir, loop)->header, operands, key);
+
+    ir_table_put(&ir->table, ir_table_find(&ir->table, ir_Phi, table_key), ir_Phi, table_key, phi);
+
+    return phi;
+}
+
+u32 ir_read(Ir *ir, u32 key) {
+    IrDef *def = ir_def(ir, key);
+    u32 value = def->value;
+    u32 stamp = def->stamp;
+
+    if (value == IR_NONE) {
+        value = ir_load(ir, key);
+        stamp = 0;
+    }
+
+    return ir_loop_value(ir, ir->loop, key, value, stamp);
+}
+
+// NOTE: stamps count the loops entered so far, so a write happened inside a loop exactly when its stamp is
+// greater than the loop's index
+void ir_write(Ir *ir, u32 key, u32 value) {
+    IrDef *def = ir_def(ir, key);
+    IrWrite write = { key, def->value, def->stamp };
+
+    stack_push(&ir->log, &write);
+    def->value = value;
+    def->stamp = stack_len(&ir->loops);
+}
+
+void ir_undo(Ir *ir, u64 mark) {
+    while (stack_len(&ir->log) > mark) {
+        IrWrite write;
+        stack_pop(&ir->log, &write);
+
+        IrDef *def = ir_def(ir, write.key);
+        def->value = write.value;
+        def->stamp = write.stamp;
+    }
+}
+
+void ir_push(Ir *ir, u32 value) {
+    stack_push(&ir->scratch, &value);
+}
+
+u32 ir_scratch(Ir *ir, u64 index) {
+    return ((u32 *) ir->scratch.arr)[index];
+}
+
+// NOTE: records one way into a join as its block, its result, and the latest value of each variable written
+// since `mark`, then undoes those writes so the next way starts from the same state
+void ir_capture(Ir *ir, u64 mark, u32 result) {
+    u64 count_index;
+
+    ir_push(ir, ir->block);
+    ir_push(ir, result);
+    count_index = stack_len(&ir->scratch);
+    ir_push(ir, 0);
+    ir->seen += 1;
+
+    for (u64 i = mark; i < stack_len(&ir->log); ++i) {
+        u32 key = ((IrWrite *) ir->log.arr)[i].key;
+        IrDef *def = ir_def(ir, key);
+
+        if (def->seen != ir->seen) {
+            def->seen = ir->seen;
+            ir_push(ir, key);
+            ir_push(ir, def->value);
+            ((u32 *) ir->scratch.arr)[count_index] += 1;
+        }
+    }
+
+    ir_undo(ir, mark);
+}
+
+// NOTE: phis are only made where the incoming values actually differ
+u32 ir_merge(Ir *ir, u32 block, u32 *values, u32 key) {
+    u32 num_preds = IR_BLOCK(ir, block)->num_preds;
+
+    for (u32 i = 1; i < num_preds; ++i) {
+        if (values[i] != values[0]) {
+            return ir_phi(ir, block, values, key);
+        }
+    }
+
+    return values[0];
+}
+
+// NOTE: joins the ways captured from `base` onwards in a new block and returns their merged result, a variable
+// any way wrote is merged with what the others had for it, which is its value from before they split
+u32 ir_join(Ir *ir, u64 base, u32 num_paths, u32 idom) {
+    u32 join = ir_block_new(ir, idom, num_paths);
+    u32 *results = ir_alloc(ir, num_paths);
+    u64 index = base;
+
+    ir->joins.len = 0;
+    ir->seen += 1;
+
+    for (u32 path = 0; path < num_paths; ++path) {
+        u32 pred = ir_scratch(ir, index);
+        u32 count = ir_scratch(ir, index + 2);
+
+        IR_BLOCK(ir, join)->preds[path] = pred;
+        ir_jump(ir, pred, join);
+        results[path] = ir_scratch(ir, index + 1);
+
+        for (u32 i = 0; i < count; ++i) {
+            u32 key = ir_scratch(ir, index + 3 + i * 2);
+            IrDef *def = ir_def(ir, key);
+
+            if (def->seen != ir->seen) {
+                IrJoin entry = { key, ir_alloc(ir, num_paths) };
+                u32 before = ir_read(ir, key);
+
+                for (u32 j = 0; j < num_paths; ++j) {
+                    entry.values[j] = before;
+                }
+
+                def = ir_def(ir, key);
+                def->seen = ir->seen;
+                def->index = stack_len(&ir->joins);
+                stack_push(&ir->joins, &entry);
+            }
+
+            ((IrJoin *) ir->joins.arr)[def->index].values[path] = ir_scratch(ir, index + 4 + i * 2);
+        }
+
+        index += 3 + count * 2;
+    }
+
+    ir->block = join;
+    ir->scratch.len = base * sizeof (u32);
+
+    for (u64 i = 0; i < stack_len(&ir->joins); ++i) {
+        IrJoin entry = ((IrJoin *) ir->joins.arr)[i];
+        ir_write(ir, entry.key, ir_merge(ir, join, entry.values, entry.key));
+    }
+
+    return ir_merge(ir, join, results, IR_NONE);
+}
+
+RESULT ir_expr(Ir *ir, Expression *expr, u32 *result);
+
+RESULT ir_while(Ir *ir, Statement *statement) {
+    u32 pre = ir_block_after(ir, ir->block);
+    u32 id = stack_len(&ir->loops);
+    IrLoop *loop = stack_reserve(&ir->loops);
+    u64 mark = stack_len(&ir->log);
+    u64 cond_mark;
+    u32 cond;
+
+    ir_jump(ir, ir->block, pre);
+    loop->pre = pre;
+    loop->parent = ir->loop;
+    ir->loop = id;
+    loop->header = ir_block_new(ir, pre, 2);
+    IR_BLOCK(ir, loop->header)->preds[0] = pre;
+    IR_BLOCK(ir, loop->header)->preds[1] = IR_NONE;
+    ir_jump(ir, pre, loop->header);
+    ir->block = loop->header;
+
+    CHECK(ir_expr(ir, &statement->while_condition, &cond));
+    cond_mark = stack_len(&ir->log);
+
+    u32 cond_block = ir->block;
+    u32 body = ir_block_after(ir, cond_block);
+    u32 value;
+
+    ir->block = body;
+    CHECK(ir_expr(ir, &statement->while_body, &value));
+
+    loop = IR_LOOP(ir, id);
+    loop->cond = cond_block;
+    loop->latch = ir->block;
+    IR_BLOCK(ir, loop->header)->preds[1] = ir->block;
+    ir_jump(ir, ir->block, loop->header);
+
+    // NOTE: a variable the loop writes reaches the exit through the header even if nothing in the loop reads it
+    ir->seen += 1;
+
+    for (u64 i = mark; i < stack_len(&ir->log); ++i) {
+        IrWrite write = ((IrWrite *) ir->log.arr)[i];
+        IrDef *def = ir_def(ir, write.key);
+
+        if (def->seen != ir->seen) {
+            def->seen = ir->seen;
+
+            u32 before = write.value == IR_NONE ? ir_load(ir, write.key) : write.value;
+            u32 stamp = write.value == IR_NONE ? 0 : write.stamp;
+
+            ir_loop_value(ir, id, write.key, before, stamp);
+        }
+    }
+
+    u32 header = IR_LOOP(ir, id)->header;
+
+    for (u32 phi = IR_BLOCK(ir, header)->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+        IR_INST(ir, phi)->operands[1] = ir_read(ir, IR_INST(ir, phi)->value);
+    }
+
+    // NOTE: the exit is taken right after the condition, where the phis are what anything written later in the loop has
+    ir_undo(ir, cond_mark);
+    ir->loop = IR_LOOP(ir, id)->parent;
+
+    for (u32 phi = IR_BLOCK(ir, header)->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+        u32 key = IR_INST(ir, phi)->value;
+
+        if (ir_def(ir, key)->stamp <= id) {
+            ir_write(ir, key, phi);
+        }
+    }
+
+    u32 exit = ir_block_after(ir, cond_block);
+    IrBlock *block = IR_BLOCK(ir, cond_block);
+
+    block->term = ir_Branch;
+    block->cond = cond;
+    block->succs[0] = body;
+    block->succs[1] = exit;
+    IR_LOOP(ir, id)->exit = exit;
+    ir->block = exit;
+
+    return FALSE;
+}
+
+RESULT ir_statement(Ir *ir, Statement *statement) {
+    u32 value;
+
+    switch (statement->type) {
+    case st_Expression:
+        CHECK(ir_expr(ir, &statement->expr, &value));
+        break;
+    case st_Print:
+        CHECK(ir_expr(ir, &statement->expr, &value));
+        ir_emit(ir, ir_Print, value, IR_NONE, 0);
+        break;
+    case st_Send:
+        CHECK(ir_expr(ir, &statement->expr, &value));
+        ir_write(ir, ir->compiler->send_target.index, value);
+        break;
+    case st_While:
+        CHECK(ir_while(ir, statement));
+        break;
+    }
+
+    return FALSE;
+}
+
+// NOTE: every send leaves for the block's exit with what it sent, the statements after it are still built for
+// their errors but into a block nothing jumps to
+RESULT ir_block(Ir *ir, Expression *expr, u32 *result) {
+    u64 mark = stack_len(&ir->log);
+    u64 base = stack_len(&ir->scratch);
+    u32 idom = ir->block;
+    u32 paths = 0;
+    u32 value;
+
+    compiler_scope(ir->compiler, FALSE);
+
+    for (u64 i = 0; i < expr->num_statements; ++i) {
+        Statement *statement = expr->statements + i;
+
+        if (statement->type != st_Send) {
+            CHECK(ir_statement(ir, statement));
+            continue;
+        }
+
+        CHECK(ir_expr(ir, &statement->expr, &value));
+        ir_capture(ir, mark, value);
+        ir->block = ir_block_new(ir, ir->block, 0);
+        paths += 1;
+    }
+
+    compiler_exit(ir->compiler);
+    *result = ir_emit(ir, ir_None, IR_NONE, IR_NONE, 0);
+
+    if (paths) {
+        ir_capture(ir, mark, *result);
+        *result = ir_join(ir, base, paths + 1, idom);
+    }
+
+    return FALSE;
+}
+
+RESULT ir_if_else(Ir *ir, Expression *expr, u32 *result) {
+    u64 mark;
+    u64 base = stack_len(&ir->scratch);
+    u32 cond;
+    u32 value;
+
+    CHECK(ir_expr(ir, expr->condition, &cond));
+
+    u32 branch = ir->block;
+    u32 on_true = ir_block_after(ir, branch);
+    u32 on_false = ir_block_after(ir, branch);
+    IrBlock *block = IR_BLOCK(ir, branch);
+
+    block->term = ir_Branch;
+    block->cond = cond;
+    block->succs[0] = on_true;
+    block->succs[1] = on_false;
+    mark = stack_len(&ir->log);
+
+    // NOTE: the else branch is built first, like compile_expr compiles it, so both report the same error first
+    ir->block = on_false;
+
+    if (expr->on_false) {
+        CHECK(ir_expr(ir, expr->on_false, &value));
+    }
+    else {
+        value = ir_emit(ir, ir_None, IR_NONE, IR_NONE, 0);
+    }
+
+    ir_capture(ir, mark, value);
+
+    ir->block = on_true;
+    CHECK(ir_expr(ir, expr->on_true, &value));
+    ir_capture(ir, mark, value);
+    *result = ir_join(ir, base, 2, branch);
+
+    return FALSE;
+}
+
+RESULT ir_assignment(Ir *ir, Expression *expr, bool reassign, u32 *result) {
+    Compiler *compiler = ir->compiler;
+    u64 ptr;
+    u64 depth;
+
+    switch (expr->lhs->type) {
+    case ex_Identifier:
+        CHECK(ir_expr(ir, expr->rhs, result));
+
+        if (reassign) {
+            if (scope_get(compiler, expr->lhs->symbol, &ptr, &depth)) {
+                DISPATCH_ERROR_FMT(compiler->context, expr->lhs->line, "Variable not already defined `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->lhs->symbol)));
+                return TRUE;
+            }
+        }
+        else {
+            ptr = scope_assign(compiler, expr->lhs->symbol);
+        }
+
+        ir_write(ir, ptr, *result);
+        break;
+    default:
+        DISPATCH_ERROR(compiler->context, expr->lhs->line, "Invalid left-hand side of assignment");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+RESULT ir_expr(Ir *ir, Expression *expr, u32 *result) {
+    Compiler *compiler = ir->compiler;
+
+    switch (expr->type) {
+        u64 op_sstr;
+        u64 ptr;
+        u64 depth;
+        u32 lhs;
+        u32 rhs;
+
+    case ex_Integer:
+        *result = ir_emit(ir, ir_Const, IR_NONE, IR_NONE, (i64) expr->integer);
+        break;
+    case ex_Null:
+        fprintf(stderr, FATAL "Got null expression");
+        exit(-1);
+    case ex_Identifier:
+        if (scope_get(compiler, expr->symbol, &ptr, &depth)) {
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Undefined variable `%.*s`", VIEW_ARGS(symbol_name(compiler, expr->symbol)));
+            return TRUE;
+        }
+
+        *result = ir_read(ir, ptr);
+        break;
+    case ex_BinaryOperation:
+        if (expr->bin_op == op_Assignment || expr->bin_op == op_Reassignment) {
+            CHECK(ir_assignment(ir, expr, expr->bin_op == op_Reassignment, result));
+            break;
+        }
+
+        CHECK(ir_expr(ir, expr->lhs, &lhs));
+        CHECK(ir_expr(ir, expr->rhs, &rhs));
+        *result = ir_emit(ir, ir_Add + expr->bin_op - op_Addition, lhs, rhs, 0);
+        break;
+    case ex_UnaryOperation:
+        switch (expr->un_op) {
+        case op_Subtraction:
+            CHECK(ir_expr(ir, expr->oprand, &rhs));
+            *result = ir_emit(ir, ir_Neg, rhs, IR_NONE, 0);
+            break;
+        default:
+            op_sstr = op_to_sstr(expr->un_op);
+            DISPATCH_ERROR_FMT(compiler->context, expr->line, "Invalid unary operator `%s`", (char *) &op_sstr);
+            return TRUE;
+        }
+
+        break;
+    case ex_Block:
+        CHECK(ir_block(ir, expr, result));
+        break;
+    case ex_IfElse:
+        CHECK(ir_if_else(ir, expr, result));
+        break;
+    case ex_Function:
+        fprintf(stderr, FATAL "Function compilation");
+        exit(-1);
+        break;
+    }
+
+    return FALSE;
+}
+
+// NOTE: the IR covers one top-level statement, variables of the top-level frame are loaded from their slots
+// the first time they're read and every one it writes is stored back when it ends
+RESULT ir_build(Ir *ir, Statement *statement) {
+    ir->insts.len = 0;
+    ir->blocks.len = 0;
+    ir->loops.len = 0;
+    ir->log.len = 0;
+    ir->scratch.len = 0;
+    ir->stores.len = 0;
+    ir->gen += 1;
+    ir_table_clear(&ir->table);
+
+    ir->loop = IR_NONE;
+    ir->entry = ir_block_new(ir, IR_NONE, 0);
+    ir->block = ir->entry;
+
+    CHECK(ir_statement(ir, statement));
+
+    ir->exit = ir->block;
+    ir->globals = ir->compiler->scope->ptr;
+    ir->seen += 1;
+
+    for (u64 i = 0; i < stack_len(&ir->log); ++i) {
+        u32 key = ((IrWrite *) ir->log.arr)[i].key;
+        IrDef *def = ir_def(ir, key);
+
+        if (key < ir->globals && def->seen != ir->seen) {
+            def->seen = ir->seen;
+            stack_push(&ir->stores, &key);
+            stack_push(&ir->stores, &def->value);
+        }
+    }
+
+    return FALSE;
+}
+
+// NOTE: drops the edge from `pred`, along with what each phi of `block` had for it
+void ir_remove_pred(Ir *ir, u32 block, u32 pred) {
+    IrBlock *b = IR_BLOCK(ir, block);
+    u32 index = 0;
+
+    while (b->preds[index] != pred) {
+        index += 1;
+    }
+
+    for (u32 phi = b->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+        u32 *operands = IR_INST(ir, phi)->operands;
+        memmove(operands + index, operands + index + 1, (b->num_preds - index - 1) * sizeof (u32));
+    }
+
+    memmove(b->preds + index, b->preds + index + 1, (b->num_preds - index - 1) * sizeof (u32));
+    b->num_preds -= 1;
+}
+
+#ifdef EBUG_IR
+const char *ir_op_names[] = { "add", "sub", "mul", "div", "neg", "const", "none", "load", "phi", "print" };
+
+void ir_print_inst(Ir *ir, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+
+    printf("    v%u = %s", value, ir_op_names[inst->op]);
+
+    switch (inst->op) {
+    case ir_Const:
+    case ir_Load:
+        printf(" %lld", inst->value);
+        break;
+    case ir_Phi:
+        for (u32 i = 0; i < IR_BLOCK(ir, inst->block)->num_preds; ++i) {
+            printf(" v%u", ir_resolve(ir, inst->operands[i]));
+        }
+        break;
+    case ir_None:
+        break;
+    case ir_Neg:
+    case ir_Print:
+        printf(" v%u", ir_resolve(ir, inst->args[0]));
+        break;
+    default:
+        printf(" v%u v%u", ir_resolve(ir, inst->args[0]), ir_resolve(ir, inst->args[1]));
+        break;
+    }
+
+    printf(inst->integer ? " (integer)\n" : "\n");
+}
+
+void ir_print(Ir *ir) {
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        printf("  b%u (idom b%d, loop %d):", id, (int) block->idom, (int) block->loop);
+
+        for (u32 i = 0; i < block->num_preds; ++i) {
+            printf(" b%u", block->preds[i]);
+        }
+
+        printf("\n");
+
+        for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+            if (!IR_INST(ir, phi)->dead) ir_print_inst(ir, phi);
+        }
+
+        for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            if (!IR_INST(ir, value)->dead && IR_INST(ir, value)->block == id) ir_print_inst(ir, value);
+        }
+
+        switch (block->term) {
+        case ir_Jump:   printf("    jump b%u\n", block->succs[0]); break;
+        case ir_Branch: printf("    branch v%u b%u b%u\n", ir_resolve(ir, block->cond), block->succs[0], block->succs[1]); break;
+        case ir_Return: printf("    return\n"); break;
+        }
+    }
+}
+#endif
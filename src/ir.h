@@ -0,0 +1,160 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "stack.h"
+#include "parsing.h"
+
+typedef struct __Compiler__ Compiler;
+
+#define IR_NONE ((u32) -1)
+
+typedef enum PACKED {
+    ir_Add, // NOTE: in the same order as op_Addition through op_Division and RINST_ADD through RINST_DIV
+    ir_Sub,
+    ir_Mul,
+    ir_Div,
+    ir_Neg,
+    ir_Const,
+    ir_None,
+    ir_Load,
+    ir_Phi,
+    ir_Print,
+} IrOp;
+
+// NOTE: values are instruction indices, `forward` is what a value was replaced with by an optimization, so
+// operands are always looked up through ir_resolve, a phi has one operand per predecessor of its block
+typedef struct {
+    IrOp op;
+    bool integer; // NOTE: known to hold an integer, which is what makes arithmetic on it unable to fail
+    bool dead;
+    u32 block;
+    u32 next;
+    u32 forward;
+    u32 uses;
+    u32 reg;
+
+    union {
+        u32 args[2];
+        u32 *operands;
+    };
+
+    i64 value; // NOTE: the integer of a constant or the slot of a load
+} IrInst;
+
+typedef enum PACKED {
+    ir_Jump,
+    ir_Branch,
+    ir_Return,
+} IrTerminator;
+
+typedef struct {
+    u32 first;
+    u32 last;
+    u32 phis;
+    u32 num_preds;
+    u32 *preds;
+    u32 succs[2]; // NOTE: a branch goes to the first when its condition is true
+    u32 cond;
+    u32 idom;
+    u32 loop;
+    IrTerminator term;
+    bool dead;
+
+    u32 start;
+    u32 end;
+    u64 label;
+} IrBlock;
+
+// NOTE: the blocks of a loop are exactly the ones numbered from `header` up to `exit`, `pre` is the only
+// block outside it that jumps to the header
+typedef struct {
+    u32 pre;
+    u32 header;
+    u32 cond;
+    u32 latch;
+    u32 exit;
+    u32 parent;
+    u32 end;
+} IrLoop;
+
+// NOTE: the current value of a variable, by slot, along with the loop stamp it was written at and its load,
+// `seen` and `index` are scratch space for deduplicating keys
+typedef struct {
+    u32 value;
+    u32 stamp;
+    u32 load;
+    u32 gen;
+    u32 seen;
+    u32 index;
+} IrDef;
+
+typedef struct {
+    u32 key;
+    u32 value;
+    u32 stamp;
+} IrWrite;
+
+typedef struct {
+    u32 key;
+    u32 *values;
+} IrJoin;
+
+typedef struct {
+    u64 key;
+    u32 value;
+    u32 gen;
+    u8 op;
+} IrSlot;
+
+// NOTE: open addressing over (op, key) pairs, entries from an earlier generation count as empty so clearing is free
+typedef struct {
+    IrSlot *slots;
+    u64 capacity;
+    u64 len;
+    u32 gen;
+} IrTable;
+
+typedef struct {
+    u64 instructions;
+    u64 eliminated;
+} IrStats;
+
+typedef struct {
+    Compiler *compiler;
+
+    Stack insts;
+    Stack blocks;
+    Stack loops;
+    Stack defs;
+    Stack log;
+    Stack scratch;
+    Stack joins;
+    Stack stores; // NOTE: pairs of a slot and the value it's left with, for every top-level variable written
+    IrTable table;
+
+    u32 block;
+    u32 loop;
+    u32 gen;
+    u32 seen;
+    u32 entry;
+    u32 exit;
+    u32 globals;
+
+    IrStats stats;
+} Ir;
+
+#define IR_INST(ir, value) ((IrInst *) (ir)->insts.arr + (value))
+#define IR_BLOCK(ir, block) ((IrBlock *) (ir)->blocks.arr + (block))
+#define IR_LOOP(ir, loop) ((IrLoop *) (ir)->loops.arr + (loop))
+
+void ir_init(Ir *ir, Compiler *compiler);
+void ir_deinit(Ir *ir);
+RESULT ir_build(Ir *ir, Statement *statement);
+u32 ir_resolve(Ir *ir, u32 value);
+u32 ir_num_insts(Ir *ir);
+u32 ir_num_blocks(Ir *ir);
+void ir_remove_pred(Ir *ir, u32 block, u32 pred);
+IrSlot *ir_table_find(IrTable *table, u8 op, u64 key);
+void ir_table_put(IrTable *table, IrSlot *slot, u8 op, u64 key, u32 value);
+void ir_table_clear(IrTable *table);
+void ir_print(Ir *ir);
@@ -0,0 +1,870 @@
+#include <string.h>
+#include <stddef.h>
+#include "jit.h"
+#include "vm.h"
+#include "context.h"
+#include "verifier.h"
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define JIT_LOOPS_SIZE 16
+#define JIT_EXIT  0
+#define JIT_ERROR 1
+#define NO_OFFSET ((u32) -1)
+
+typedef struct {
+    u32 at;
+    u64 target;
+} JitPatch;
+
+typedef enum PACKED {
+    stub_Arithmetic,
+    stub_Negate,
+    stub_Slot,
+    stub_Truth,
+    stub_Barrier,
+} JitStubKind;
+
+// NOTE: a slow path, placed after the loop and reached from a conditional jump at `at`, only the barrier returns. The
+// integer ones leave the instruction at `pc` to the interpreter, which boxes the result or reports the error
+typedef struct {
+    JitStubKind kind;
+    u8 inst;
+    u8 base;
+    u8 scope;
+    i32 disp;
+    u32 at;
+    u32 resume;
+    u64 pc;
+} JitStub;
+
+typedef struct {
+    void *ptr;
+    u64 size;
+} JitMapping;
+
+void jit_init(Jit *jit) {
+    jit->capacity = JIT_LOOPS_SIZE;
+    jit->len = 0;
+    jit->loops = heap_alloc(jit->capacity, sizeof (JitLoop));
+    memset(jit->loops, 0, jit->capacity * sizeof (JitLoop));
+
+    stack_init(&jit->code, sizeof (u8));
+    stack_init(&jit->offsets, sizeof (u32));
+    stack_init(&jit->patches, sizeof (JitPatch));
+    stack_init(&jit->stubs, sizeof (JitStub));
+    stack_init(&jit->mappings, sizeof (JitMapping));
+    jit->perf_map = NULL;
+    jit->enabled = FALSE;
+}
+
+void jit_deinit(Jit *jit) {
+#ifdef JIT_SUPPORTED
+    for (u64 i = 0; i < stack_len(&jit->mappings); ++i) {
+        JitMapping *mapping = stack_index(&jit->mappings, i);
+        munmap(mapping->ptr, mapping->size);
+    }
+#endif
+
+    if (jit->perf_map) {
+        fclose(jit->perf_map);
+    }
+
+    heap_dealloc(jit->loops);
+    stack_deinit(&jit->code);
+    stack_deinit(&jit->offsets);
+    stack_deinit(&jit->patches);
+    stack_deinit(&jit->stubs);
+    stack_deinit(&jit->mappings);
+}
+
+JitLoop *jit_find(Jit *jit, u64 header, u64 end) {
+    u64 mask = jit->capacity - 1;
+    u64 hash = (header * 0x9E3779B97F4A7C15ULL) ^ end;
+
+    for (u64 i = (hash ^ (hash >> 29)) & mask;; i = (i + 1) & mask) {
+        JitLoop *loop = jit->loops + i;
+
+        if (!loop->used || (loop->header == header && loop->end == end)) {
+            return loop;
+        }
+    }
+}
+
+JitLoop *jit_get(Jit *jit, u64 header, u64 end) {
+    JitLoop *loop = jit_find(jit, header, end);
+
+    if (loop->used) {
+        return loop;
+    }
+
+    if ((jit->len + 1) * 2 > jit->capacity) {
+        JitLoop *old = jit->loops;
+        u64 capacity = jit->capacity;
+
+        jit->capacity *= 2;
+        jit->loops = heap_alloc(jit->capacity, sizeof (JitLoop));
+        memset(jit->loops, 0, jit->capacity * sizeof (JitLoop));
+
+        for (u64 i = 0; i < capacity; ++i) {
+            if (old[i].used) {
+                *jit_find(jit, old[i].header, old[i].end) = old[i];
+            }
+        }
+
+        heap_dealloc(old);
+        loop = jit_find(jit, header, end);
+    }
+
+    *loop = (JitLoop) { header, end, NULL, 0, TRUE, FALSE };
+    jit->len += 1;
+
+    return loop;
+}
+
+// NOTE: called from native code, these are the interpreter's slow paths
+void jit_truth_error(Vm *vm, Object *cond) {
+    DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(OBJ_TYPE(*cond)));
+}
+
+void jit_barrier(Vm *vm, VmScope *target, Object *value) {
+    if (OBJ_TYPE(*value) == obj_Scope && target->heap && !target->young && OBJ_SCOPE(*value)->young) {
+        gc_write_barrier(&vm->gc, target);
+    }
+}
+
+void jit_print(Object *obj) {
+    switch (OBJ_TYPE(*obj)) {
+    case obj_Integer:
+        printf("%lld\n", OBJ_INT(*obj));
+        break;
+    case obj_None:
+        printf("none\n");
+        break;
+    case obj_Scope:
+        fprintf(stderr, "Attempt to print scope");
+        exit(-1);
+    }
+}
+
+RESULT jit_run(Vm *vm, JitCode code) {
+    Object *base = (Object *) vm->op_stack.arr;
+    JitState state = { base + stack_len(&vm->op_stack), vm->scope, vm->pc };
+    u64 status = code(vm, &state);
+
+    vm->op_stack.len = (u64) (state.sp - base) * sizeof (Object);
+    vm->pc = state.pc;
+
+    return status == JIT_ERROR;
+}
+
+#ifdef JIT_SUPPORTED
+
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} X64Reg;
+
+// NOTE: the interpreter's state lives in callee-saved registers for as long as native code runs
+#define SP_REG    RBX
+#define SCOPE_REG R12
+#define VM_REG    R13
+#define SLOTS_REG R14
+#define STATE_REG R15
+
+#define CC_O  0x0
+#define CC_B  0x2
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+
+#define VS VALUE_SIZE
+
+#ifdef TAGGED_VALUES
+#define PAYLOAD 0
+#else
+#define PAYLOAD 8
+#endif
+
+void jit_byte(Jit *jit, u8 byte) {
+    stack_push_byte(&jit->code, byte);
+}
+
+void jit_u32(Jit *jit, u32 value) {
+    for (u64 i = 0; i < 4; ++i) {
+        jit_byte(jit, (u8) (value >> i * 8));
+    }
+}
+
+void jit_u64(Jit *jit, u64 value) {
+    jit_u32(jit, (u32) value);
+    jit_u32(jit, (u32) (value >> 32));
+}
+
+u32 jit_here(Jit *jit) {
+    return (u32) jit->code.len;
+}
+
+void jit_patch(Jit *jit, u32 at, u32 to) {
+    u32 rel = to - (at + 4);
+    memcpy(jit->code.arr + at, &rel, sizeof (u32));
+}
+
+void jit_rex(Jit *jit, bool wide, u8 reg, u8 rm) {
+    u8 rex = 0x40 | wide << 3 | (reg >> 3) << 2 | rm >> 3;
+
+    if (rex != 0x40) {
+        jit_byte(jit, rex);
+    }
+}
+
+void jit_opcode(Jit *jit, u32 opcode) {
+    if (opcode > 0xFF) {
+        jit_byte(jit, (u8) (opcode >> 8));
+    }
+
+    jit_byte(jit, (u8) opcode);
+}
+
+// NOTE: `opcode` with a [base + disp] operand, r12 as a base needs a SIB byte and r13 one with a displacement,
+// which is always there
+void jit_mem(Jit *jit, bool wide, u32 opcode, u8 reg, u8 base, i32 disp) {
+    bool short_disp = disp >= -128 && disp <= 127;
+
+    jit_rex(jit, wide, reg, base);
+    jit_opcode(jit, opcode);
+    jit_byte(jit, (short_disp ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+
+    if ((base & 7) == RSP) {
+        jit_byte(jit, 0x24);
+    }
+
+    if (short_disp) {
+        jit_byte(jit, (u8) disp);
+    }
+    else {
+        jit_u32(jit, (u32) disp);
+    }
+}
+
+void jit_reg(Jit *jit, bool wide, u32 opcode, u8 reg, u8 rm) {
+    jit_rex(jit, wide, reg, rm);
+    jit_opcode(jit, opcode);
+    jit_byte(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void jit_load(Jit *jit, u8 dst, u8 base, i32 disp) {
+    jit_mem(jit, TRUE, 0x8B, dst, base, disp);
+}
+
+void jit_store(Jit *jit, u8 src, u8 base, i32 disp) {
+    jit_mem(jit, TRUE, 0x89, src, base, disp);
+}
+
+void jit_store_imm(Jit *jit, u8 base, i32 disp, i32 imm) {
+    jit_mem(jit, TRUE, 0xC7, 0, base, disp);
+    jit_u32(jit, (u32) imm);
+}
+
+void jit_mov(Jit *jit, u8 dst, u8 src) {
+    jit_reg(jit, TRUE, 0x89, src, dst);
+}
+
+void jit_mov_imm(Jit *jit, u8 dst, u64 imm) {
+    jit_rex(jit, TRUE, 0, dst);
+    jit_byte(jit, 0xB8 + (dst & 7));
+    jit_u64(jit, imm);
+}
+
+// NOTE: the group 1 instructions that take an 8 bit immediate, `digit` picks the operation
+#define ALU_ADD 0
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_CMP 7
+
+void jit_alu_imm(Jit *jit, u8 digit, u8 reg, i8 imm) {
+    jit_reg(jit, TRUE, 0x83, digit, reg);
+    jit_byte(jit, (u8) imm);
+}
+
+void jit_call(Jit *jit, void *function) {
+    jit_mov_imm(jit, RAX, (u64) function);
+    jit_byte(jit, 0xFF);
+    jit_byte(jit, 0xD0);
+}
+
+u32 jit_jcc(Jit *jit, u8 cc) {
+    jit_byte(jit, 0x0F);
+    jit_byte(jit, 0x80 | cc);
+    jit_u32(jit, 0);
+    return jit_here(jit) - 4;
+}
+
+u32 jit_jmp(Jit *jit) {
+    jit_byte(jit, 0xE9);
+    jit_u32(jit, 0);
+    return jit_here(jit) - 4;
+}
+
+void jit_jump_to(Jit *jit, u64 target) {
+    JitPatch patch = { jit_jmp(jit), target };
+    stack_push(&jit->patches, &patch);
+}
+
+void jit_branch_to(Jit *jit, u8 cc, u64 target) {
+    JitPatch patch = { jit_jcc(jit, cc), target };
+    stack_push(&jit->patches, &patch);
+}
+
+// NOTE: jumps to a slow path when `cc` holds
+void jit_slow(Jit *jit, u8 cc, JitStubKind kind, u8 inst, u8 base, i32 disp, u8 scope, u64 pc) {
+    JitStub stub = { kind, inst, base, scope, disp, jit_jcc(jit, cc), 0, pc };
+
+    stub.resume = jit_here(jit);
+    stack_push(&jit->stubs, &stub);
+}
+
+void jit_push(Jit *jit, u8 reg) {
+    jit_rex(jit, FALSE, 0, reg);
+    jit_byte(jit, 0x50 + (reg & 7));
+}
+
+void jit_pop(Jit *jit, u8 reg) {
+    jit_rex(jit, FALSE, 0, reg);
+    jit_byte(jit, 0x58 + (reg & 7));
+}
+
+void jit_adjust_sp(Jit *jit, i8 bytes) {
+    jit_alu_imm(jit, bytes > 0 ? ALU_ADD : ALU_SUB, SP_REG, bytes > 0 ? bytes : -bytes);
+}
+
+// NOTE: leaves the register holding the slots of the scope `depth` frames up, and the scope itself in `scope`
+u8 jit_slots(Jit *jit, u64 depth, u8 *scope) {
+    if (depth == 0) {
+        *scope = SCOPE_REG;
+        return SLOTS_REG;
+    }
+
+    jit_mov(jit, RDX, SCOPE_REG);
+
+    for (u64 i = 0; i < depth; ++i) {
+        jit_load(jit, RDX, RDX, offsetof(VmScope, parent));
+    }
+
+    jit_load(jit, RAX, RDX, offsetof(VmScope, stack));
+    *scope = RDX;
+
+    return RAX;
+}
+
+void jit_copy(Jit *jit, u8 dst, i32 dst_disp, u8 src, i32 src_disp) {
+    jit_load(jit, RCX, src, src_disp);
+    jit_store(jit, RCX, dst, dst_disp);
+
+#ifndef TAGGED_VALUES
+    jit_load(jit, RCX, src, src_disp + 8);
+    jit_store(jit, RCX, dst, dst_disp + 8);
+#endif
+}
+
+// NOTE: writes MAKE_INT of what's in `reg`, which for tagged values has to have been tagged already
+void jit_store_int(Jit *jit, u8 reg, u8 base, i32 disp) {
+#ifndef TAGGED_VALUES
+    jit_store_imm(jit, base, disp, obj_Integer);
+#endif
+    jit_store(jit, reg, base, disp + PAYLOAD);
+}
+
+void jit_push_int(Jit *jit, i64 integer) {
+#ifdef TAGGED_VALUES
+    u64 bits = MAKE_INT(integer).bits;
+#else
+    u64 bits = (u64) integer;
+    jit_store_imm(jit, SP_REG, 0, obj_Integer);
+#endif
+
+    if ((i64) bits == (i32) bits) {
+        jit_store_imm(jit, SP_REG, PAYLOAD, (i32) bits);
+    }
+    else {
+        jit_mov_imm(jit, RAX, bits);
+        jit_store(jit, RAX, SP_REG, PAYLOAD);
+    }
+
+    jit_adjust_sp(jit, VS);
+}
+
+void jit_push_none(Jit *jit) {
+#ifdef TAGGED_VALUES
+    jit_store_imm(jit, SP_REG, 0, 1);
+#else
+    jit_store_imm(jit, SP_REG, 0, obj_None);
+    jit_store_imm(jit, SP_REG, 8, 0);
+#endif
+
+    jit_adjust_sp(jit, VS);
+}
+
+// NOTE: the fast path for two integers on top of the stack, anything else takes the slow path
+void jit_arithmetic(Jit *jit, u8 inst, u64 pc) {
+#ifdef TAGGED_VALUES
+    jit_load(jit, RAX, SP_REG, -2 * VS);
+    jit_load(jit, RCX, SP_REG, -VS);
+    jit_mov(jit, RDX, RAX);
+    jit_reg(jit, TRUE, 0x0B, RDX, RCX);
+    jit_reg(jit, FALSE, 0xF6, 0, RDX);
+    jit_byte(jit, 1);
+    jit_slow(jit, CC_NE, stub_Arithmetic, inst, SP_REG, 0, 0, pc);
+
+    // NOTE: an integer x is 2x, so the arithmetic is done on the tagged values directly where it can be, and a
+    // result that doesn't fit overflows and takes the slow path to be boxed
+    switch (inst) {
+    case INST_ADD:
+        jit_reg(jit, TRUE, 0x03, RAX, RCX);
+        break;
+    case INST_SUB:
+        jit_reg(jit, TRUE, 0x2B, RAX, RCX);
+        break;
+    case INST_MUL:
+        jit_reg(jit, TRUE, 0xD1, 7, RAX);
+        jit_reg(jit, TRUE, 0x0FAF, RAX, RCX);
+        break;
+    case INST_DIV:
+        jit_reg(jit, TRUE, 0xD1, 7, RAX);
+        jit_reg(jit, TRUE, 0xD1, 7, RCX);
+        jit_byte(jit, 0x48);
+        jit_byte(jit, 0x99);
+        jit_reg(jit, TRUE, 0xF7, 7, RCX);
+        jit_reg(jit, TRUE, 0x03, RAX, RAX);
+        break;
+    }
+
+    jit_slow(jit, CC_O, stub_Arithmetic, inst, SP_REG, 0, 0, pc);
+    jit_store(jit, RAX, SP_REG, -2 * VS);
+#else
+    jit_mem(jit, FALSE, 0x8A, RCX, SP_REG, -2 * VS);
+    jit_mem(jit, FALSE, 0x0A, RCX, SP_REG, -VS);
+    jit_slow(jit, CC_NE, stub_Arithmetic, inst, SP_REG, 0, 0, pc);
+    jit_load(jit, RAX, SP_REG, -2 * VS + 8);
+
+    switch (inst) {
+    case INST_ADD:
+        jit_mem(jit, TRUE, 0x03, RAX, SP_REG, -VS + 8);
+        break;
+    case INST_SUB:
+        jit_mem(jit, TRUE, 0x2B, RAX, SP_REG, -VS + 8);
+        break;
+    case INST_MUL:
+        jit_mem(jit, TRUE, 0x0FAF, RAX, SP_REG, -VS + 8);
+        break;
+    case INST_DIV:
+        jit_byte(jit, 0x48);
+        jit_byte(jit, 0x99);
+        jit_mem(jit, TRUE, 0xF7, 7, SP_REG, -VS + 8);
+        break;
+    }
+
+    jit_store_int(jit, RAX, SP_REG, -2 * VS);
+#endif
+
+    jit_adjust_sp(jit, -VS);
+}
+
+void jit_negate(Jit *jit, u64 pc) {
+#ifdef TAGGED_VALUES
+    jit_load(jit, RAX, SP_REG, -VS);
+    jit_reg(jit, FALSE, 0xF6, 0, RAX);
+    jit_byte(jit, 1);
+    jit_slow(jit, CC_NE, stub_Negate, 0, SP_REG, -VS, 0, pc);
+    jit_reg(jit, TRUE, 0xF7, 3, RAX);
+    jit_slow(jit, CC_O, stub_Negate, 0, SP_REG, -VS, 0, pc);
+    jit_store(jit, RAX, SP_REG, -VS);
+#else
+    jit_mem(jit, FALSE, 0x80, 7, SP_REG, -VS);
+    jit_byte(jit, obj_Integer);
+    jit_slow(jit, CC_NE, stub_Negate, 0, SP_REG, -VS, 0, pc);
+    jit_load(jit, RAX, SP_REG, -VS + 8);
+    jit_reg(jit, TRUE, 0xF7, 3, RAX);
+    jit_store_int(jit, RAX, SP_REG, -VS);
+#endif
+}
+
+void jit_slot_arithmetic(Jit *jit, u8 inst, u8 base, i32 disp, i64 imm, u64 pc) {
+#ifdef TAGGED_VALUES
+    jit_load(jit, RCX, base, disp);
+    jit_reg(jit, FALSE, 0xF6, 0, RCX);
+    jit_byte(jit, 1);
+    jit_slow(jit, CC_NE, stub_Slot, inst, base, disp, 0, pc);
+    jit_mov(jit, RAX, RCX);
+
+    switch (inst) {
+    case INST_ADD_SLOT_IMM:
+        jit_mov_imm(jit, R8, (u64) imm << 1);
+        jit_reg(jit, TRUE, 0x03, RAX, R8);
+        break;
+    case INST_SUB_SLOT_IMM:
+        jit_mov_imm(jit, R8, (u64) imm << 1);
+        jit_reg(jit, TRUE, 0x2B, RAX, R8);
+        break;
+    case INST_MUL_SLOT_IMM:
+        jit_mov_imm(jit, R8, (u64) imm);
+        jit_reg(jit, TRUE, 0x0FAF, RAX, R8);
+        break;
+    }
+
+    jit_slow(jit, CC_O, stub_Slot, inst, base, disp, 0, pc);
+#else
+    jit_mem(jit, FALSE, 0x80, 7, base, disp);
+    jit_byte(jit, obj_Integer);
+    jit_slow(jit, CC_NE, stub_Slot, inst, base, disp, 0, pc);
+    jit_load(jit, RAX, base, disp + 8);
+    jit_mov_imm(jit, R8, (u64) imm);
+
+    switch (inst) {
+    case INST_ADD_SLOT_IMM:
+        jit_reg(jit, TRUE, 0x03, RAX, R8);
+        break;
+    case INST_SUB_SLOT_IMM:
+        jit_reg(jit, TRUE, 0x2B, RAX, R8);
+        break;
+    case INST_MUL_SLOT_IMM:
+        jit_reg(jit, TRUE, 0x0FAF, RAX, R8);
+        break;
+    }
+#endif
+
+    jit_store_int(jit, RAX, SP_REG, 0);
+    jit_adjust_sp(jit, VS);
+}
+
+#ifdef TAGGED_VALUES
+// NOTE: sets the flags for E when the tagged value in RCX, which isn't none or 0, is a scope rather than a boxed integer
+void jit_scope_check(Jit *jit) {
+    jit_mov(jit, R8, RCX);
+    jit_alu_imm(jit, ALU_AND, R8, 3);
+    jit_alu_imm(jit, ALU_CMP, R8, 1);
+}
+#endif
+
+// NOTE: jumps to `target` when the object is falsy, or truthy if `on_true`, anything that isn't an integer or
+// none takes the slow path to the error
+void jit_truth(Jit *jit, u8 base, i32 disp, bool on_true, u64 target, u64 pc) {
+#ifdef TAGGED_VALUES
+    jit_load(jit, RCX, base, disp);
+    jit_alu_imm(jit, ALU_CMP, RCX, 1);
+
+    if (on_true) {
+        u32 falsy = jit_jcc(jit, CC_BE);
+        jit_scope_check(jit);
+        jit_slow(jit, CC_E, stub_Truth, 0, base, disp, 0, pc);
+        jit_jump_to(jit, target);
+        jit_patch(jit, falsy, jit_here(jit));
+    }
+    else {
+        jit_branch_to(jit, CC_BE, target);
+        jit_scope_check(jit);
+        jit_slow(jit, CC_E, stub_Truth, 0, base, disp, 0, pc);
+    }
+#else
+    jit_mem(jit, FALSE, 0x80, 7, base, disp);
+    jit_byte(jit, obj_None);
+    jit_slow(jit, CC_A, stub_Truth, 0, base, disp, 0, pc);
+    jit_mem(jit, TRUE, 0x83, ALU_CMP, base, disp + 8);
+    jit_byte(jit, 0);
+    jit_branch_to(jit, on_true ? CC_NE : CC_E, target);
+#endif
+}
+
+// NOTE: only a scope stored into an old heap scope needs the write barrier, so that's all the slow path checks for
+void jit_store_slot(Jit *jit, u8 base, i32 disp, u8 scope, u64 pc) {
+    jit_copy(jit, base, disp, SP_REG, -VS);
+
+#ifdef TAGGED_VALUES
+    jit_alu_imm(jit, ALU_CMP, RCX, 1);
+    u32 skip = jit_jcc(jit, CC_BE);
+    jit_scope_check(jit);
+    jit_slow(jit, CC_E, stub_Barrier, 0, base, disp, scope, pc);
+    jit_patch(jit, skip, jit_here(jit));
+#else
+    jit_mem(jit, FALSE, 0x80, 7, base, disp);
+    jit_byte(jit, obj_None);
+    jit_slow(jit, CC_A, stub_Barrier, 0, base, disp, scope, pc);
+#endif
+}
+
+void jit_exit(Jit *jit, u64 pc, u8 status, u32 epilogue) {
+    jit_store_imm(jit, STATE_REG, offsetof(JitState, pc), (i32) pc);
+    jit_byte(jit, 0xB8);
+    jit_u32(jit, status);
+    jit_patch(jit, jit_jmp(jit), epilogue);
+}
+
+void jit_emit_stub(Jit *jit, JitStub *stub, u32 epilogue) {
+    jit_patch(jit, stub->at, jit_here(jit));
+
+    switch (stub->kind) {
+    case stub_Arithmetic:
+    case stub_Negate:
+    case stub_Slot:
+        jit_exit(jit, stub->pc, JIT_EXIT, epilogue);
+        return;
+    case stub_Truth:
+        jit_mov(jit, RDI, VM_REG);
+        jit_mem(jit, TRUE, 0x8D, RSI, stub->base, stub->disp);
+        jit_call(jit, jit_truth_error);
+        break;
+    case stub_Barrier:
+        jit_mov(jit, RDI, VM_REG);
+        jit_mov(jit, RSI, stub->scope);
+        jit_mem(jit, TRUE, 0x8D, RDX, stub->base, stub->disp);
+        jit_call(jit, jit_barrier);
+        jit_patch(jit, jit_jmp(jit), stub->resume);
+        return;
+    }
+
+    jit_exit(jit, stub->pc, JIT_ERROR, epilogue);
+}
+
+// NOTE: slots are addressed with 32 bit displacements
+bool jit_slot_fits(u64 ptr) {
+    return ptr <= INT32_MAX / VS - 1;
+}
+
+// NOTE: translates the loop one instruction at a time, the epilogue comes first so every exit jumps back to it,
+// and jumps that leave the loop exit to the interpreter at their target
+u32 jit_translate(Jit *jit, u8 *program, u64 header, u64 end) {
+    const u8 saved[] = { RBP, RBX, R12, R13, R14, R15 };
+    u32 *offsets;
+    u32 epilogue = 0;
+    u32 entry;
+
+    jit->code.len = 0;
+    jit->patches.len = 0;
+    jit->stubs.len = 0;
+    stack_ensure(&jit->offsets, end - header);
+    jit->offsets.len = (end - header) * sizeof (u32);
+    offsets = (u32 *) jit->offsets.arr;
+    memset(offsets, 0xFF, jit->offsets.len);
+
+    jit_store(jit, SP_REG, STATE_REG, offsetof(JitState, sp));
+    jit_alu_imm(jit, ALU_ADD, RSP, 8);
+
+    for (u64 i = sizeof (saved); i-- > 0;) {
+        jit_pop(jit, saved[i]);
+    }
+
+    jit_byte(jit, 0xC3);
+    entry = jit_here(jit);
+
+    for (u64 i = 0; i < sizeof (saved); ++i) {
+        jit_push(jit, saved[i]);
+    }
+
+    jit_alu_imm(jit, ALU_SUB, RSP, 8);
+    jit_mov(jit, VM_REG, RDI);
+    jit_mov(jit, STATE_REG, RSI);
+    jit_load(jit, SP_REG, STATE_REG, offsetof(JitState, sp));
+    jit_load(jit, SCOPE_REG, STATE_REG, offsetof(JitState, scope));
+    jit_load(jit, SLOTS_REG, SCOPE_REG, offsetof(VmScope, stack));
+
+    for (u64 pc = header; pc < end;) {
+        u64 at = pc;
+        u8 inst = program[pc++];
+        const char *kinds = inst_operands[inst];
+        u64 operands[3] = { 0, 0, 0 };
+        u8 base;
+        u8 scope;
+
+        offsets[at - header] = jit_here(jit);
+
+        for (u64 i = 0; kinds && kinds[i]; ++i) {
+            operands[i] = kinds[i] == 'u' ? decode_uint(program, &pc) : (u64) decode_int(program, &pc);
+        }
+
+        if ((inst == INST_PUSH || inst == INST_PULL_TO || inst == INST_STORE_POP || inst == INST_ADD_SLOT_IMM ||
+            inst == INST_SUB_SLOT_IMM || inst == INST_MUL_SLOT_IMM || inst == INST_BRANCH_F_SLOT) && !jit_slot_fits(operands[0])) {
+            return NO_OFFSET;
+        }
+
+#ifdef TAGGED_VALUES
+        // NOTE: native code never allocates, so a literal too wide to tag keeps the loop in the interpreter
+        if ((inst == INST_PUSH_INT && !INT_FITS(operands[0])) || ((inst == INST_ADD_SLOT_IMM || inst == INST_SUB_SLOT_IMM ||
+            inst == INST_MUL_SLOT_IMM) && !INT_FITS(operands[2]))) {
+            return NO_OFFSET;
+        }
+#endif
+
+        i32 disp = (i32) (operands[0] * VS);
+
+        switch (inst) {
+        case INST_PUSH_INT:
+            jit_push_int(jit, (i64) operands[0]);
+            break;
+        case INST_PUSH_NONE:
+            jit_push_none(jit);
+            break;
+        case INST_PUSH:
+            base = jit_slots(jit, operands[1], &scope);
+            jit_copy(jit, SP_REG, 0, base, disp);
+            jit_adjust_sp(jit, VS);
+            break;
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+            jit_arithmetic(jit, inst, at);
+            break;
+        case INST_NEG:
+            jit_negate(jit, at);
+            break;
+        case INST_POP:
+            jit_adjust_sp(jit, -VS);
+            break;
+        case INST_PULL_TO:
+        case INST_STORE_POP:
+            base = jit_slots(jit, operands[1], &scope);
+            jit_store_slot(jit, base, disp, scope, at);
+
+            if (inst == INST_STORE_POP) {
+                jit_adjust_sp(jit, -VS);
+            }
+
+            break;
+        case INST_ADD_SLOT_IMM:
+        case INST_SUB_SLOT_IMM:
+        case INST_MUL_SLOT_IMM:
+            base = jit_slots(jit, operands[1], &scope);
+            jit_slot_arithmetic(jit, inst, base, disp, (i64) operands[2], at);
+            break;
+        case INST_PRINT:
+            jit_adjust_sp(jit, -VS);
+            jit_mov(jit, RDI, SP_REG);
+            jit_call(jit, jit_print);
+            break;
+        case INST_JUMP:
+            jit_jump_to(jit, pc + operands[0]);
+            break;
+        case INST_BRANCH:
+        case INST_BRANCH_F:
+            jit_adjust_sp(jit, -VS);
+            jit_truth(jit, SP_REG, 0, inst == INST_BRANCH, pc + operands[0], at);
+            break;
+        case INST_BRANCH_F_SLOT:
+            base = jit_slots(jit, operands[1], &scope);
+            jit_truth(jit, base, disp, FALSE, pc + operands[2], at);
+            break;
+        default:
+            // NOTE: scopes are only entered and exited around the whole program, so a loop never has these
+            return NO_OFFSET;
+        }
+    }
+
+    // NOTE: a branch at the end can fall out of the loop
+    jit_jump_to(jit, end);
+
+    for (u64 i = 0; i < stack_len(&jit->patches); ++i) {
+        JitPatch *patch = stack_index(&jit->patches, i);
+
+        if (patch->target >= header && patch->target < end) {
+            if (offsets[patch->target - header] == NO_OFFSET) {
+                return NO_OFFSET;
+            }
+
+            jit_patch(jit, patch->at, offsets[patch->target - header]);
+        }
+        else if (patch->target > INT32_MAX) {
+            return NO_OFFSET;
+        }
+        else {
+            jit_patch(jit, patch->at, jit_here(jit));
+            jit_exit(jit, patch->target, JIT_EXIT, epilogue);
+        }
+    }
+
+    for (u64 i = 0; i < stack_len(&jit->stubs); ++i) {
+        jit_emit_stub(jit, stack_index(&jit->stubs, i), epilogue);
+    }
+
+    return entry;
+}
+
+// NOTE: code is written while the mapping is only writable and then made only executable
+JitCode jit_compile(Jit *jit, u8 *program, u64 header, u64 end) {
+    if (header > INT32_MAX || end > INT32_MAX) {
+        return NULL;
+    }
+
+    u32 entry = jit_translate(jit, program, header, end);
+
+    if (entry == NO_OFFSET) {
+        return NULL;
+    }
+
+    u64 page = (u64) sysconf(_SC_PAGESIZE);
+    JitMapping mapping = { NULL, (jit->code.len + page - 1) / page * page };
+
+    mapping.ptr = mmap(NULL, mapping.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapping.ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    memcpy(mapping.ptr, jit->code.arr, jit->code.len);
+
+    if (mprotect(mapping.ptr, mapping.size, PROT_READ | PROT_EXEC)) {
+        munmap(mapping.ptr, mapping.size);
+        return NULL;
+    }
+
+    stack_push(&jit->mappings, &mapping);
+
+    // NOTE: lets perf put a name on samples that land in the loop
+    if (jit->perf_map == NULL) {
+        char path[64];
+        sprintf_s(path, sizeof (path), "/tmp/perf-%d.map", (int) getpid());
+        jit->perf_map = fopen(path, "w");
+    }
+
+    if (jit->perf_map) {
+        fprintf(jit->perf_map, "%llx %llx jit_loop_%llu_%llu\n", (u64) mapping.ptr, jit->code.len, header, end);
+        fflush(jit->perf_map);
+    }
+
+#ifdef EBUG_JIT
+    fprintf(stderr, "jit: loop %llu-%llu, %llu bytes of bytecode to %llu of code\n", header, end, end - header, jit->code.len);
+#endif
+
+    return (JitCode) ((u8 *) mapping.ptr + entry);
+}
+
+#else
+
+JitCode jit_compile(UNUSED Jit *jit, UNUSED u8 *program, UNUSED u64 header, UNUSED u64 end) {
+    return NULL;
+}
+
+#endif
+
+// NOTE: counts the times the loop closed by a backward jump goes round, and once it's hot returns its native
+// code, or NULL while it isn't or when it can't be compiled
+JitCode jit_loop(Vm *vm, u64 header, u64 end) {
+    Jit *jit = &vm->jit;
+    JitLoop *loop = jit_get(jit, header, end);
+
+    if (loop->code || loop->failed) {
+        return loop->code;
+    }
+
+    if (++loop->count < JIT_HOT_LOOP) {
+        return NULL;
+    }
+
+    loop->code = jit_compile(jit, vm->program, header, end);
+    loop->failed = loop->code == NULL;
+
+    return loop->code;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "stack.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+#define JIT_HOT_LOOP 64 // NOTE: how many times a loop goes round in the interpreter before it's compiled
+
+typedef struct __Object__ Object;
+typedef struct __VmScope__ VmScope;
+typedef struct __Vm__ Vm;
+
+// NOTE: what the interpreter hands native code when entering it, and what it gets back when it leaves
+typedef struct {
+    Object *sp;
+    VmScope *scope;
+    u64 pc;
+} JitState;
+
+typedef u64 (*JitCode)(Vm *vm, JitState *state);
+
+// NOTE: a loop is the bytecode from the target of a backward jump up to the end of that jump
+typedef struct {
+    u64 header;
+    u64 end;
+    JitCode code;
+    u32 count;
+    bool used;
+    bool failed;
+} JitLoop;
+
+typedef struct {
+    JitLoop *loops;
+    u64 capacity;
+    u64 len;
+
+    Stack code; // NOTE: the loop being compiled, copied into a mapping of its own once it's done
+    Stack offsets;
+    Stack patches;
+    Stack stubs;
+    Stack mappings;
+    FILE *perf_map;
+    bool enabled;
+} Jit;
+
+void jit_init(Jit *jit);
+void jit_deinit(Jit *jit);
+JitCode jit_loop(Vm *vm, u64 header, u64 end);
+RESULT jit_run(Vm *vm, JitCode code);
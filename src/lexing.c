@@ -1,26 +1,51 @@
 #include <intsafe.h>
-#include <ctype.h>
 #include <string.h>
 #include "lexing.h"
 #include "context.h"
 
-#define MAX_OPERATOR_LEN 7
+#if defined(__SSE2__) && !defined(EBUG_CHARS)
+#include <emmintrin.h>
+#define SIMD_SCAN
+#endif
+
+#define CC_SPACE    0x01
+#define CC_DIGIT    0x02
+#define CC_ALPHA    0x04
+#define CC_OPERATOR 0x08
+#define CC_IDENT    (CC_ALPHA | CC_DIGIT)
+
+#define CLASS(c) char_class[(u8) (c)]
+
+// NOTE: replaces the ctype calls, which are locale aware and so can't be inlined, and must agree with the vector masks below
+const u8 char_class[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE, ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT,
+    ['a' ... 'z'] = CC_ALPHA, ['A' ... 'Z'] = CC_ALPHA, ['_'] = CC_ALPHA,
+    ['+'] = CC_OPERATOR, ['-'] = CC_OPERATOR, ['*'] = CC_OPERATOR, ['/'] = CC_OPERATOR,
+    ['\\'] = CC_OPERATOR, ['='] = CC_OPERATOR, [':'] = CC_OPERATOR,
+    ['{'] = CC_OPERATOR, ['}'] = CC_OPERATOR, ['('] = CC_OPERATOR, [')'] = CC_OPERATOR,
+};
+
+#ifdef SIMD_SCAN
+__m128i in_range(__m128i chunk, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8(hi + 1)));
+}
 
-bool is_operator(char c) {
-    return
-        c == '+' ||
-        c == '-' ||
-        c == '*' ||
-        c == '/' ||
-        c == '\\' ||
-        c == '=' ||
-        c == ':' ||
-        c == '{' ||
-        c == '}' ||
-        c == '(' ||
-        c == ')' ;
+// NOTE: bit i is set when byte i of the chunk is whitespace, i.e. ' ' or '\t' through '\r'
+u32 space_mask(__m128i chunk) {
+    return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), in_range(chunk, '\t', '\r')));
 }
 
+// NOTE: or-ing in 0x20 folds upper case onto lower case without pulling in any other byte
+u32 ident_mask(__m128i chunk) {
+    __m128i alpha = in_range(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i digit = in_range(chunk, '0', '9');
+    __m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), underscore));
+}
+#endif
+
 char peek(Lexer *lexer) {
 #ifdef EBUG_CHARS
     printf("'%c\n", lexer->context->program[lexer->index]);
@@ -43,7 +68,7 @@ RESULT lexer_integer(Lexer *lexer) {
     lexer->token_type = tt_Integer;
     lexer->integer = 0;
 
-    while (isdigit(peek(lexer))) {
+    while (CLASS(peek(lexer)) & CC_DIGIT) {
         HRESULT mult_result = ULongLongMult(lexer->integer, 10, &lexer->integer);
         HRESULT add_result = ULongLongAdd(lexer->integer, next(lexer) - '0', &lexer->integer);
 
@@ -58,55 +83,140 @@ RESULT lexer_integer(Lexer *lexer) {
     return FALSE;
 }
 
+// NOTE: a hand-unrolled trie over the operator list, so it must change along with OperatorType and op_to_sstr
 RESULT lexer_operator(Lexer *lexer) {
-    char op_str[MAX_OPERATOR_LEN + 1] = { 0 };
-    u8 i = 0;
+    char c = next(lexer);
 
-    bool op_found = FALSE;
-    u64 op_index;
-    u64 op;
+    lexer->token_type = tt_Operator;
 
-    while (is_operator(peek(lexer))) {
-        if (i >= MAX_OPERATOR_LEN + 1) {
-            break;
+    switch (c) {
+    case '=':   lexer->operator_type = op_Assignment;           break;
+    case '\\':  lexer->operator_type = op_Lambda;               break;
+    case '+':   lexer->operator_type = op_Addition;             break;
+    case '-':   lexer->operator_type = op_Subtraction;          break;
+    case '*':   lexer->operator_type = op_Multiplication;       break;
+    case '/':   lexer->operator_type = op_Division;             break;
+    case '(':   lexer->operator_type = op_OpenParenthesis;      break;
+    case ')':   lexer->operator_type = op_CloseParenthesis;     break;
+    case '{':   lexer->operator_type = op_OpenBrace;            break;
+    case '}':   lexer->operator_type = op_CloseBrace;           break;
+    case ':':
+        if (peek(lexer) == '=') {
+            next(lexer);
+            lexer->operator_type = op_Reassignment;
         }
+        else {
+            lexer->operator_type = op_Colon;
+        }
+        break;
+    default:
+        DISPATCH_ERROR_FMT(lexer->context, lexer->line, "Undefined operator `%c`", c);
+        return TRUE;
+    }
+
+    return FALSE;
+}
 
-        op_str[i++] = next(lexer);
+#define KEYWORD(str, kw) \
+    if (len == sizeof (str) - 1 && memcmp(start, str, len) == 0) { *keyword = kw; return FALSE; }
+
+// NOTE: same as lexer_operator, but for the keywords and keyword_to_str
+RESULT keyword_get(const char *start, u64 len, Keyword *keyword) {
+    switch (start[0]) {
+    case 'e':   KEYWORD("else", kw_Else);   break;
+    case 'i':   KEYWORD("if", kw_If);       break;
+    case 'p':   KEYWORD("print", kw_Print); break;
+    case 's':   KEYWORD("send", kw_Send);   break;
+    case 'w':   KEYWORD("while", kw_While); break;
+    }
+
+    return TRUE;
+}
 
-        if (!hashmap_get(&lexer->operator_map, op_str, &op)) {
-            op_found = TRUE;
-            op_index = lexer->index;
+// NOTE: most runs are short, so the first SCALAR_PREFIX bytes are checked one at a time before switching to
+// vectors, which rely on the program being padded, see FILE_PADDING
+#define SCALAR_PREFIX 8
+
+void lexer_skip_space(Lexer *lexer) {
+    const char *program = lexer->context->program;
+    u64 index = lexer->index;
+    u64 lines = 0;
+
+#ifdef SIMD_SCAN
+    for (u64 end = index + SCALAR_PREFIX; index < end; ++index) {
+#else
+    for (;; ++index) {
+#endif
+        char c = program[index];
+
+        if (!(CLASS(c) & CC_SPACE)) {
+            lexer->line += lines;
+            lexer->index = index;
+            return;
         }
+
+        lines += c == '\n';
     }
 
-    if (!op_found) {
-        DISPATCH_ERROR_FMT(lexer->context, lexer->line, "Undefined operator `%s`", op_str);
-        return TRUE;
+#ifdef SIMD_SCAN
+    for (;; index += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (program + index));
+        u32 newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+        u32 rest = ~space_mask(chunk) & 0xFFFF;
+
+        if (rest) {
+            u32 len = __builtin_ctz(rest);
+
+            lexer->line += lines + __builtin_popcount(newlines & ((1u << len) - 1));
+            lexer->index = index + len;
+            return;
+        }
+
+        lines += __builtin_popcount(newlines);
     }
+#endif
+}
 
-    lexer->token_type = tt_Operator;
-    lexer->operator_type = op;
-    lexer->index = op_index;
+void lexer_skip_ident(Lexer *lexer) {
+    const char *program = lexer->context->program;
+    u64 index = lexer->index;
 
-    return FALSE;
+#ifdef SIMD_SCAN
+    for (u64 end = index + SCALAR_PREFIX; index < end; ++index) {
+#else
+    for (;; ++index) {
+#endif
+        if (!(CLASS(program[index]) & CC_IDENT)) {
+            lexer->index = index;
+            return;
+        }
+    }
+
+#ifdef SIMD_SCAN
+    for (;; index += 16) {
+        u32 rest = ~ident_mask(_mm_loadu_si128((const __m128i *) (program + index))) & 0xFFFF;
+
+        if (rest) {
+            lexer->index = index + __builtin_ctz(rest);
+            return;
+        }
+    }
+#endif
 }
 
 RESULT lexer_ident_keyword(Lexer *lexer) {
-    u64 start = lexer->idents.len;
-    u64 keyword;
+    const char *start = lexer->context->program + lexer->index;
 
-    while (isalnum(peek(lexer)) || peek(lexer) == '_') {
-        stack_push_byte(&lexer->idents, next(lexer));
-    }
+    lexer_skip_ident(lexer);
 
-    stack_push_byte(&lexer->idents, 0);
-    lexer->token_type = tt_Identifier;
-    lexer->ident = (char *) lexer->idents.arr + start;
+    u64 len = lexer->context->program + lexer->index - start;
 
-    if (!hashmap_get(&lexer->keyword_map, lexer->ident, &keyword)) {
+    if (!keyword_get(start, len, &lexer->keyword)) {
         lexer->token_type = tt_Keyword;
-        lexer->keyword = (Keyword) keyword;
-        lexer->idents.len = start;
+    }
+    else {
+        lexer->token_type = tt_Identifier;
+        lexer->symbol = symbols_intern(&lexer->symbols, start, len);
     }
 
     return FALSE;
@@ -117,58 +227,33 @@ RESULT lexer_init(Lexer *lexer, Context *context) {
     lexer->line = 1;
     lexer->context = context;
 
-    stack_init(&lexer->idents, sizeof (u8));
-    hashmap_init(&lexer->operator_map);
-    hashmap_init(&lexer->keyword_map);
-
-    hashmap_put(&lexer->operator_map, "=", op_Assignment);
-    hashmap_put(&lexer->operator_map, ":=", op_Reassignment);
-    hashmap_put(&lexer->operator_map, "\\", op_Lambda);
-    hashmap_put(&lexer->operator_map, ":", op_Colon);
-    hashmap_put(&lexer->operator_map, "+", op_Addition);
-    hashmap_put(&lexer->operator_map, "-", op_Subtraction);
-    hashmap_put(&lexer->operator_map, "*", op_Multiplication);
-    hashmap_put(&lexer->operator_map, "/", op_Division);
-    hashmap_put(&lexer->operator_map, "(", op_OpenParenthesis);
-    hashmap_put(&lexer->operator_map, ")", op_CloseParenthesis);
-    hashmap_put(&lexer->operator_map, "{", op_OpenBrace);
-    hashmap_put(&lexer->operator_map, "}", op_CloseBrace);
-
-    hashmap_put(&lexer->keyword_map, "print", kw_Print);
-    hashmap_put(&lexer->keyword_map, "send", kw_Send);
-    hashmap_put(&lexer->keyword_map, "if", kw_If);
-    hashmap_put(&lexer->keyword_map, "else", kw_Else);
-    hashmap_put(&lexer->keyword_map, "while", kw_While);
+    symbols_init(&lexer->symbols);
 
     return lexer_next(lexer);
 }
 
 void lexer_deinit(Lexer *lexer) {
-    hashmap_deinit(&lexer->operator_map);
-    hashmap_deinit(&lexer->keyword_map);
+    symbols_deinit(&lexer->symbols);
 }
 
 RESULT lexer_next(Lexer *lexer) {
-    while (isspace(peek(lexer))) {
-        if (next(lexer) == '\n') {
-            lexer->line += 1;
-        }
-    }
+    lexer_skip_space(lexer);
 
     char c = peek(lexer);
+    lexer->token.str = lexer->context->program + lexer->index;
 
     switch (c) {
     case 0:
         lexer->token_type = tt_Eof;
         break;
     default:
-        if (isdigit(c)) {
+        if (CLASS(c) & CC_DIGIT) {
             CHECK(lexer_integer(lexer));
         }
-        else if (is_operator(c)) {
+        else if (CLASS(c) & CC_OPERATOR) {
             CHECK(lexer_operator(lexer));
         }
-        else if (isalpha(c) || c == '_') {
+        else if (CLASS(c) & CC_ALPHA) {
             CHECK(lexer_ident_keyword(lexer));
         }
         else {
@@ -177,6 +262,8 @@ RESULT lexer_next(Lexer *lexer) {
         }
     }
 
+    lexer->token.len = lexer->context->program + lexer->index - lexer->token.str;
+
 #ifdef EBUG_TOKENS
     token_to_str(lexer);
     printf("[%s]\n", lexer->token_str);
@@ -236,7 +323,7 @@ void token_to_str(Lexer *lexer) {
         sprintf(lexer->token_str, "%llu", lexer->integer);
         break;
     case tt_Identifier:
-        sprintf(lexer->token_str, "%s", lexer->ident);
+        sprintf_s(lexer->token_str, MAX_TOKEN_STR_LEN, "%.*s", VIEW_ARGS(lexer->token));
         break;
     case tt_Keyword:
         sprintf(lexer->token_str, "%s", keyword_to_str(lexer->keyword));
@@ -1,8 +1,8 @@
 #pragma once
 
 #include "auxiliary.h"
-#include "hashmap.h"
 #include "stack.h"
+#include "symbols.h"
 
 #define MAX_TOKEN_STR_LEN 512
 
@@ -49,17 +49,15 @@ typedef struct {
 
     u64 line;
 
-    HashMap operator_map;
-    HashMap keyword_map;
-
-    Stack idents;
+    SymbolTable symbols;
 
     char token_str[MAX_TOKEN_STR_LEN];
+    View token;
     JyTokenType token_type;
     union {
         u64 integer;
         OperatorType operator_type;
-        char *ident;
+        Symbol symbol;
         Keyword keyword;
     };
 } Lexer;
@@ -0,0 +1,727 @@
+#include <stdlib.h>
+#include "lowering.h"
+#include "compiling.h"
+
+#define REG_FREE    0
+#define REG_BUSY    1
+#define REG_LIMITED 2
+
+#define IR_TABLE_REG 0xFF // NOTE: the register given to a slot, kept in the IR's table alongside the loads
+
+#define IR_INTERVAL(lowering, value) ((IrInterval *) (lowering)->intervals.arr + (value))
+#define IR_REG(lowering, reg) ((IrReg *) (lowering)->regs.arr + (reg))
+
+void lowering_init(Lowering *lowering) {
+    stack_init(&lowering->intervals, sizeof (IrInterval));
+    stack_init(&lowering->items, sizeof (u64));
+    stack_init(&lowering->resumes, sizeof (u64));
+    stack_init(&lowering->active, sizeof (u64));
+    stack_init(&lowering->free, sizeof (u32));
+    stack_init(&lowering->limited, sizeof (u32));
+    stack_init(&lowering->regs, sizeof (IrReg));
+    stack_init(&lowering->moves, sizeof (IrMove));
+}
+
+void lowering_deinit(Lowering *lowering) {
+    stack_deinit(&lowering->intervals);
+    stack_deinit(&lowering->items);
+    stack_deinit(&lowering->resumes);
+    stack_deinit(&lowering->active);
+    stack_deinit(&lowering->free);
+    stack_deinit(&lowering->limited);
+    stack_deinit(&lowering->regs);
+    stack_deinit(&lowering->moves);
+}
+
+bool ir_live(Ir *ir, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+    return !inst->dead && !IR_BLOCK(ir, inst->block)->dead;
+}
+
+bool ir_in_loop(Ir *ir, u32 loop, u32 block) {
+    return IR_LOOP(ir, loop)->header <= block && block < IR_LOOP(ir, loop)->exit;
+}
+
+u32 ir_pred_index(Ir *ir, u32 block, u32 pred) {
+    u32 index = 0;
+
+    while (IR_BLOCK(ir, block)->preds[index] != pred) {
+        index += 1;
+    }
+
+    return index;
+}
+
+// NOTE: lays the blocks out in order and numbers every instruction in steps of two, a block's start and end
+// get numbers of their own so moves into phis and branches have somewhere to be
+void ir_number(Ir *ir, Lowering *lowering) {
+    u32 pos = 0;
+
+    stack_ensure(&lowering->intervals, ir_num_insts(ir));
+    lowering->intervals.len = ir_num_insts(ir) * sizeof (IrInterval);
+
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        block->start = pos;
+        pos += 2;
+
+        for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            if (!IR_INST(ir, value)->dead && IR_INST(ir, value)->block == id) {
+                *IR_INTERVAL(lowering, value) = (IrInterval) { pos, pos, IR_NONE, IR_NONE, IR_NONE, IR_NONE };
+                pos += 2;
+            }
+        }
+
+        block->end = pos;
+        pos += 2;
+    }
+
+    for (u32 id = 0; id < stack_len(&ir->loops); ++id) {
+        IR_LOOP(ir, id)->end = 0;
+    }
+
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        for (u32 loop = block->loop; loop != IR_NONE; loop = IR_LOOP(ir, loop)->parent) {
+            if (IR_LOOP(ir, loop)->end < block->end) {
+                IR_LOOP(ir, loop)->end = block->end;
+            }
+        }
+
+        // NOTE: a phi is written by the moves at the end of each predecessor, the earliest of which starts it
+        for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+            if (IR_INST(ir, phi)->dead) {
+                continue;
+            }
+
+            u32 start = IR_NONE;
+
+            for (u32 i = 0; i < block->num_preds; ++i) {
+                if (IR_BLOCK(ir, block->preds[i])->end < start) {
+                    start = IR_BLOCK(ir, block->preds[i])->end;
+                }
+            }
+
+            *IR_INTERVAL(lowering, phi) = (IrInterval) { start, start, IR_NONE, IR_NONE, IR_NONE, IR_NONE };
+        }
+    }
+}
+
+// NOTE: a use inside a loop the value was defined outside of needs it for the whole loop, and a use of a loop's
+// phi after the loop only needs it from the last time the loop goes back to its header
+void ir_use_at(Ir *ir, Lowering *lowering, u32 value, u32 pos, u32 block) {
+    IrInst *inst = IR_INST(ir, value);
+    IrInterval *interval = IR_INTERVAL(lowering, value);
+    u32 own = IR_BLOCK(ir, inst->block)->loop;
+    u32 outer = IR_NONE;
+
+    for (u32 loop = IR_BLOCK(ir, block)->loop; loop != IR_NONE && !ir_in_loop(ir, loop, inst->block); loop = IR_LOOP(ir, loop)->parent) {
+        outer = loop;
+    }
+
+    if (outer != IR_NONE && pos < IR_LOOP(ir, outer)->end) {
+        pos = IR_LOOP(ir, outer)->end;
+    }
+
+    if (inst->op == ir_Phi && own != IR_NONE && IR_LOOP(ir, own)->header == inst->block && pos > IR_LOOP(ir, own)->end) {
+        interval->resume = IR_LOOP(ir, own)->end;
+
+        if (interval->stop == IR_NONE || interval->stop < pos) {
+            interval->stop = pos;
+        }
+    }
+    else if (interval->end < pos) {
+        interval->end = pos;
+    }
+}
+
+void ir_intervals(Ir *ir, Lowering *lowering) {
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            IrInst *inst = IR_INST(ir, value);
+            u32 pos = IR_INTERVAL(lowering, value)->start;
+
+            if (inst->dead || inst->block != id) {
+                continue;
+            }
+
+            if (inst->op <= ir_Neg || inst->op == ir_Print) {
+                ir_use_at(ir, lowering, inst->args[0], pos, id);
+            }
+
+            if (inst->op < ir_Neg) {
+                ir_use_at(ir, lowering, inst->args[1], pos, id);
+            }
+        }
+
+        switch (block->term) {
+        case ir_Jump: {
+            IrBlock *succ = IR_BLOCK(ir, block->succs[0]);
+            u32 index = ir_pred_index(ir, block->succs[0], id);
+
+            for (u32 phi = succ->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+                if (!IR_INST(ir, phi)->dead) {
+                    ir_use_at(ir, lowering, IR_INST(ir, phi)->operands[index], block->end, id);
+                }
+            }
+
+            break;
+        }
+        case ir_Branch:
+            ir_use_at(ir, lowering, block->cond, block->end, id);
+            break;
+        case ir_Return:
+            if (id == ir->exit) {
+                u32 *stores = (u32 *) ir->stores.arr;
+
+                for (u64 i = 0; i < stack_len(&ir->stores); i += 2) {
+                    ir_use_at(ir, lowering, stores[i + 1], block->end, id);
+                }
+            }
+
+            break;
+        }
+    }
+
+    // NOTE: the exit is taken from the condition, so a phi needed after the loop has to last until then
+    for (u32 id = 0; id < stack_len(&ir->loops); ++id) {
+        IrLoop *loop = IR_LOOP(ir, id);
+
+        if (IR_BLOCK(ir, loop->header)->dead) {
+            continue;
+        }
+
+        for (u32 phi = IR_BLOCK(ir, loop->header)->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+            IrInterval *interval = IR_INTERVAL(lowering, phi);
+
+            if (IR_INST(ir, phi)->dead || interval->resume == IR_NONE) {
+                continue;
+            }
+
+            if (interval->end < IR_BLOCK(ir, loop->cond)->end) {
+                interval->end = IR_BLOCK(ir, loop->cond)->end;
+            }
+
+            if (interval->end >= interval->resume) {
+                interval->end = interval->stop;
+                interval->resume = IR_NONE;
+                interval->stop = IR_NONE;
+            }
+        }
+    }
+}
+
+// NOTE: a value stored to a variable is computed straight into its slot when the variable's old value is no
+// longer needed by then, and a value a phi takes from the end of a block prefers the phi's register
+void ir_hints(Ir *ir, Lowering *lowering) {
+    u32 *stores = (u32 *) ir->stores.arr;
+
+    ir_table_clear(&ir->table);
+
+    for (u32 value = IR_BLOCK(ir, ir->entry)->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+        IrInst *inst = IR_INST(ir, value);
+
+        if (inst->op == ir_Load && !inst->dead) {
+            ir_table_put(&ir->table, ir_table_find(&ir->table, ir_Load, inst->value), ir_Load, inst->value, value);
+        }
+    }
+
+    if (!IR_BLOCK(ir, ir->exit)->dead) {
+        for (u64 i = 0; i < stack_len(&ir->stores); i += 2) {
+            u32 value = stores[i + 1];
+            IrInterval *interval = IR_INTERVAL(lowering, value);
+            IrSlot *load = ir_table_find(&ir->table, ir_Load, stores[i]);
+
+            if (IR_INST(ir, value)->op == ir_Load || interval->slot != IR_NONE) {
+                continue;
+            }
+
+            if (load->gen != ir->table.gen || IR_INTERVAL(lowering, load->value)->end <= interval->start) {
+                interval->slot = stores[i];
+            }
+        }
+    }
+
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+            if (IR_INST(ir, phi)->dead) {
+                continue;
+            }
+
+            for (u32 i = 0; i < block->num_preds; ++i) {
+                u32 operand = IR_INST(ir, phi)->operands[i];
+                IrInst *inst = IR_INST(ir, operand);
+
+                if (inst->op != ir_Load && inst->op != ir_Phi && IR_INTERVAL(lowering, operand)->hint == IR_NONE) {
+                    IR_INTERVAL(lowering, operand)->hint = phi;
+                }
+            }
+        }
+    }
+}
+
+void ir_heap_push(Stack *heap, u64 item) {
+    stack_push(heap, &item);
+
+    u64 *arr = (u64 *) heap->arr;
+
+    for (u64 i = stack_len(heap) - 1; i > 0;) {
+        u64 parent = (i - 1) / 2;
+
+        if (arr[parent] <= arr[i]) {
+            break;
+        }
+
+        u64 temp = arr[parent];
+        arr[parent] = arr[i];
+        arr[i] = temp;
+        i = parent;
+    }
+}
+
+u64 ir_heap_pop(Stack *heap) {
+    u64 *arr = (u64 *) heap->arr;
+    u64 top = arr[0];
+    u64 last;
+
+    stack_pop(heap, &last);
+
+    u64 len = stack_len(heap);
+
+    if (len == 0) {
+        return top;
+    }
+
+    arr[0] = last;
+
+    for (u64 i = 0;;) {
+        u64 least = i;
+        u64 left = i * 2 + 1;
+        u64 right = left + 1;
+
+        if (left < len && arr[left] < arr[least]) least = left;
+        if (right < len && arr[right] < arr[least]) least = right;
+
+        if (least == i) {
+            break;
+        }
+
+        u64 temp = arr[least];
+        arr[least] = arr[i];
+        arr[i] = temp;
+        i = least;
+    }
+
+    return top;
+}
+
+int ir_compare(const void *a, const void *b) {
+    u64 x = *(const u64 *) a;
+    u64 y = *(const u64 *) b;
+    return (x > y) - (x < y);
+}
+
+u32 ir_reg_new(Lowering *lowering, u8 state, u64 index) {
+    IrReg reg = { state, IR_NONE, index };
+
+    stack_push(&lowering->regs, &reg);
+
+    return stack_len(&lowering->regs) - 1;
+}
+
+u32 ir_slot_reg(Ir *ir, Lowering *lowering, u32 slot) {
+    IrSlot *entry = ir_table_find(&ir->table, IR_TABLE_REG, slot);
+
+    if (entry->gen == ir->table.gen) {
+        return entry->value;
+    }
+
+    u32 reg = ir_reg_new(lowering, REG_FREE, slot);
+
+    ir_table_put(&ir->table, ir_table_find(&ir->table, IR_TABLE_REG, slot), IR_TABLE_REG, slot, reg);
+
+    return reg;
+}
+
+bool ir_available(Lowering *lowering, u32 reg, IrInterval *interval) {
+    if (reg == IR_NONE) {
+        return FALSE;
+    }
+
+    IrReg *r = IR_REG(lowering, reg);
+
+    return r->state == REG_FREE || (r->state == REG_LIMITED && interval->resume == IR_NONE && r->limit >= interval->end);
+}
+
+// NOTE: prefers the register of the phi the value flows into or of an operand that dies here, since either saves
+// a move, then one a loop phi lends out while it's not needed, then any free one
+u32 ir_pick(Ir *ir, Lowering *lowering, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+    IrInterval *interval = IR_INTERVAL(lowering, value);
+
+    if (interval->slot != IR_NONE) {
+        return ir_slot_reg(ir, lowering, interval->slot);
+    }
+
+    if (interval->hint != IR_NONE && ir_available(lowering, IR_INST(ir, interval->hint)->reg, interval)) {
+        return IR_INST(ir, interval->hint)->reg;
+    }
+
+    if (inst->op == ir_Phi) {
+        for (u32 i = 0; i < IR_BLOCK(ir, inst->block)->num_preds; ++i) {
+            if (ir_available(lowering, IR_INST(ir, inst->operands[i])->reg, interval)) {
+                return IR_INST(ir, inst->operands[i])->reg;
+            }
+        }
+    }
+    else if (inst->op <= ir_Neg) {
+        if (ir_available(lowering, IR_INST(ir, inst->args[0])->reg, interval)) {
+            return IR_INST(ir, inst->args[0])->reg;
+        }
+
+        if (inst->op < ir_Neg && ir_available(lowering, IR_INST(ir, inst->args[1])->reg, interval)) {
+            return IR_INST(ir, inst->args[1])->reg;
+        }
+    }
+
+    if (interval->resume == IR_NONE) {
+        u32 *limited = (u32 *) lowering->limited.arr;
+        u64 len = 0;
+        u32 found = IR_NONE;
+
+        for (u64 i = 0; i < stack_len(&lowering->limited); ++i) {
+            if (IR_REG(lowering, limited[i])->state != REG_LIMITED) {
+                continue;
+            }
+
+            if (found == IR_NONE && ir_available(lowering, limited[i], interval)) {
+                found = limited[i];
+            }
+
+            limited[len++] = limited[i];
+        }
+
+        lowering->limited.len = len * sizeof (u32);
+
+        if (found != IR_NONE) {
+            return found;
+        }
+    }
+
+    while (lowering->free.len) {
+        u32 reg;
+        stack_pop(&lowering->free, &reg);
+
+        if (IR_REG(lowering, reg)->state == REG_FREE) {
+            return reg;
+        }
+    }
+
+    return ir_reg_new(lowering, REG_FREE, lowering->temp_base + lowering->temps++);
+}
+
+void ir_expire(Ir *ir, Lowering *lowering, u64 item) {
+    u32 value = (u32) item;
+    IrInterval *interval = IR_INTERVAL(lowering, value);
+    u32 reg = IR_INST(ir, value)->reg;
+    IrReg *r = IR_REG(lowering, reg);
+
+    if (interval->resume != IR_NONE && (u32) (item >> 32) == interval->end) {
+        r->limit = interval->resume;
+    }
+
+    if (r->limit != IR_NONE) {
+        r->state = REG_LIMITED;
+        stack_push(&lowering->limited, &reg);
+    }
+    else {
+        r->state = REG_FREE;
+
+        if (r->index >= lowering->temp_base) {
+            stack_push(&lowering->free, &reg);
+        }
+    }
+}
+
+// NOTE: linear scan over the intervals in order of their starts
+void ir_allocate(Ir *ir, Lowering *lowering) {
+    lowering->items.len = 0;
+    lowering->resumes.len = 0;
+    lowering->active.len = 0;
+    lowering->free.len = 0;
+    lowering->limited.len = 0;
+    lowering->regs.len = 0;
+
+    for (u32 value = 0; value < ir_num_insts(ir); ++value) {
+        IrInst *inst = IR_INST(ir, value);
+        inst->reg = IR_NONE;
+
+        if (!ir_live(ir, value) || inst->op == ir_Load || inst->op == ir_Print) {
+            continue;
+        }
+
+        u64 item = (u64) IR_INTERVAL(lowering, value)->start << 32 | value;
+        stack_push(&lowering->items, &item);
+
+        if (IR_INTERVAL(lowering, value)->resume != IR_NONE) {
+            item = (u64) IR_INTERVAL(lowering, value)->resume << 32 | value;
+            stack_push(&lowering->resumes, &item);
+        }
+    }
+
+    qsort(lowering->items.arr, stack_len(&lowering->items), sizeof (u64), ir_compare);
+    qsort(lowering->resumes.arr, stack_len(&lowering->resumes), sizeof (u64), ir_compare);
+
+    u64 *resumes = (u64 *) lowering->resumes.arr;
+    u64 next = 0;
+
+    for (u64 i = 0; i < stack_len(&lowering->items); ++i) {
+        u64 item = ((u64 *) lowering->items.arr)[i];
+        u32 start = item >> 32;
+        u32 value = (u32) item;
+
+        for (;;) {
+            u64 ends = lowering->active.len ? *(u64 *) lowering->active.arr >> 32 : IR_NONE;
+            u64 resume = next < stack_len(&lowering->resumes) ? resumes[next] >> 32 : IR_NONE;
+
+            if (ends <= start && ends <= resume) {
+                ir_expire(ir, lowering, ir_heap_pop(&lowering->active));
+            }
+            else if (resume <= start) {
+                u32 phi = (u32) resumes[next++];
+                IrReg *reg = IR_REG(lowering, IR_INST(ir, phi)->reg);
+
+                reg->state = REG_BUSY;
+                reg->limit = IR_NONE;
+                ir_heap_push(&lowering->active, (u64) IR_INTERVAL(lowering, phi)->stop << 32 | phi);
+            }
+            else {
+                break;
+            }
+        }
+
+        u32 reg = ir_pick(ir, lowering, value);
+
+        IR_REG(lowering, reg)->state = REG_BUSY;
+        IR_INST(ir, value)->reg = reg;
+        ir_heap_push(&lowering->active, (u64) IR_INTERVAL(lowering, value)->end << 32 | value);
+    }
+}
+
+u64 ir_reg_index(Ir *ir, Lowering *lowering, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+    return inst->op == ir_Load ? (u64) inst->value : IR_REG(lowering, inst->reg)->index;
+}
+
+void ir_emit_reg(Compiler *compiler, u64 index) {
+    compiler_emit_reg(compiler, (Reg) { FALSE, index });
+}
+
+void ir_move(Lowering *lowering, u64 dst, u64 src) {
+    if (dst != src) {
+        IrMove move = { dst, src };
+        stack_push(&lowering->moves, &move);
+    }
+}
+
+// NOTE: the moves are parallel, so each one waits until nothing left reads its destination, and when every
+// remaining destination is still to be read they form cycles, one of which is broken through a scratch register
+void ir_emit_moves(Ir *ir, Lowering *lowering) {
+    Compiler *compiler = ir->compiler;
+    IrMove *moves = (IrMove *) lowering->moves.arr;
+    u64 count = stack_len(&lowering->moves);
+
+    while (count) {
+        u64 ready = count;
+
+        for (u64 i = 0; i < count && ready == count; ++i) {
+            ready = i;
+
+            for (u64 j = 0; j < count; ++j) {
+                if (moves[j].src == moves[i].dst) {
+                    ready = count;
+                    break;
+                }
+            }
+        }
+
+        if (ready == count) {
+            u64 scratch = lowering->temp_base + lowering->temps;
+            u64 saved = moves[0].dst;
+
+            compiler_emit_instruction(compiler, RINST_MOVE);
+            ir_emit_reg(compiler, scratch);
+            ir_emit_reg(compiler, saved);
+            lowering->scratch = TRUE;
+
+            for (u64 j = 0; j < count; ++j) {
+                if (moves[j].src == saved) {
+                    moves[j].src = scratch;
+                }
+            }
+
+            continue;
+        }
+
+        compiler_emit_instruction(compiler, RINST_MOVE);
+        ir_emit_reg(compiler, moves[ready].dst);
+        ir_emit_reg(compiler, moves[ready].src);
+        moves[ready] = moves[--count];
+    }
+
+    lowering->moves.len = 0;
+}
+
+void ir_emit_inst(Ir *ir, Lowering *lowering, u32 value) {
+    Compiler *compiler = ir->compiler;
+    IrInst *inst = IR_INST(ir, value);
+
+    switch (inst->op) {
+    case ir_Add:
+    case ir_Sub:
+    case ir_Mul:
+    case ir_Div:
+        compiler_emit_instruction(compiler, RINST_ADD + inst->op);
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, value));
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, inst->args[0]));
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, inst->args[1]));
+        break;
+    case ir_Neg:
+        compiler_emit_instruction(compiler, RINST_NEG);
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, value));
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, inst->args[0]));
+        break;
+    case ir_Const:
+        compiler_emit_instruction(compiler, RINST_LOAD_INT);
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, value));
+        compiler_emit_int(compiler, inst->value);
+        break;
+    case ir_None:
+        compiler_emit_instruction(compiler, RINST_LOAD_NONE);
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, value));
+        break;
+    case ir_Print:
+        compiler_emit_instruction(compiler, RINST_PRINT);
+        ir_emit_reg(compiler, ir_reg_index(ir, lowering, inst->args[0]));
+        break;
+    case ir_Load:
+    case ir_Phi:
+        break;
+    }
+}
+
+// NOTE: there are no critical edges, a block that branches only goes to blocks with a single predecessor,
+// so the moves into a block's phis can always be made at the end of the block before it
+void ir_emit_blocks(Ir *ir, Lowering *lowering) {
+    Compiler *compiler = ir->compiler;
+    u32 *stores = (u32 *) ir->stores.arr;
+    u32 num_blocks = ir_num_blocks(ir);
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        IR_BLOCK(ir, id)->label = assembler_get_next(&compiler->assembler);
+    }
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+        u32 next = id + 1;
+
+        if (block->dead) {
+            continue;
+        }
+
+        while (next < num_blocks && IR_BLOCK(ir, next)->dead) {
+            next += 1;
+        }
+
+        compiler_emit_label_def(compiler, block->label);
+
+        for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            if (!IR_INST(ir, value)->dead && IR_INST(ir, value)->block == id) {
+                ir_emit_inst(ir, lowering, value);
+            }
+        }
+
+        switch (block->term) {
+        case ir_Jump: {
+            IrBlock *succ = IR_BLOCK(ir, block->succs[0]);
+            u32 index = ir_pred_index(ir, block->succs[0], id);
+
+            for (u32 phi = succ->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+                if (!IR_INST(ir, phi)->dead) {
+                    ir_move(lowering, ir_reg_index(ir, lowering, phi), ir_reg_index(ir, lowering, IR_INST(ir, phi)->operands[index]));
+                }
+            }
+
+            ir_emit_moves(ir, lowering);
+
+            if (block->succs[0] != next) {
+                compiler_emit_instruction(compiler, RINST_JUMP);
+                compiler_emit_label_ref(compiler, succ->label);
+            }
+
+            break;
+        }
+        case ir_Branch:
+            compiler_emit_instruction(compiler, RINST_BRANCH_F);
+            ir_emit_reg(compiler, ir_reg_index(ir, lowering, block->cond));
+            compiler_emit_label_ref(compiler, IR_BLOCK(ir, block->succs[1])->label);
+
+            if (block->succs[0] != next) {
+                compiler_emit_instruction(compiler, RINST_JUMP);
+                compiler_emit_label_ref(compiler, IR_BLOCK(ir, block->succs[0])->label);
+            }
+
+            break;
+        case ir_Return:
+            if (id == ir->exit) {
+                for (u64 i = 0; i < stack_len(&ir->stores); i += 2) {
+                    ir_move(lowering, stores[i], ir_reg_index(ir, lowering, stores[i + 1]));
+                }
+
+                ir_emit_moves(ir, lowering);
+            }
+
+            break;
+        }
+    }
+}
+
+// NOTE: turns the optimized IR of a statement back into register bytecode, temporaries are placed from the
+// compiler's temp_base up like the ones compile_reg_statement uses
+void ir_lower(Ir *ir, Lowering *lowering) {
+    Compiler *compiler = ir->compiler;
+
+    lowering->temp_base = compiler->temp_base;
+    lowering->temps = 0;
+    lowering->scratch = FALSE;
+
+    ir_number(ir, lowering);
+    ir_intervals(ir, lowering);
+    ir_hints(ir, lowering);
+    ir_allocate(ir, lowering);
+    ir_emit_blocks(ir, lowering);
+
+    compiler->max_temps = lowering->temps + lowering->scratch;
+}
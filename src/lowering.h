@@ -0,0 +1,48 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "stack.h"
+#include "ir.h"
+
+// NOTE: a value is live from `start` to `end`, a loop phi that's still needed after its loop is dead in between
+// and live again from `resume` to `stop`, `slot` is the variable it's stored to if it can be computed right there
+// and `hint` the phi it flows into
+typedef struct {
+    u32 start;
+    u32 end;
+    u32 resume;
+    u32 stop;
+    u32 slot;
+    u32 hint;
+} IrInterval;
+
+// NOTE: a limited register is free until `limit`, where the loop phi it belongs to needs it again
+typedef struct {
+    u8 state;
+    u32 limit;
+    u64 index;
+} IrReg;
+
+typedef struct {
+    u32 dst;
+    u32 src;
+} IrMove;
+
+typedef struct {
+    Stack intervals;
+    Stack items;
+    Stack resumes;
+    Stack active;
+    Stack free;
+    Stack limited;
+    Stack regs;
+    Stack moves;
+
+    u64 temp_base;
+    u32 temps;
+    bool scratch;
+} Lowering;
+
+void lowering_init(Lowering *lowering);
+void lowering_deinit(Lowering *lowering);
+void ir_lower(Ir *ir, Lowering *lowering);
@@ -3,13 +3,45 @@
 // TODO: fixed signedness issue (negation can overflow and literals can be too large to be signed)
 int main(int argc, char **argv) {
     Context context;
+    u64 flags = 0;
+    int arg = 1;
 
-    if (argc < 2) {
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "-r") == 0) {
+            flags |= CONTEXT_REGISTERS;
+        }
+        else if (strcmp(argv[arg], "-O") == 0) {
+            flags |= CONTEXT_OPTIMIZE | CONTEXT_REGISTERS; // NOTE: the IR is only lowered to register bytecode
+        }
+        else if (strcmp(argv[arg], "-j") == 0) {
+            flags |= CONTEXT_JIT;
+        }
+        else if (strcmp(argv[arg], "-a") == 0) {
+            flags |= CONTEXT_AOT; // NOTE: prints the program translated to C instead of running it
+        }
+        else if (strcmp(argv[arg], "-c") == 0) {
+            flags |= CONTEXT_CACHE;
+        }
+        else {
+            fprintf(stderr, FATAL "Unknown option `%s`\n", argv[arg]);
+            return 1;
+        }
+    }
+
+    if (arg >= argc) {
         fprintf(stderr, FATAL "File not specified\n");
         return 1;
     }
 
-    context_init(&context, argv[1]);
+#ifdef EBUG_ALLOCATIONS
+    begin_tracking();
+#endif
+
+    context_init(&context, argv[arg], flags);
     context_run(&context);
     context_deinit(&context);
+
+#ifdef EBUG_ALLOCATIONS
+    tracking_diagnostics();
+#endif
 }
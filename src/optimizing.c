@@ -0,0 +1,602 @@
+#include <stdint.h>
+#include <string.h>
+#include "optimizing.h"
+#include "folding.h"
+
+// NOTE: an instruction is pure when dropping, repeating or moving it can't change what the program does,
+// arithmetic only stops the program on a type error or a division trap, so it's pure once those are ruled out
+bool ir_pure(Ir *ir, IrInst *inst) {
+    switch (inst->op) {
+    case ir_Add:
+    case ir_Sub:
+    case ir_Mul:
+        return IR_INST(ir, inst->args[0])->integer && IR_INST(ir, inst->args[1])->integer;
+    case ir_Div:
+        return IR_INST(ir, inst->args[0])->integer && IR_INST(ir, inst->args[1])->op == ir_Const &&
+            IR_INST(ir, inst->args[1])->value != 0 && IR_INST(ir, inst->args[1])->value != -1;
+    case ir_Neg:
+        return IR_INST(ir, inst->args[0])->integer;
+    case ir_Const:
+    case ir_None:
+    case ir_Load:
+    case ir_Phi:
+        return TRUE;
+    case ir_Print:
+        return FALSE;
+    }
+
+    UNREACHABLE();
+}
+
+bool ir_is_const(Ir *ir, u32 value, i64 integer) {
+    IrInst *inst = IR_INST(ir, value);
+    return inst->op == ir_Const && inst->value == integer;
+}
+
+void ir_replace(Ir *ir, u32 value, u32 with) {
+    IrInst *inst = IR_INST(ir, value);
+
+    inst->forward = with;
+    inst->dead = TRUE;
+}
+
+void ir_make_const(IrInst *inst, i64 integer) {
+    inst->op = ir_Const;
+    inst->value = integer;
+    inst->integer = TRUE;
+}
+
+// NOTE: the same identities fold_binary applies to the tree, they can only be seen here once variables are
+// replaced by their values
+bool ir_simplify_inst(Ir *ir, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+    u32 lhs;
+    u32 rhs;
+    i64 result;
+
+    switch (inst->op) {
+    case ir_Add:
+    case ir_Sub:
+    case ir_Mul:
+    case ir_Div:
+        lhs = inst->args[0] = ir_resolve(ir, inst->args[0]);
+        rhs = inst->args[1] = ir_resolve(ir, inst->args[1]);
+
+        if (IR_INST(ir, lhs)->op == ir_Const && IR_INST(ir, rhs)->op == ir_Const) {
+            if (fold_arithmetic(op_Addition + inst->op, IR_INST(ir, lhs)->value, IR_INST(ir, rhs)->value, &result)) {
+                ir_make_const(inst, result);
+                return TRUE;
+            }
+
+            return FALSE;
+        }
+
+        bool integers = IR_INST(ir, lhs)->integer && IR_INST(ir, rhs)->integer;
+
+        if (!integers) {
+            return FALSE;
+        }
+
+        switch (inst->op) {
+        case ir_Add:
+            if (ir_is_const(ir, rhs, 0)) { ir_replace(ir, value, lhs); return TRUE; }
+            if (ir_is_const(ir, lhs, 0)) { ir_replace(ir, value, rhs); return TRUE; }
+            break;
+        case ir_Sub:
+            if (ir_is_const(ir, rhs, 0)) { ir_replace(ir, value, lhs); return TRUE; }
+            break;
+        case ir_Mul:
+            if (ir_is_const(ir, rhs, 1)) { ir_replace(ir, value, lhs); return TRUE; }
+            if (ir_is_const(ir, lhs, 1)) { ir_replace(ir, value, rhs); return TRUE; }
+            if (ir_is_const(ir, lhs, 0) || ir_is_const(ir, rhs, 0)) { ir_make_const(inst, 0); return TRUE; }
+            break;
+        case ir_Div:
+            if (ir_is_const(ir, rhs, 1)) { ir_replace(ir, value, lhs); return TRUE; }
+            break;
+        default:
+            break;
+        }
+
+        return FALSE;
+    case ir_Neg:
+        lhs = inst->args[0] = ir_resolve(ir, inst->args[0]);
+
+        if (IR_INST(ir, lhs)->op == ir_Const) {
+            ir_make_const(inst, (i64) (~(u64) IR_INST(ir, lhs)->value + 1));
+            return TRUE;
+        }
+
+        if (IR_INST(ir, lhs)->op == ir_Neg) {
+            u32 oprand = ir_resolve(ir, IR_INST(ir, lhs)->args[0]);
+
+            if (IR_INST(ir, oprand)->integer) {
+                ir_replace(ir, value, oprand);
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    case ir_Print:
+        inst->args[0] = ir_resolve(ir, inst->args[0]);
+        return FALSE;
+    default:
+        return FALSE;
+    }
+}
+
+// NOTE: a phi whose operands are all the same value, or itself, is that value
+bool ir_simplify_phi(Ir *ir, u32 phi) {
+    IrInst *inst = IR_INST(ir, phi);
+    u32 num_preds = IR_BLOCK(ir, inst->block)->num_preds;
+    u32 same = IR_NONE;
+    bool trivial = TRUE;
+    bool integer = TRUE;
+
+    for (u32 i = 0; i < num_preds; ++i) {
+        u32 operand = inst->operands[i] = ir_resolve(ir, inst->operands[i]);
+
+        if (operand == phi) {
+            continue;
+        }
+
+        integer = integer && IR_INST(ir, operand)->integer;
+
+        if (same != IR_NONE && operand != same) {
+            trivial = FALSE;
+        }
+
+        same = operand;
+    }
+
+    if (trivial && same != IR_NONE) {
+        ir_replace(ir, phi, same);
+        return TRUE;
+    }
+
+    if (integer && !inst->integer) {
+        inst->integer = TRUE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// NOTE: a branch on a known value becomes a jump, which can leave phis in the block it no longer goes to trivial
+bool ir_simplify_branch(Ir *ir, u32 id) {
+    IrBlock *block = IR_BLOCK(ir, id);
+    IrInst *cond = IR_INST(ir, block->cond = ir_resolve(ir, block->cond));
+    bool truth;
+
+    switch (cond->op) {
+    case ir_Const:
+        truth = cond->value != 0;
+        break;
+    case ir_None:
+        truth = FALSE;
+        break;
+    default:
+        return FALSE;
+    }
+
+    u32 taken = truth ? block->succs[0] : block->succs[1];
+    u32 skipped = truth ? block->succs[1] : block->succs[0];
+
+    block->term = ir_Jump;
+    block->succs[0] = taken;
+    block->succs[1] = IR_NONE;
+
+    ir_remove_pred(ir, skipped, id);
+
+    return TRUE;
+}
+
+// NOTE: copy and constant propagation, replacing every use of a value that's known to be another through `forward`
+bool ir_propagate(Ir *ir) {
+    bool changed = FALSE;
+    bool again;
+
+    do {
+        again = FALSE;
+
+        for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+            IrBlock *block = IR_BLOCK(ir, id);
+
+            if (block->dead) {
+                continue;
+            }
+
+            for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+                if (!IR_INST(ir, phi)->dead) {
+                    again |= ir_simplify_phi(ir, phi);
+                }
+            }
+
+            for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+                if (!IR_INST(ir, value)->dead && IR_INST(ir, value)->block == id) {
+                    again |= ir_simplify_inst(ir, value);
+                }
+            }
+
+            if (IR_BLOCK(ir, id)->term == ir_Branch) {
+                again |= ir_simplify_branch(ir, id);
+            }
+        }
+
+        changed |= again;
+    } while (again);
+
+    return changed;
+}
+
+void ir_kill_block(Ir *ir, u32 id) {
+    IrBlock *block = IR_BLOCK(ir, id);
+
+    block->dead = TRUE;
+
+    for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+        IR_INST(ir, phi)->dead = TRUE;
+    }
+
+    for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+        if (IR_INST(ir, value)->block == id) {
+            IR_INST(ir, value)->dead = TRUE;
+        }
+    }
+}
+
+// NOTE: every edge but a loop's back edge goes to a later block and every header is also entered from its
+// preheader, so one pass in order finds everything reachable
+bool ir_unreachable(Ir *ir) {
+    u32 num_blocks = ir_num_blocks(ir);
+    bool changed = FALSE;
+
+    stack_ensure(&ir->scratch, num_blocks);
+    u32 *reached = (u32 *) ir->scratch.arr;
+    memset(reached, 0, num_blocks * sizeof (u32));
+    reached[ir->entry] = TRUE;
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        if (!reached[id]) {
+            for (u32 i = 0; i < 2; ++i) {
+                if (block->succs[i] != IR_NONE && (block->term == ir_Branch || (block->term == ir_Jump && i == 0))) {
+                    ir_remove_pred(ir, block->succs[i], id);
+                }
+            }
+
+            ir_kill_block(ir, id);
+            changed = TRUE;
+            continue;
+        }
+
+        switch (block->term) {
+        case ir_Branch:
+            reached[block->succs[1]] = TRUE;
+            // fallthrough
+        case ir_Jump:
+            reached[block->succs[0]] = TRUE;
+            break;
+        case ir_Return:
+            break;
+        }
+    }
+
+    return changed;
+}
+
+// NOTE: numbers the dominator tree, the tree built alongside the blocks always has a block's parent before it,
+// so sizes are summed backwards and each block takes the next free number under its parent going forwards,
+// `pre` is left holding each block's position in preorder and `order` the blocks in that order
+u32 ir_dominators(Ir *ir, u32 *pre, u32 *size, u32 *order) {
+    u32 num_blocks = ir_num_blocks(ir);
+    u32 count = 0;
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        size[id] = !IR_BLOCK(ir, id)->dead;
+    }
+
+    for (u32 id = num_blocks; id-- > 1;) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (!block->dead && block->idom != IR_NONE) {
+            size[block->idom] += size[id];
+        }
+    }
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        pre[id] = block->idom == IR_NONE ? 0 : order[block->idom];
+        order[id] = pre[id] + 1;
+
+        if (block->idom != IR_NONE) {
+            order[block->idom] += size[id];
+        }
+
+        count += 1;
+    }
+
+    for (u32 id = 0; id < num_blocks; ++id) {
+        if (!IR_BLOCK(ir, id)->dead) {
+            order[pre[id]] = id;
+        }
+    }
+
+    return count;
+}
+
+bool ir_dominates(u32 *pre, u32 *size, u32 a, u32 b) {
+    return pre[a] <= pre[b] && pre[b] < pre[a] + size[a];
+}
+
+// NOTE: common subexpressions, walking the dominator tree in preorder means an entry that doesn't dominate the
+// current block belongs to a subtree that's finished with, so it can simply be overwritten
+void ir_cse(Ir *ir) {
+    u32 num_blocks = ir_num_blocks(ir);
+
+    stack_ensure(&ir->scratch, num_blocks * 3);
+    u32 *pre = (u32 *) ir->scratch.arr;
+    u32 *size = pre + num_blocks;
+    u32 *order = size + num_blocks;
+    u32 count = ir_dominators(ir, pre, size, order);
+
+    ir_table_clear(&ir->table);
+
+    for (u32 i = 0; i < count; ++i) {
+        u32 id = order[i];
+
+        for (u32 value = IR_BLOCK(ir, id)->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            IrInst *inst = IR_INST(ir, value);
+            u64 key;
+
+            if (inst->dead || inst->block != id) {
+                continue;
+            }
+
+            switch (inst->op) {
+            case ir_Add:
+            case ir_Mul:
+                inst->args[0] = ir_resolve(ir, inst->args[0]);
+                inst->args[1] = ir_resolve(ir, inst->args[1]);
+                key = inst->args[0] < inst->args[1] ?
+                    (u64) inst->args[0] << 32 | inst->args[1] : (u64) inst->args[1] << 32 | inst->args[0];
+                break;
+            case ir_Sub:
+            case ir_Div:
+                inst->args[0] = ir_resolve(ir, inst->args[0]);
+                inst->args[1] = ir_resolve(ir, inst->args[1]);
+                key = (u64) inst->args[0] << 32 | inst->args[1];
+                break;
+            case ir_Neg:
+                key = inst->args[0] = ir_resolve(ir, inst->args[0]);
+                break;
+            case ir_Const:
+                key = (u64) inst->value;
+                break;
+            case ir_None:
+                key = 0;
+                break;
+            default:
+                continue;
+            }
+
+            IrSlot *slot = ir_table_find(&ir->table, inst->op, key);
+
+            if (slot->gen == ir->table.gen && ir_dominates(pre, size, IR_INST(ir, slot->value)->block, id)) {
+                ir_replace(ir, value, slot->value);
+            }
+            else {
+                ir_table_put(&ir->table, slot, inst->op, key, value);
+            }
+        }
+    }
+}
+
+bool ir_outside(Ir *ir, IrLoop *loop, u32 value) {
+    u32 block = IR_INST(ir, ir_resolve(ir, value))->block;
+    return block < loop->header || block >= loop->exit;
+}
+
+// NOTE: loop invariant code motion, inner loops come after the loops they're in so going backwards lets
+// something hoisted out of an inner loop be hoisted again out of the outer one, only pure instructions move
+// since the body may never run
+void ir_licm(Ir *ir) {
+    for (u32 id = stack_len(&ir->loops); id-- > 0;) {
+        IrLoop *loop = IR_LOOP(ir, id);
+
+        if (IR_BLOCK(ir, loop->pre)->dead) {
+            continue;
+        }
+
+        for (u32 b = loop->header; b < loop->exit; ++b) {
+            if (IR_BLOCK(ir, b)->dead) {
+                continue;
+            }
+
+            for (u32 value = IR_BLOCK(ir, b)->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+                IrInst *current = IR_INST(ir, value);
+
+                if (current->op <= ir_Neg) {
+                    current->args[0] = ir_resolve(ir, current->args[0]);
+                }
+
+                if (current->op < ir_Neg) {
+                    current->args[1] = ir_resolve(ir, current->args[1]);
+                }
+
+                IrInst inst = *current;
+
+                if (inst.dead || inst.block != b || inst.op == ir_Print || !ir_pure(ir, &inst)) {
+                    continue;
+                }
+
+                if (inst.op <= ir_Neg && !ir_outside(ir, loop, inst.args[0])) {
+                    continue;
+                }
+
+                if (inst.op < ir_Neg && !ir_outside(ir, loop, inst.args[1])) {
+                    continue;
+                }
+
+                IrInst *hoisted = stack_reserve(&ir->insts);
+                u32 moved = ir_num_insts(ir) - 1;
+
+                *hoisted = inst;
+                hoisted->block = loop->pre;
+                hoisted->next = IR_NONE;
+
+                IrBlock *pre = IR_BLOCK(ir, loop->pre);
+
+                if (pre->last == IR_NONE) {
+                    pre->first = moved;
+                }
+                else {
+                    IR_INST(ir, pre->last)->next = moved;
+                }
+
+                pre->last = moved;
+                ir_replace(ir, value, moved);
+            }
+        }
+    }
+}
+
+void ir_use(Ir *ir, u32 *value) {
+    *value = ir_resolve(ir, *value);
+    IR_INST(ir, *value)->uses += 1;
+}
+
+void ir_unuse(Ir *ir, u32 value) {
+    IrInst *inst = IR_INST(ir, value);
+
+    if (--inst->uses == 0 && !inst->dead && ir_pure(ir, inst)) {
+        stack_push(&ir->scratch, &value);
+    }
+}
+
+// NOTE: dead code elimination, counts the uses of every value then removes pure instructions nothing uses,
+// which can leave their operands unused in turn
+void ir_dce(Ir *ir) {
+    u32 num_insts = ir_num_insts(ir);
+
+    for (u32 value = 0; value < num_insts; ++value) {
+        IR_INST(ir, value)->uses = 0;
+    }
+
+    for (u32 id = 0; id < ir_num_blocks(ir); ++id) {
+        IrBlock *block = IR_BLOCK(ir, id);
+
+        if (block->dead) {
+            continue;
+        }
+
+        for (u32 phi = block->phis; phi != IR_NONE; phi = IR_INST(ir, phi)->next) {
+            if (!IR_INST(ir, phi)->dead) {
+                for (u32 i = 0; i < block->num_preds; ++i) {
+                    ir_use(ir, IR_INST(ir, phi)->operands + i);
+                }
+            }
+        }
+
+        for (u32 value = block->first; value != IR_NONE; value = IR_INST(ir, value)->next) {
+            IrInst *inst = IR_INST(ir, value);
+
+            if (inst->dead || inst->block != id) {
+                continue;
+            }
+
+            if (inst->op <= ir_Neg || inst->op == ir_Print) {
+                ir_use(ir, inst->args);
+            }
+
+            if (inst->op < ir_Neg) {
+                ir_use(ir, inst->args + 1);
+            }
+        }
+
+        if (block->term == ir_Branch) {
+            ir_use(ir, &block->cond);
+        }
+    }
+
+    u32 *stores = (u32 *) ir->stores.arr;
+
+    for (u64 i = 0; i < stack_len(&ir->stores); i += 2) {
+        ir_use(ir, stores + i + 1);
+    }
+
+    ir->scratch.len = 0;
+
+    for (u32 value = 0; value < num_insts; ++value) {
+        IrInst *inst = IR_INST(ir, value);
+
+        if (!inst->dead && inst->uses == 0 && ir_pure(ir, inst)) {
+            stack_push(&ir->scratch, &value);
+        }
+    }
+
+    while (ir->scratch.len) {
+        u32 value;
+        stack_pop(&ir->scratch, &value);
+
+        IrInst *inst = IR_INST(ir, value);
+
+        if (inst->dead) {
+            continue;
+        }
+
+        inst->dead = TRUE;
+
+        if (inst->op == ir_Phi) {
+            for (u32 i = 0; i < IR_BLOCK(ir, inst->block)->num_preds; ++i) {
+                ir_unuse(ir, inst->operands[i]);
+            }
+        }
+        else if (inst->op <= ir_Neg) {
+            ir_unuse(ir, inst->args[0]);
+
+            if (inst->op < ir_Neg) {
+                ir_unuse(ir, inst->args[1]);
+            }
+        }
+    }
+}
+
+// NOTE: counts what would become an instruction, loads read their slot in place and phis become moves
+u64 ir_count(Ir *ir) {
+    u64 count = 0;
+
+    for (u32 value = 0; value < ir_num_insts(ir); ++value) {
+        IrInst *inst = IR_INST(ir, value);
+        count += !inst->dead && inst->op != ir_Load && inst->op != ir_Phi && !IR_BLOCK(ir, inst->block)->dead;
+    }
+
+    return count;
+}
+
+void ir_optimize(Ir *ir) {
+    u64 before = ir_count(ir);
+
+    while (ir_propagate(ir) | ir_unreachable(ir));
+
+    ir_cse(ir);
+    ir_licm(ir);
+    ir_propagate(ir);
+    ir_dce(ir);
+
+    ir->stats.instructions += before;
+    ir->stats.eliminated += before - ir_count(ir);
+
+#ifdef EBUG_IR
+    ir_print(ir);
+#endif
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "ir.h"
+
+void ir_optimize(Ir *ir);
@@ -34,25 +34,26 @@ RESULT parser_expr(Parser *parser, Expression *expr) {
     return FALSE;
 }
 
-void print_expr(Expression *expr);
+void print_expr(SymbolTable *symbols, Expression *expr);
 
-void print_statement(Statement *statement) {
+// NOTE: identifiers are printed by name, so these take the table the lexer interned them into
+void print_statement(SymbolTable *symbols, Statement *statement) {
     switch (statement->type) {
     case st_Expression:
-        print_expr(&statement->expr);
+        print_expr(symbols, &statement->expr);
         break;
     case st_Print:
         printf("PRINT\t");
-        print_expr(&statement->expr);
+        print_expr(symbols, &statement->expr);
         break;
     case st_Send:
         printf("SEND\t");
-        print_expr(&statement->expr);
+        print_expr(symbols, &statement->expr);
         break;
     case st_While:
         printf("WHILE\t");
-        print_expr(&statement->while_condition);
-        print_expr(&statement->while_body);
+        print_expr(symbols, &statement->while_condition);
+        print_expr(symbols, &statement->while_body);
         break;
     }
 }
@@ -103,7 +104,7 @@ RESULT parser_function(Parser *parser, Expression *expr) {
     expr->line = parser->context->lexer.line;
 
     CHECK(lexer_next(&parser->context->lexer));
-    stack_init(&params, sizeof (char *));
+    stack_init(&params, sizeof (Symbol));
 
     while (!is_op(parser, op_Colon)) {
         if (parser->context->lexer.token_type != tt_Identifier) {
@@ -111,11 +112,13 @@ RESULT parser_function(Parser *parser, Expression *expr) {
             return TRUE;
         }
 
-        stack_push(&params, &parser->context->lexer.ident);
+        stack_push(&params, &parser->context->lexer.symbol);
     }
 
-    expr->params = (char **) params.arr;
+    expr->params = arena_alloc(&parser->context->arena, stack_len(&params), sizeof (Symbol));
     expr->num_params = stack_len(&params);
+    memcpy(expr->params, params.arr, params.len);
+    stack_deinit(&params);
     CHECK(parser_expr(parser, expr->body));
 
     return FALSE;
@@ -164,7 +167,9 @@ RESULT parser_block_general(Parser *parser, Expression *expr) {
     }
 
     expr->num_statements = stack_len(&statements);
-    expr->statements = (Statement *) statements.arr;
+    expr->statements = arena_alloc(&parser->context->arena, expr->num_statements, sizeof (Statement));
+    memcpy(expr->statements, statements.arr, statements.len);
+    stack_deinit(&statements);
 
     return FALSE;
 }
@@ -182,8 +187,8 @@ RESULT parser_block(Parser *parser, Expression *expr) {
 }
 
 RESULT parser_ifelse(Parser *parser, Expression *expr) {
-    expr->condition= heap_alloc(1, sizeof (Expression));
-    expr->on_true = heap_alloc(1, sizeof (Expression));
+    expr->condition = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
+    expr->on_true = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
     expr->on_false = NULL;
     expr->type = ex_IfElse;
     expr->line = parser->context->lexer.line;
@@ -198,7 +203,7 @@ RESULT parser_ifelse(Parser *parser, Expression *expr) {
     }
 
     if (is_keyword(parser, kw_Else)) {
-        expr->on_false = heap_alloc(1, sizeof (Expression));
+        expr->on_false = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
         CHECK(lexer_next(&parser->context->lexer));
         CHECK(parser_expr(parser, expr->on_false));
     }
@@ -223,7 +228,7 @@ RESULT parser_term(Parser *parser, Expression *expr) {
         break;
     case tt_Identifier:
         expr->type = ex_Identifier;
-        expr->ident = lexer->ident;
+        expr->symbol = lexer->symbol;
 
         CHECK(lexer_next(lexer));
         break;
@@ -244,7 +249,7 @@ RESULT parser_term(Parser *parser, Expression *expr) {
         case op_Subtraction:
             expr->type = ex_UnaryOperation;
             expr->un_op = op_Subtraction;
-            expr->oprand = heap_alloc(1, sizeof (Expression));
+            expr->oprand = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
 
             CHECK(lexer_next(lexer));
             CHECK(parser_expr(parser, expr->oprand));
@@ -288,14 +293,14 @@ RESULT parser_binop(Parser *parser, Expression *expr, u8 precedence) {
         u8 this_precedence = parser->precedence_lookup[parser->context->lexer.operator_type];
 
         if (this_precedence && precedence == this_precedence) {
-            Expression *lhs = heap_alloc(1, sizeof (Expression));
+            Expression *lhs = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
             *lhs = *expr;
 
             expr->type = ex_BinaryOperation;
             expr->line = parser->context->lexer.line;
             expr->bin_op = parser->context->lexer.operator_type;
             expr->lhs = lhs;
-            expr->rhs = heap_alloc(1, sizeof (Expression));
+            expr->rhs = arena_alloc(&parser->context->arena, 1, sizeof (Expression));
 
             CHECK(lexer_next(&parser->context->lexer));
             CHECK(parser_binop(parser, expr->rhs, precedence - 1));
@@ -308,103 +313,59 @@ RESULT parser_binop(Parser *parser, Expression *expr, u8 precedence) {
     return FALSE;
 }
 
-void tree_dealloc(Expression *expr);
-
-void statement_dealloc(Statement *statement) {
-    switch (statement->type) {
-    case st_Expression:
-    case st_Print:
-    case st_Send:
-        tree_dealloc(&statement->expr);
-        break;
-    case st_While:
-        tree_dealloc(&statement->while_condition);
-        tree_dealloc(&statement->while_body);
-        break;
+// NOTE: parses one top-level statement into `statement`, anything it allocates can be freed once it's compiled
+RESULT parser_next(Parser *parser) {
+    if (is_op(parser, op_CloseBrace)) {
+        parser->context->error_line = parser->context->lexer.line;
+        strcpy_s(parser->context->error_msg, ERROR_MSG_LEN, "Expected EOF but got }");
+        return TRUE;
     }
-}
 
-void tree_dealloc(Expression *expr) {
-    switch (expr->type) {
-    case ex_BinaryOperation:
-        tree_dealloc(expr->lhs);
-        tree_dealloc(expr->rhs);
-        heap_dealloc(expr->lhs);
-        heap_dealloc(expr->rhs);
-        break;
-    case ex_UnaryOperation:
-        tree_dealloc(expr->oprand);
-        heap_dealloc(expr->oprand);
-        break;
-    case ex_Block:
-        for (u64 i = 0; i < expr->num_statements; ++i) {
-            statement_dealloc(expr->statements + i);
-        }
-        heap_dealloc(expr->statements);
-        break;
-    case ex_IfElse:
-        tree_dealloc(expr->condition);
-        tree_dealloc(expr->on_true);
-        heap_dealloc(expr->condition);
-        heap_dealloc(expr->on_true);
-
-        if (expr->on_false) {
-            tree_dealloc(expr->on_false);
-            heap_dealloc(expr->on_false);
-        }
-
-        break;
-    case ex_Function:
-        tree_dealloc(expr->body);
-        heap_dealloc(expr->body);
-        heap_dealloc(expr->params);
-        break;
-    case ex_Identifier:
-    case ex_Integer:
-    case ex_Null:
-        break;
-    }
+    return parser_statement(parser, &parser->statement);
 }
 
-void parser_stmt_deinit(Parser *parser) {
-    statement_dealloc(&parser->statement);
+bool parser_done(Parser *parser) {
+    return parser->context->lexer.token_type == tt_Eof;
 }
 
-RESULT parser_next(Parser *parser) {
-    parser->statement.type = st_Expression;
-    parser->statement.line = parser->statement.expr.line;
-    CHECK(parser_block_general(parser, &parser->statement.expr));
+// NOTE: called when a statement fails to compile, the rest of the file is still parsed so that a syntax error
+// anywhere in it is reported before the compile error, as when whole files were parsed first, it always fails
+RESULT parser_finish(Parser *parser) {
+    Arena *arena = &parser->context->arena;
 
-    if (parser->context->lexer.token_type != tt_Eof) {
-        parser->context->error_line = parser->context->lexer.line;
-        strcpy_s(parser->context->error_msg, ERROR_MSG_LEN, "Expected EOF but got }");
-        return TRUE;
+    while (!parser_done(parser)) {
+        ArenaMark mark = arena_mark(arena);
+
+        CHECK(parser_next(parser));
+        arena_rewind(arena, mark);
     }
 
-    return FALSE;
+    return TRUE;
 }
 
-void print_expr(Expression *expr) {
+void print_expr(SymbolTable *symbols, Expression *expr) {
     switch (expr->type) {
         u64 op_sstr;
+        View name;
 
     case ex_Integer:
-        printf("%llu", expr->integer);
+        printf("%lld", (i64) expr->integer);
         break;
     case ex_Null:
         fprintf(stderr, FATAL "Got null exression in print\n");
         exit(-1);
         break;
     case ex_Identifier:
-        printf("%s", expr->ident);
+        name = symbols_name(symbols, expr->symbol);
+        printf("%.*s", VIEW_ARGS(name));
         break;
     case ex_BinaryOperation:
         putchar('(');
         op_sstr = op_to_sstr(expr->bin_op);
         printf("%s ", (char *) &op_sstr);
-        print_expr(expr->lhs);
+        print_expr(symbols, expr->lhs);
         putchar(' ');
-        print_expr(expr->rhs);
+        print_expr(symbols, expr->rhs);
         putchar(')');
 
         break;
@@ -412,14 +373,14 @@ void print_expr(Expression *expr) {
         putchar('(');
         op_sstr = op_to_sstr(expr->un_op);
         printf("%s ", (char *) &op_sstr);
-        print_expr(expr->oprand);
+        print_expr(symbols, expr->oprand);
         putchar(')');
 
         break;
     case ex_Block:
         putchar('{');
         for (u64 i = 0; i < expr->num_statements; ++i) {
-            print_statement(expr->statements + i);
+            print_statement(symbols, expr->statements + i);
             puts("");
         }
         putchar('}');
@@ -427,13 +388,13 @@ void print_expr(Expression *expr) {
         break;
     case ex_IfElse:
         printf("if ");
-        print_expr(expr->condition);
+        print_expr(symbols, expr->condition);
         printf("then ");
-        print_expr(expr->on_true);
+        print_expr(symbols, expr->on_true);
 
         if (expr->on_false) {
             printf("else ");
-            print_expr(expr->on_false);
+            print_expr(symbols, expr->on_false);
         }
 
         break;
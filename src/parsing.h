@@ -23,7 +23,7 @@ typedef struct __Expression__ {
 
     union {
         u64 integer;
-        char *ident;
+        Symbol symbol;
 
         struct {
             OperatorType bin_op;
@@ -50,7 +50,7 @@ typedef struct __Expression__ {
         };
 
         struct {
-            char **params;
+            Symbol *params;
             u64 num_params;
             struct __Expression__ *body;
         };
@@ -86,5 +86,6 @@ typedef struct {
 
 void parser_init(Parser *parser, Context *context);
 void parser_deinit(Parser *parser);
-void parser_stmt_deinit(Parser *parser);
 RESULT parser_next(Parser *parser);
+bool parser_done(Parser *parser);
+RESULT parser_finish(Parser *parser);
@@ -0,0 +1,412 @@
+#include <string.h>
+#include "peephole.h"
+#include "compiling.h"
+#include "verifier.h"
+
+#define NO_TARGET ((u32) -1)
+#define MAX_THREAD 64
+
+// NOTE: 32 bit positions keep this small, it's one per instruction of the whole program
+typedef struct {
+    u32 pc;
+    u32 new_pc;
+    u32 target; // NOTE: the index of the instruction a jump lands on, NO_TARGET for anything else
+    u32 refs;
+    u8 opcode;
+    u8 head; // NOTE: bytes before the jump offset, or the whole instruction when it isn't a jump, once re-encoded
+    u8 offset_size;
+    bool dead;
+    bool reached;
+} PeepInst;
+
+typedef struct {
+    PeepInst *insts;
+    u64 count;
+    const char **operands;
+    bool registers;
+    u8 *program;
+} Peephole;
+
+bool is_jump_opcode(Peephole *peephole, u8 opcode) {
+    if (peephole->registers) {
+        return opcode == RINST_JUMP || opcode == RINST_BRANCH || opcode == RINST_BRANCH_F;
+    }
+
+    return opcode == INST_JUMP || opcode == INST_BRANCH || opcode == INST_BRANCH_F || opcode == INST_BRANCH_F_SLOT;
+}
+
+u8 jump_opcode(Peephole *peephole) {
+    return peephole->registers ? RINST_JUMP : INST_JUMP;
+}
+
+bool ends_flow(Peephole *peephole, u8 opcode) {
+    return opcode == jump_opcode(peephole) || opcode == (peephole->registers ? RINST_HALT : INST_HALT);
+}
+
+// NOTE: the opcode that branches on the opposite condition, or the same opcode when there isn't one
+u8 invert_branch(Peephole *peephole, u8 opcode) {
+    if (peephole->registers) {
+        return opcode == RINST_BRANCH ? RINST_BRANCH_F : opcode == RINST_BRANCH_F ? RINST_BRANCH : opcode;
+    }
+
+    return opcode == INST_BRANCH ? INST_BRANCH_F : opcode == INST_BRANCH_F ? INST_BRANCH : opcode;
+}
+
+// NOTE: jumps mostly land close by, so the search gallops out from the jump before bisecting
+u64 find_inst(Peephole *peephole, u64 from, u64 pc) {
+    PeepInst *insts = peephole->insts;
+    u64 lo = 0;
+    u64 hi = peephole->count;
+    u64 step = 1;
+
+    if (insts[from].pc < pc) {
+        for (lo = from; lo + step < hi && insts[lo + step].pc < pc; step *= 2) lo += step;
+        if (lo + step < hi) hi = lo + step + 1;
+    }
+    else {
+        for (hi = from + 1; hi > step && insts[hi - step - 1].pc >= pc; step *= 2) hi -= step;
+        if (hi > step) lo = hi - step - 1;
+    }
+
+    while (lo < hi) {
+        u64 mid = (lo + hi) / 2;
+
+        if (insts[mid].pc < pc) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+u64 skip_operands(Peephole *peephole, u8 *program, u64 pc) {
+    for (const char *kinds = peephole->operands[program[pc++]]; *kinds; ++kinds) {
+        while (program[pc++] & 0x80);
+    }
+
+    return pc;
+}
+
+// NOTE: operands other than a jump's offset are written again at their minimal width, whatever padding they came
+// with, returning their size. Without `dst` this only measures them
+u64 encode_operands(Peephole *peephole, PeepInst *inst, u8 *dst) {
+    const char *kinds = peephole->operands[inst->opcode];
+    u64 count = strlen(kinds) - is_jump_opcode(peephole, inst->opcode);
+    u64 pc = inst->pc + 1;
+    u64 size = 0;
+
+    for (u64 i = 0; i < count; ++i) {
+        if (kinds[i] == 'i') {
+            i64 value = decode_int(peephole->program, &pc);
+
+            if (dst) encode_int(dst + size, value, int_size(value));
+            size += int_size(value);
+        }
+        else {
+            u64 value = decode_uint(peephole->program, &pc);
+
+            if (dst) encode_uint(dst + size, value, uint_size(value));
+            size += uint_size(value);
+        }
+    }
+
+    return size;
+}
+
+// NOTE: the program has just been assembled, so unlike the verifier this can trust its encoding. Counting first
+// means the instructions are written straight into an array of the right size
+void peephole_decode(Peephole *peephole, u8 *program, u64 len) {
+    ASSERT(len < NO_TARGET);
+
+    peephole->count = 0;
+    peephole->program = program;
+
+    for (u64 pc = 0; pc < len; pc = skip_operands(peephole, program, pc)) {
+        ++peephole->count;
+    }
+
+    peephole->insts = heap_alloc(peephole->count, sizeof (PeepInst));
+
+    for (u64 pc = 0, i = 0; pc < len; ++i) {
+        PeepInst *inst = peephole->insts + i;
+        u64 next = skip_operands(peephole, program, pc);
+
+        *inst = (PeepInst) { pc, 0, NO_TARGET, 0, program[pc], 0, 0, FALSE, FALSE };
+        inst->head = 1 + encode_operands(peephole, inst, NULL);
+
+        // NOTE: the offset is always the last operand of a jump
+        if (is_jump_opcode(peephole, inst->opcode)) {
+            u64 at = next - 1;
+
+            while (at > pc + 1 && (program[at - 1] & 0x80)) --at;
+
+            inst->target = next + decode_int(program, &at);
+        }
+
+        pc = next;
+    }
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        PeepInst *inst = peephole->insts + i;
+
+        if (inst->target != NO_TARGET) {
+            inst->target = find_inst(peephole, i, inst->target);
+        }
+    }
+}
+
+u64 next_live(Peephole *peephole, u64 i) {
+    while (i < peephole->count && peephole->insts[i].dead) {
+        ++i;
+    }
+
+    return i;
+}
+
+// NOTE: anything control can't reach from the first instruction is dropped, like statements after a send. Each sweep
+// carries reachability forward, and only a jump backwards to code that wasn't reached yet needs another
+void peephole_reachable(Peephole *peephole) {
+    PeepInst *insts = peephole->insts;
+    bool again = TRUE;
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        insts[i].reached = FALSE;
+    }
+
+    while (again) {
+        bool live = TRUE;
+        again = FALSE;
+
+        for (u64 i = 0; i < peephole->count; ++i) {
+            PeepInst *inst = insts + i;
+
+            if (inst->dead || !(live |= inst->reached)) continue;
+
+            inst->reached = TRUE;
+            live = !ends_flow(peephole, inst->opcode);
+
+            if (inst->target != NO_TARGET) {
+                u64 target = next_live(peephole, inst->target);
+
+                again |= target < i && !insts[target].reached;
+                insts[target].reached = TRUE;
+            }
+        }
+    }
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        insts[i].dead |= !insts[i].reached;
+    }
+}
+
+// NOTE: jumps to a jump go straight to where it goes, the hop limit stops a cycle of them
+void peephole_thread(Peephole *peephole) {
+    for (u64 i = 0; i < peephole->count; ++i) {
+        PeepInst *inst = peephole->insts + i;
+
+        if (inst->dead || inst->target == NO_TARGET) {
+            continue;
+        }
+
+        inst->target = next_live(peephole, inst->target);
+
+        for (u64 hops = 0; hops < MAX_THREAD; ++hops) {
+            PeepInst *target = peephole->insts + inst->target;
+
+            if (target->opcode != jump_opcode(peephole) || target->target == inst->target) {
+                break;
+            }
+
+            inst->target = next_live(peephole, target->target);
+        }
+    }
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        peephole->insts[i].refs = 0;
+    }
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        PeepInst *inst = peephole->insts + i;
+
+        if (!inst->dead && inst->target != NO_TARGET) {
+            peephole->insts[inst->target].refs += 1;
+        }
+    }
+}
+
+bool is_pure_push(u8 opcode) {
+    return opcode == INST_PUSH_INT || opcode == INST_PUSH_NONE || opcode == INST_PUSH;
+}
+
+void kill(PeepInst *inst, bool *retarget) {
+    inst->dead = TRUE;
+    *retarget |= inst->refs > 0;
+}
+
+// NOTE: matches against the tail of the instructions kept so far, so removing a pair lets the ones around it pair up
+// in the same pass. Patterns never span an instruction that's jumped to, since control can arrive there with other
+// values, and jumps to a removed instruction count towards the one that follows it. Returns whether something that
+// was jumped to went away, since jumps to it may now thread further
+bool peephole_patterns(Peephole *peephole) {
+    PeepInst *insts = peephole->insts;
+    u32 *kept = heap_alloc(peephole->count, sizeof (u32));
+    u64 top = 0;
+    u32 carried = 0;
+    bool retarget = FALSE;
+
+    for (u64 i = next_live(peephole, 0); i < peephole->count; i = next_live(peephole, i + 1)) {
+        kept[top++] = i;
+        insts[i].refs += carried;
+        carried = 0;
+
+        for (bool reduced = TRUE; reduced && top >= 2;) {
+            PeepInst *prev = insts + kept[top - 2];
+            PeepInst *last = insts + kept[top - 1];
+            PeepInst *branch = top >= 3 ? insts + kept[top - 3] : NULL;
+
+            if (prev->opcode == jump_opcode(peephole) && next_live(peephole, prev->target) == kept[top - 1]) {
+                last->refs += prev->refs;
+                kill(prev, &retarget);
+                kept[top - 2] = kept[top - 1];
+                top -= 1;
+            }
+            else if (branch && invert_branch(peephole, branch->opcode) != branch->opcode && prev->opcode == jump_opcode(peephole) &&
+                     !prev->refs && next_live(peephole, branch->target) == kept[top - 1]) {
+                // NOTE: a branch over a jump becomes the opposite branch to where the jump went
+                branch->opcode = invert_branch(peephole, branch->opcode);
+                branch->target = prev->target;
+                kill(prev, &retarget);
+                kept[top - 2] = kept[top - 1];
+                top -= 1;
+            }
+            else if (last->refs) {
+                reduced = FALSE;
+            }
+            else if (!peephole->registers && is_pure_push(prev->opcode) && last->opcode == INST_POP) {
+                carried += prev->refs;
+                kill(prev, &retarget);
+                kill(last, &retarget);
+                top -= 2;
+            }
+            else if (!peephole->registers && prev->opcode == INST_EXIT_NONE && last->opcode == INST_POP) {
+                prev->opcode = INST_EXIT;
+                kill(last, &retarget);
+                top -= 1;
+            }
+            else {
+                reduced = FALSE;
+            }
+        }
+    }
+
+    heap_dealloc(kept);
+
+    return retarget;
+}
+
+i64 jump_offset(Peephole *peephole, PeepInst *inst) {
+    return (i64) peephole->insts[inst->target].new_pc - (i64) (inst->new_pc + inst->head + inst->offset_size);
+}
+
+// NOTE: offsets are LEB128, so moving an instruction can change the size of a jump over it. Every offset starts at
+// a byte and grows until it fits, which only happens a few times since a jump only grows when one it spans does
+u64 peephole_layout(Peephole *peephole) {
+    bool grew = TRUE;
+    u64 pc = 0;
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        peephole->insts[i].offset_size = peephole->insts[i].target != NO_TARGET;
+    }
+
+    while (grew) {
+        pc = 0;
+        grew = FALSE;
+
+        for (u64 i = 0; i < peephole->count; ++i) {
+            PeepInst *inst = peephole->insts + i;
+
+            if (inst->dead) continue;
+
+            inst->new_pc = pc;
+            pc += inst->head + inst->offset_size;
+        }
+
+        for (u64 i = 0; i < peephole->count; ++i) {
+            PeepInst *inst = peephole->insts + i;
+
+            if (inst->dead || inst->target == NO_TARGET) continue;
+
+            i64 offset = jump_offset(peephole, inst);
+
+            if (int_size(offset) > inst->offset_size) {
+                inst->offset_size = int_size(offset);
+                grew = TRUE;
+            }
+        }
+    }
+
+    return pc;
+}
+
+// NOTE: also recounts the assembler's operand statistics, which EBUG_BYTECODE reports
+void peephole_encode(Peephole *peephole, Assembler *assembler) {
+    u8 *dst = assembler->bytecode.arr;
+
+    assembler->operands = 0;
+    assembler->operand_bytes = 0;
+
+    for (u64 i = 0; i < peephole->count; ++i) {
+        PeepInst *inst = peephole->insts + i;
+
+        if (inst->dead) continue;
+
+        assembler->operands += strlen(peephole->operands[inst->opcode]);
+        assembler->operand_bytes += inst->head - 1 + inst->offset_size;
+
+        *dst = inst->opcode;
+        encode_operands(peephole, inst, dst + 1);
+        dst += inst->head;
+
+        if (inst->target != NO_TARGET) {
+            encode_int(dst, jump_offset(peephole, inst), inst->offset_size);
+            dst += inst->offset_size;
+        }
+    }
+}
+
+// NOTE: runs on the assembled bytecode, removing push/pop pairs, threading jump chains, inverting branches over
+// jumps and dropping unreachable code, then lays the rest out again
+PeepholeStats peephole_optimize(Assembler *assembler, bool registers) {
+    Peephole peephole = { .operands = registers ? reg_inst_operands : inst_operands, .registers = registers };
+    Stack *bytecode = &assembler->bytecode;
+    PeepholeStats stats = { 0, 0 };
+    bool changed = TRUE;
+
+    peephole_decode(&peephole, (u8 *) bytecode->arr, bytecode->len);
+
+    // NOTE: patterns never make code unreachable, they only give jumps somewhere new to thread to
+    while (changed) {
+        peephole_thread(&peephole);
+        peephole_reachable(&peephole);
+        changed = peephole_patterns(&peephole);
+    }
+
+    stats.instructions = peephole.count;
+
+    for (u64 i = 0; i < peephole.count; ++i) {
+        stats.eliminated += peephole.insts[i].dead;
+    }
+
+    // NOTE: the old bytecode is kept until the new one is written, the copy is where operands come from
+    Stack old = *bytecode;
+
+    stack_init(bytecode, sizeof (u64));
+
+    bytecode->len = peephole_layout(&peephole);
+    stack_ensure(bytecode, bytecode->len / bytecode->elem_size + 1);
+    peephole_encode(&peephole, assembler);
+
+    stack_deinit(&old);
+    heap_dealloc(peephole.insts);
+
+    return stats;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "assembling.h"
+
+typedef struct {
+    u64 instructions;
+    u64 eliminated;
+} PeepholeStats;
+
+PeepholeStats peephole_optimize(Assembler *assembler, bool registers);
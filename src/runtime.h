@@ -0,0 +1,101 @@
+#pragma once
+
+// NOTE: included by the C that `-a` translates programs to, not by the interpreter, so it only depends on the
+// standard library, it does what vm_run does for each instruction and reports the same errors
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#if defined(__GNUC__)
+#define RT_COLD __attribute__((cold, noreturn))
+#define RT_UNLIKELY(v) __builtin_expect(!!(v), 0)
+#else
+#define RT_COLD
+#define RT_UNLIKELY(v) (v)
+#endif
+
+#define RT_ERR "\x1B[91m[ERROR]\x1B[0m\t"
+#define RT_NO_LINE ((unsigned long long) -1) // NOTE: runtime errors don't know their line, the VM reports them the same way
+
+typedef enum {
+    rt_Integer,
+    rt_None,
+} RtType;
+
+typedef struct {
+    uint8_t type;
+    uint64_t data;
+} RtObject;
+
+#define RT_ZERO { rt_Integer, 0 } // NOTE: what a variable holds before it's assigned, same as a zeroed VM slot
+
+static inline RtObject rt_int(uint64_t integer) {
+    RtObject obj = { rt_Integer, integer };
+    return obj;
+}
+
+static inline RtObject rt_none(void) {
+    RtObject obj = { rt_None, 0 };
+    return obj;
+}
+
+static inline const char *rt_type_str(uint8_t type) {
+    switch (type) {
+    case rt_Integer:    return "Integer";
+    case rt_None:       return "None";
+    default:            return "????";
+    }
+}
+
+static RT_COLD void rt_error(const char *verb, RtObject lhs, RtObject rhs) {
+    fprintf(stderr, RT_ERR "Line %llu: Attempt to %s invalid types `%s` and `%s`\n", RT_NO_LINE, verb, rt_type_str(lhs.type), rt_type_str(rhs.type));
+    exit(1);
+}
+
+static RT_COLD void rt_negate_error(RtObject obj) {
+    fprintf(stderr, RT_ERR "Line %llu: Attempt to negate an invalid type `%s`\n", RT_NO_LINE, rt_type_str(obj.type));
+    exit(1);
+}
+
+static RT_COLD void rt_truth_error(RtObject obj) {
+    fprintf(stderr, RT_ERR "Line %llu: Cannot determine truth value of object with type `%s`\n", RT_NO_LINE, rt_type_str(obj.type));
+    exit(1);
+}
+
+#define RT_ARITHMETIC(name, op, cast, verb) \
+    static inline RtObject name(RtObject lhs, RtObject rhs) { \
+        if (RT_UNLIKELY(lhs.type != rt_Integer || rhs.type != rt_Integer)) rt_error(verb, lhs, rhs); \
+        return rt_int((uint64_t) ((cast) lhs.data op (cast) rhs.data)); \
+    }
+
+RT_ARITHMETIC(rt_add, +, uint64_t, "add")
+RT_ARITHMETIC(rt_sub, -, uint64_t, "subtract")
+RT_ARITHMETIC(rt_mul, *, uint64_t, "multiply")
+
+// NOTE: the VM traps on these, raising the signal keeps that instead of leaving it to undefined behaviour
+static inline RtObject rt_div(RtObject lhs, RtObject rhs) {
+    if (RT_UNLIKELY(lhs.type != rt_Integer || rhs.type != rt_Integer)) rt_error("divide", lhs, rhs);
+    if (RT_UNLIKELY(rhs.data == 0 || (lhs.data == (uint64_t) INT64_MIN && (int64_t) rhs.data == -1))) raise(SIGFPE);
+    return rt_int((uint64_t) ((int64_t) lhs.data / (int64_t) rhs.data));
+}
+
+static inline RtObject rt_neg(RtObject obj) {
+    if (RT_UNLIKELY(obj.type != rt_Integer)) rt_negate_error(obj);
+    return rt_int(~obj.data + 1);
+}
+
+static inline int rt_truth(RtObject obj) {
+    if (RT_UNLIKELY(obj.type != rt_Integer && obj.type != rt_None)) rt_truth_error(obj);
+    return obj.data != 0;
+}
+
+static inline void rt_print(RtObject obj) {
+    if (obj.type == rt_Integer) {
+        printf("%lld\n", (long long) obj.data);
+    }
+    else {
+        printf("none\n");
+    }
+}
@@ -67,6 +67,14 @@ void *stack_reserve(Stack *stack) {
     return ptr;
 }
 
+// NOTE: makes room for `count` elements in total, so that many can be pushed without reallocating
+void stack_ensure(Stack *stack, u64 count) {
+    if (count * stack->elem_size > stack->cap) {
+        stack->cap = count * stack->elem_size;
+        stack->arr = heap_realloc(stack->arr, stack->cap, sizeof (u8));
+    }
+}
+
 u64 stack_len(Stack *stack) {
     return stack->len / stack->elem_size;
 }
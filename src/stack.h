@@ -16,5 +16,6 @@ void stack_pop(Stack *stack, void *obj);
 void stack_push_byte(Stack *stack, u8 byte);
 void *stack_index(Stack *stack, u64 index);
 void *stack_reserve(Stack *stack);
+void stack_ensure(Stack *stack, u64 count);
 u8 stack_pop_byte(Stack *stack);
 u64 stack_len(Stack *stack);
@@ -0,0 +1,35 @@
+#include "symbols.h"
+
+void symbols_init(SymbolTable *symbols) {
+    hashmap_init(&symbols->ids);
+    stack_init(&symbols->names, sizeof (View));
+}
+
+void symbols_deinit(SymbolTable *symbols) {
+    hashmap_deinit(&symbols->ids);
+    stack_deinit(&symbols->names);
+}
+
+Symbol symbols_intern(SymbolTable *symbols, const char *name, u64 len) {
+    u64 symbol;
+
+    if (!hashmap_get_len(&symbols->ids, name, len, &symbol)) {
+        return (Symbol) symbol;
+    }
+
+    View view = { name, len };
+
+    symbol = symbols_count(symbols);
+    stack_push(&symbols->names, &view);
+    hashmap_put_len(&symbols->ids, name, len, symbol);
+
+    return (Symbol) symbol;
+}
+
+View symbols_name(SymbolTable *symbols, Symbol symbol) {
+    return *(View *) stack_index(&symbols->names, symbol);
+}
+
+u64 symbols_count(SymbolTable *symbols) {
+    return stack_len(&symbols->names);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "auxiliary.h"
+#include "hashmap.h"
+#include "stack.h"
+
+#define NO_SYMBOL ((Symbol) -1)
+
+typedef u32 Symbol;
+
+// NOTE: names are views into the source rather than copies, so the table must not outlive it
+typedef struct {
+    HashMap ids;
+    Stack names;
+} SymbolTable;
+
+void symbols_init(SymbolTable *symbols);
+void symbols_deinit(SymbolTable *symbols);
+Symbol symbols_intern(SymbolTable *symbols, const char *name, u64 len);
+View symbols_name(SymbolTable *symbols, Symbol symbol);
+u64 symbols_count(SymbolTable *symbols);
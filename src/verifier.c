@@ -0,0 +1,502 @@
+#include <string.h>
+#include "verifier.h"
+#include "context.h"
+
+#define MAX_OPERANDS 3
+#define MAX_LEB_BYTES 10
+#define NO_FRAME ((u64) -1)
+#define UNVISITED ((u64) -1)
+#define DEAD ((u64) -2)
+
+const char *inst_operands[NUM_INSTRUCTIONS] = {
+    [INST_PUSH_INT] = "i",
+    [INST_PUSH_NONE] = "",
+    [INST_PUSH] = "uu",
+    [INST_ADD] = "",
+    [INST_SUB] = "",
+    [INST_MUL] = "",
+    [INST_DIV] = "",
+    [INST_NEG] = "",
+    [INST_POP] = "",
+    [INST_PULL_TO] = "uu",
+    [INST_HALT] = "",
+    [INST_SCOPE] = "u",
+    [INST_EXIT] = "",
+    [INST_PRINT] = "",
+    [INST_JUMP] = "i",
+    [INST_BRANCH] = "i",
+    [INST_BRANCH_F] = "i",
+    [INST_SCOPE_HEAP] = "u",
+    [INST_STORE_POP] = "uu",
+    [INST_ADD_SLOT_IMM] = "uui",
+    [INST_SUB_SLOT_IMM] = "uui",
+    [INST_MUL_SLOT_IMM] = "uui",
+    [INST_EXIT_NONE] = "",
+    [INST_BRANCH_F_SLOT] = "uui",
+};
+
+const char *reg_inst_operands[NUM_REG_INSTRUCTIONS] = {
+    [RINST_LOAD_INT] = "ui",
+    [RINST_LOAD_NONE] = "u",
+    [RINST_MOVE] = "uu",
+    [RINST_ADD] = "uuu",
+    [RINST_SUB] = "uuu",
+    [RINST_MUL] = "uuu",
+    [RINST_DIV] = "uuu",
+    [RINST_NEG] = "uu",
+    [RINST_HALT] = "",
+    [RINST_SCOPE] = "u",
+    [RINST_EXIT] = "",
+    [RINST_PRINT] = "u",
+    [RINST_JUMP] = "i",
+    [RINST_BRANCH] = "ui",
+    [RINST_BRANCH_F] = "ui",
+};
+
+typedef struct {
+    u64 size;
+    u64 parent;
+} VerifyFrame;
+
+// NOTE: the abstract state at an instruction, every path reaching it must agree on it
+typedef struct {
+    u64 height;
+    u64 frame;
+} VerifyState;
+
+// NOTE: states are only kept for jump targets, everything else is reached by falling through in order. Targets
+// are a bitmap over the program and a target's state is found by its rank, the number of targets before it
+typedef struct {
+    Context *context;
+    u8 *program;
+    u64 len;
+    const char **operands;
+    u64 num_opcodes;
+
+    u64 *targets;
+    u64 *ranks;
+    u64 num_targets;
+    VerifyState *states;
+    Stack frames;
+    u64 max_stack;
+
+    u64 pc;
+    u64 next;
+    u8 opcode;
+    u64 values[MAX_OPERANDS];
+} Verifier;
+
+#define VERIFY_ERROR(verifier, fmt, ...) do { \
+        DISPATCH_ERROR_FMT((verifier)->context, -1, "Invalid bytecode at %llu: " fmt, (verifier)->pc, __VA_ARGS__); \
+        return TRUE; \
+    } while (FALSE)
+
+// NOTE: unlike decode_uint and decode_int this never reads past the end or shifts out of range
+RESULT verify_leb(Verifier *verifier, u64 *pc, bool is_signed, u64 *value) {
+    u64 result = 0;
+    u64 shift = 0;
+    u8 byte;
+
+    // NOTE: most operands are a single byte
+    if (*pc < verifier->len && verifier->program[*pc] < 0x80) {
+        byte = verifier->program[(*pc)++];
+        *value = is_signed && (byte & 0x40) ? byte | ~(u64) 0x7F : byte;
+        return FALSE;
+    }
+
+    do {
+        if (*pc >= verifier->len || shift >= MAX_LEB_BYTES * 7) {
+            VERIFY_ERROR(verifier, "%s", "truncated operand");
+        }
+
+        byte = verifier->program[(*pc)++];
+
+        if (shift < 64) {
+            result |= (u64) (byte & 0x7F) << shift;
+        }
+
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (is_signed && shift < 64 && (byte & 0x40)) {
+        result |= ~(u64) 0 << shift;
+    }
+
+    *value = result;
+    return FALSE;
+}
+
+RESULT verify_decode(Verifier *verifier, u64 pc) {
+    verifier->pc = pc;
+    verifier->opcode = verifier->program[pc++];
+
+    if (verifier->opcode >= verifier->num_opcodes) {
+        VERIFY_ERROR(verifier, "invalid opcode %hhu", verifier->opcode);
+    }
+
+    const char *kinds = verifier->operands[verifier->opcode];
+
+    for (u64 i = 0; kinds[i]; ++i) {
+        CHECK(verify_leb(verifier, &pc, kinds[i] == 'i', &verifier->values[i]));
+    }
+
+    verifier->next = pc;
+    return FALSE;
+}
+
+bool is_jump(Verifier *verifier, u64 *offset) {
+    const char *kinds = verifier->operands[verifier->opcode];
+    u64 count = strlen(kinds);
+
+    // NOTE: the offset is always the last operand of a jump
+    if (verifier->operands == inst_operands) {
+        switch (verifier->opcode) {
+        case INST_JUMP: case INST_BRANCH: case INST_BRANCH_F: case INST_BRANCH_F_SLOT: break;
+        default: return FALSE;
+        }
+    }
+    else {
+        switch (verifier->opcode) {
+        case RINST_JUMP: case RINST_BRANCH: case RINST_BRANCH_F: break;
+        default: return FALSE;
+        }
+    }
+
+    *offset = verifier->values[count - 1];
+    return TRUE;
+}
+
+bool is_target(Verifier *verifier, u64 pc) {
+    return (verifier->targets[pc / 64] >> (pc % 64)) & 1;
+}
+
+VerifyState *target_state(Verifier *verifier, u64 target) {
+    u64 below = verifier->targets[target / 64] & (((u64) 1 << (target % 64)) - 1);
+    return &verifier->states[verifier->ranks[target / 64] + __builtin_popcountll(below)];
+}
+
+// NOTE: decodes the whole program front to back, which works since the bytecode is nothing but instructions
+RESULT verifier_init(Verifier *verifier, Context *context, u8 *program, u64 len, bool registers) {
+    u64 words = len / 64 + 1;
+
+    verifier->context = context;
+    verifier->program = program;
+    verifier->len = len;
+    verifier->operands = registers ? reg_inst_operands : inst_operands;
+    verifier->num_opcodes = registers ? NUM_REG_INSTRUCTIONS : NUM_INSTRUCTIONS;
+    verifier->targets = heap_alloc(words, sizeof (u64));
+    verifier->ranks = heap_alloc(words, sizeof (u64));
+    verifier->num_targets = 0;
+    verifier->states = NULL;
+    verifier->max_stack = 0;
+    verifier->pc = 0;
+
+    memset(verifier->targets, 0, words * sizeof (u64));
+    stack_init(&verifier->frames, sizeof (VerifyFrame));
+
+    if (len == 0) {
+        VERIFY_ERROR(verifier, "%s", "empty program");
+    }
+
+    for (u64 pc = 0; pc < len; pc = verifier->next) {
+        u64 offset;
+
+        CHECK(verify_decode(verifier, pc));
+
+        if (is_jump(verifier, &offset)) {
+            u64 target = verifier->next + offset;
+
+            if (target >= len) {
+                VERIFY_ERROR(verifier, "jump to %llu is out of range", target);
+            }
+
+            verifier->targets[target / 64] |= (u64) 1 << (target % 64);
+        }
+    }
+
+    for (u64 i = 0; i < words; ++i) {
+        verifier->ranks[i] = verifier->num_targets;
+        verifier->num_targets += __builtin_popcountll(verifier->targets[i]);
+    }
+
+    verifier->states = heap_alloc(verifier->num_targets + 1, sizeof (VerifyState));
+
+    for (u64 i = 0; i < verifier->num_targets; ++i) {
+        verifier->states[i].height = UNVISITED;
+    }
+
+    return FALSE;
+}
+
+void verifier_deinit(Verifier *verifier) {
+    if (verifier->states) {
+        heap_dealloc(verifier->states);
+    }
+
+    heap_dealloc(verifier->targets);
+    heap_dealloc(verifier->ranks);
+    stack_deinit(&verifier->frames);
+}
+
+// NOTE: a backward jump must land on code the sweep already reached, so loops can't be entered from below
+RESULT verify_merge(Verifier *verifier, VerifyState *known, VerifyState state, u64 target) {
+    if (known->height == UNVISITED) {
+        *known = state;
+    }
+    else if (known->height == DEAD) {
+        VERIFY_ERROR(verifier, "%llu is only reached by jumping backwards", target);
+    }
+    else if (known->height != state.height || known->frame != state.frame) {
+        VERIFY_ERROR(verifier, "paths merging at %llu disagree on the stack height or scope", target);
+    }
+
+    return FALSE;
+}
+
+RESULT verify_jump(Verifier *verifier, i64 offset, VerifyState state) {
+    u64 target = verifier->next + offset;
+    return verify_merge(verifier, target_state(verifier, target), state, target);
+}
+
+VerifyFrame *frame_at(Verifier *verifier, u64 frame) {
+    return stack_index(&verifier->frames, frame);
+}
+
+RESULT verify_slot(Verifier *verifier, VerifyState state, u64 ptr, u64 depth) {
+    u64 frame = state.frame;
+
+    for (u64 i = 0; i < depth && frame != NO_FRAME; ++i) {
+        frame = frame_at(verifier, frame)->parent;
+    }
+
+    if (frame == NO_FRAME) {
+        VERIFY_ERROR(verifier, "scope depth %llu is out of range", depth);
+    }
+
+    if (ptr >= frame_at(verifier, frame)->size) {
+        VERIFY_ERROR(verifier, "slot %llu is out of range", ptr);
+    }
+
+    return FALSE;
+}
+
+RESULT verify_pops(Verifier *verifier, VerifyState *state, u64 pops, u64 pushes) {
+    if (state->height < pops) {
+        VERIFY_ERROR(verifier, "%s", "stack underflow");
+    }
+
+    state->height += pushes - pops;
+
+    if (state->height > verifier->max_stack) {
+        verifier->max_stack = state->height;
+    }
+
+    return FALSE;
+}
+
+// NOTE: every slot is declared in the source or used by an instruction, so a frame can't be larger than both together,
+// which keeps a corrupt size from allocating without bound
+RESULT verify_enter(Verifier *verifier, VerifyState *state, u64 size) {
+    VerifyFrame frame = { size, state->frame };
+
+    if (size > verifier->len + verifier->context->source.len) {
+        VERIFY_ERROR(verifier, "scope size %llu is larger than the program", size);
+    }
+
+    state->frame = stack_len(&verifier->frames);
+    stack_push(&verifier->frames, &frame);
+
+    return FALSE;
+}
+
+RESULT verify_exit(Verifier *verifier, VerifyState *state) {
+    if (state->frame == NO_FRAME) {
+        VERIFY_ERROR(verifier, "%s", "exit without a scope");
+    }
+
+    state->frame = frame_at(verifier, state->frame)->parent;
+    return FALSE;
+}
+
+// NOTE: the program has to halt the way the compiler ends it, with every scope exited and nothing left on the stack
+RESULT verify_halt(Verifier *verifier, VerifyState state) {
+    if (state.height != 0 || state.frame != NO_FRAME) {
+        VERIFY_ERROR(verifier, "%s", "halt with a scope or values still live");
+    }
+
+    return FALSE;
+}
+
+RESULT verify_stack_inst(Verifier *verifier, VerifyState *live) {
+    VerifyState state = *live;
+    u64 *v = verifier->values;
+
+    switch (verifier->opcode) {
+    case INST_PUSH_INT:
+    case INST_PUSH_NONE:
+        CHECK(verify_pops(verifier, &state, 0, 1));
+        break;
+    case INST_PUSH:
+    case INST_ADD_SLOT_IMM:
+    case INST_SUB_SLOT_IMM:
+    case INST_MUL_SLOT_IMM:
+        CHECK(verify_slot(verifier, state, v[0], v[1]));
+        CHECK(verify_pops(verifier, &state, 0, 1));
+        break;
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+        CHECK(verify_pops(verifier, &state, 2, 1));
+        break;
+    case INST_PULL_TO:
+        CHECK(verify_slot(verifier, state, v[0], v[1]));
+        // fallthrough
+    case INST_NEG:
+        CHECK(verify_pops(verifier, &state, 1, 1));
+        break;
+    case INST_STORE_POP:
+        CHECK(verify_slot(verifier, state, v[0], v[1]));
+        // fallthrough
+    case INST_POP:
+    case INST_PRINT:
+        CHECK(verify_pops(verifier, &state, 1, 0));
+        break;
+    case INST_HALT:
+        live->height = DEAD;
+        return verify_halt(verifier, state);
+    case INST_SCOPE:
+    case INST_SCOPE_HEAP:
+        CHECK(verify_enter(verifier, &state, v[0]));
+        break;
+    case INST_EXIT:
+    case INST_EXIT_NONE:
+        CHECK(verify_exit(verifier, &state));
+        CHECK(verify_pops(verifier, &state, 0, verifier->opcode == INST_EXIT_NONE));
+        break;
+    case INST_JUMP:
+        live->height = DEAD;
+        return verify_jump(verifier, v[0], state);
+    case INST_BRANCH:
+    case INST_BRANCH_F:
+        CHECK(verify_pops(verifier, &state, 1, 0));
+        CHECK(verify_jump(verifier, v[0], state));
+        break;
+    case INST_BRANCH_F_SLOT:
+        CHECK(verify_slot(verifier, state, v[0], v[1]));
+        CHECK(verify_jump(verifier, v[2], state));
+        break;
+    }
+
+    *live = state;
+    return FALSE;
+}
+
+RESULT verify_reg(Verifier *verifier, VerifyState state, u64 reg) {
+    if (state.frame == NO_FRAME) {
+        VERIFY_ERROR(verifier, "%s", "register used outside a scope");
+    }
+
+    if (reg >= frame_at(verifier, state.frame)->size) {
+        VERIFY_ERROR(verifier, "register %llu is out of range", reg);
+    }
+
+    return FALSE;
+}
+
+RESULT verify_reg_inst(Verifier *verifier, VerifyState *live) {
+    VerifyState state = *live;
+    u64 *v = verifier->values;
+    const char *kinds = verifier->operands[verifier->opcode];
+
+    // NOTE: every unsigned operand of a register instruction other than scope is a register
+    if (verifier->opcode != RINST_SCOPE) {
+        for (u64 i = 0; kinds[i]; ++i) {
+            if (kinds[i] == 'u') {
+                CHECK(verify_reg(verifier, state, v[i]));
+            }
+        }
+    }
+
+    switch (verifier->opcode) {
+    case RINST_HALT:
+        live->height = DEAD;
+        return verify_halt(verifier, state);
+    case RINST_SCOPE:
+        CHECK(verify_enter(verifier, &state, v[0]));
+        break;
+    case RINST_EXIT:
+        CHECK(verify_exit(verifier, &state));
+        break;
+    case RINST_JUMP:
+        live->height = DEAD;
+        return verify_jump(verifier, v[0], state);
+    case RINST_BRANCH:
+    case RINST_BRANCH_F:
+        CHECK(verify_jump(verifier, v[1], state));
+        break;
+    default:
+        break;
+    }
+
+    *live = state;
+    return FALSE;
+}
+
+// NOTE: sweeps the program once in order, carrying the stack height and scope from each instruction to the next
+// and checking them against every jump to the same place. This proves opcodes and operands well formed, that
+// control only reaches instruction boundaries, and that stack and scope accesses stay in range. Code that is
+// only reachable by a backward jump is rejected, the compiler never emits it
+RESULT verify(Context *context, u8 *program, u64 len, bool registers, Verified *verified) {
+    Verifier verifier;
+    VerifyState state = { 0, NO_FRAME };
+    bool error = verifier_init(&verifier, context, program, len, registers);
+    u64 reached = 0;
+
+    for (u64 pc = 0; !error && pc < len; pc = verifier.next) {
+        error = verify_decode(&verifier, pc);
+
+        if (!error && is_target(&verifier, pc)) {
+            VerifyState *known = target_state(&verifier, pc);
+            reached += 1;
+
+            if (state.height != DEAD) {
+                error = verify_merge(&verifier, known, state, pc);
+            }
+            else if (known->height == UNVISITED) {
+                known->height = DEAD;
+            }
+            else {
+                state = *known;
+            }
+        }
+
+        if (!error && state.height != DEAD) {
+            error = registers ? verify_reg_inst(&verifier, &state) : verify_stack_inst(&verifier, &state);
+        }
+    }
+
+    // NOTE: every target the sweep didn't land on is in the middle of an instruction
+    if (!error && reached != verifier.num_targets) {
+        DISPATCH_ERROR_FMT(context, -1, "Invalid bytecode: %s", "jump into the middle of an instruction");
+        error = TRUE;
+    }
+
+    if (!error && state.height != DEAD) {
+        DISPATCH_ERROR_FMT(context, -1, "Invalid bytecode at %llu: %s", len, "control runs off the end");
+        error = TRUE;
+    }
+
+    verified->max_stack = verifier.max_stack;
+    verifier_deinit(&verifier);
+
+    return error;
+}
+
+RESULT verify_program(Context *context, u8 *program, u64 len, Verified *verified) {
+    return verify(context, program, len, FALSE, verified);
+}
+
+RESULT verify_reg_program(Context *context, u8 *program, u64 len, Verified *verified) {
+    return verify(context, program, len, TRUE, verified);
+}
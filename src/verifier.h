@@ -0,0 +1,17 @@
+#pragma once
+
+#include "auxiliary.h"
+
+typedef struct __Context__ Context;
+
+// NOTE: what the verifier proved about a program, the VM relies on this instead of checking as it runs
+typedef struct {
+    u64 max_stack;
+} Verified;
+
+// NOTE: operand kinds per opcode, `u` is an unsigned LEB128 and `i` a signed one
+extern const char *inst_operands[];
+extern const char *reg_inst_operands[];
+
+RESULT verify_program(Context *context, u8 *program, u64 len, Verified *verified);
+RESULT verify_reg_program(Context *context, u8 *program, u64 len, Verified *verified);
@@ -3,7 +3,15 @@
 #include "vm.h"
 #include "context.h"
 
-#define NUM_INSTRUCTIONS 17
+#if defined(EBUG_PROFILE) || defined(EBUG_PAIRS)
+#include <time.h>
+#endif
+
+#define FRAME_CHUNK_SIZE 65536
+
+#if defined(__GNUC__) && !defined(SWITCH_DISPATCH)
+#define THREADED_DISPATCH // NOTE: labels as values, define SWITCH_DISPATCH to force the portable loop
+#endif
 
 const char *type_to_str(ObjectType type) {
     switch (type) {
@@ -20,342 +28,851 @@ void vm_init(Vm *vm, Context *context) {
 
     stack_init(&vm->op_stack, sizeof (Object));
     gc_init(&vm->gc);
+    jit_init(&vm->jit);
     vm->scope = NULL;
+    vm->frames = NULL;
 }
 
 void vm_deinit(Vm *vm) {
+    FrameChunk *chunk = vm->frames;
+
+    while (chunk && chunk->prev) {
+        chunk = chunk->prev;
+    }
+
+    while (chunk) {
+        FrameChunk *next = chunk->next;
+        heap_dealloc(chunk);
+        chunk = next;
+    }
+
     stack_deinit(&vm->op_stack);
     gc_deinit(&vm->gc);
+    jit_deinit(&vm->jit);
 }
 
-RESULT inst_push_int(Vm *vm) {
-    u64 integer;
+FrameChunk *frame_chunk_alloc(FrameChunk *prev, u64 bytes) {
+    if (bytes < FRAME_CHUNK_SIZE) {
+        bytes = FRAME_CHUNK_SIZE;
+    }
 
-    memcpy(&integer, &vm->program[vm->pc], 8);
-    stack_push(&vm->op_stack, &(Object) { obj_Integer, 0, integer });
+    FrameChunk *chunk = heap_alloc(1, sizeof (FrameChunk) + bytes);
 
-    vm->pc += 8;
+    chunk->prev = prev;
+    chunk->next = NULL;
+    chunk->top = (u8 *) (chunk + 1);
+    chunk->end = chunk->top + bytes;
 
-    return FALSE;
+    return chunk;
 }
 
-RESULT inst_push_none(Vm *vm) {
-    stack_push(&vm->op_stack, &(Object) { obj_None, 0, 0 });
-    return FALSE;
+// NOTE: scopes are bump allocated from a list of chunks that is kept around, so steady state entry and exit never allocate
+VmScope *vm_push_frame(Vm *vm, VmScope *parent, u64 size) {
+    u64 bytes = sizeof (VmScope) + size * sizeof (Object);
+    FrameChunk *chunk = vm->frames;
+
+    if (chunk == NULL) {
+        chunk = vm->frames = frame_chunk_alloc(NULL, bytes);
+    }
+    else if (chunk->top + bytes > chunk->end) {
+        if (chunk->next == NULL || (u64) (chunk->next->end - chunk->next->top) < bytes) {
+            FrameChunk *next = frame_chunk_alloc(chunk, bytes);
+
+            next->next = chunk->next;
+            if (next->next) next->next->prev = next;
+            chunk->next = next;
+        }
+
+        chunk = vm->frames = chunk->next;
+    }
+
+    VmScope *scope = (VmScope *) chunk->top;
+    chunk->top += bytes;
+
+    scope->stack = (Object *) (scope + 1);
+    scope->parent = parent;
+    scope->size = size;
+    scope->heap = FALSE;
+
+    memset(scope->stack, 0, size * sizeof (Object));
+
+    return scope;
 }
 
-RESULT inst_push(Vm *vm) {
-    u64 ptr;
-    u64 depth;
+void vm_pop_frame(Vm *vm, VmScope *scope) {
+    FrameChunk *chunk = vm->frames;
+    chunk->top = (u8 *) scope;
 
-    memcpy(&ptr, vm->program + vm->pc, 8);
-    vm->pc += 8;
-    memcpy(&depth, vm->program + vm->pc, 8);
-    vm->pc += 8;
+    if (chunk->top == (u8 *) (chunk + 1) && chunk->prev) {
+        vm->frames = chunk->prev;
+    }
+}
 
-    VmScope *scope = vm->scope;
+// NOTE: may collect and move scopes, so the caller must have synced its state into `vm`
+VmScope *vm_heap_scope(Vm *vm, u64 size) {
+    return gc_alloc_scope(&vm->gc, vm, size);
+}
 
-    for (u64 i = 0; i < depth; ++i) {
-        scope = scope->parent;
+const char *reg_inst_names[NUM_REG_INSTRUCTIONS] = {
+    "load_int",
+    "load_none",
+    "move",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "neg",
+    "halt",
+    "scope",
+    "exit",
+    "print",
+    "jump",
+    "branch",
+    "branch_f",
+};
 
-        if (scope == NULL) {
-            fprintf(stderr, FATAL "Depth too large\n");
-            exit(-1);
-        }
+const char *inst_names[NUM_INSTRUCTIONS] = {
+    "push_int",
+    "push_none",
+    "push",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "neg",
+    "pop",
+    "pull_to",
+    "halt",
+    "scope",
+    "exit",
+    "print",
+    "jump",
+    "branch",
+    "branch_f",
+    "scope_heap",
+    "store_pop",
+    "add_slot_imm",
+    "sub_slot_imm",
+    "mul_slot_imm",
+    "exit_none",
+    "branch_f_slot",
+};
+
+#ifdef EBUG_PAIRS
+#define PAIRS_SHOWN 16
+
+// NOTE: the most frequent adjacent opcode pairs, these are the candidates for superinstructions
+void dump_pairs(u64 *pairs, u64 num_opcodes, const char **names) {
+    u64 total = 0;
+
+    for (u64 i = 0; i < num_opcodes * num_opcodes; ++i) {
+        total += pairs[i];
     }
 
-    stack_push(&vm->op_stack, scope->stack + ptr);
+    for (u64 shown = 0; shown < PAIRS_SHOWN; ++shown) {
+        u64 best = 0;
 
-    return FALSE;
+        for (u64 i = 1; i < num_opcodes * num_opcodes; ++i) {
+            if (pairs[i] > pairs[best]) best = i;
+        }
+
+        if (pairs[best] == 0) break;
+
+        fprintf(stderr, "%-14s %-14s %12llu %5.1f%%\n", names[best / num_opcodes], names[best % num_opcodes], pairs[best], 100.0 * pairs[best] / total);
+        pairs[best] = 0;
+    }
 }
+#endif
+
+// NOTE: the hot state lives in locals while running, these move it in and out of `vm`
+#define SYNC_STATE() do { vm->pc = pc; vm->scope = scope; vm->op_stack.len = (u64) (sp - base) * sizeof (Object); } while (FALSE)
+#define LOAD_STACK() do { base = (Object *) vm->op_stack.arr; sp = base + stack_len(&vm->op_stack); } while (FALSE)
+
+// NOTE: one byte operands are decoded inline, the copy of pc keeps it out of memory on the slow path
+#define READ_UINT(v) do { \
+        if (__builtin_expect(program[pc] < 0x80, 1)) { \
+            (v) = program[pc++]; \
+        } \
+        else { \
+            u64 at_ = pc; \
+            (v) = decode_uint(program, &at_); \
+            pc = at_; \
+        } \
+    } while (FALSE)
+#define READ_INT(v) do { \
+        if (__builtin_expect(program[pc] < 0x80, 1)) { \
+            (v) = ((i64) program[pc++] ^ 0x40) - 0x40; \
+        } \
+        else { \
+            u64 at_ = pc; \
+            (v) = decode_int(program, &at_); \
+            pc = at_; \
+        } \
+    } while (FALSE)
+// NOTE: the verifier has already proven these, EBUG_CHECKS brings them back to catch a verifier that's wrong
+#ifdef EBUG_CHECKS
+#define PUSH_OBJECT(obj) do { if (sp == base + vm->op_stack.cap / sizeof (Object)) { fprintf(stderr, FATAL "Stack overflow\n"); exit(-1); } *sp++ = (obj); } while (FALSE)
+#define REQUIRE(n) do { if (sp - base < (n)) { fprintf(stderr, FATAL "Stack underflow\n"); exit(-1); } } while (FALSE)
+#define REQUIRE_SCOPE(target) do { if (target == NULL) { fprintf(stderr, FATAL "Depth too large\n"); exit(-1); } } while (FALSE)
+#define INVALID_OPCODE() do { fprintf(stderr, FATAL "Invalid opcode\n"); exit(-1); } while (FALSE)
+#else
+#define PUSH_OBJECT(obj) (*sp++ = (obj))
+#define REQUIRE(n)
+#define REQUIRE_SCOPE(target)
+#define INVALID_OPCODE() __builtin_unreachable()
+#endif
+
+// NOTE: a backward jump to `pc` ending at `end` closes a loop, once it's hot the rest of the loop runs natively
+#define JIT_LOOP(end) do { \
+        JitCode code = jit_loop(vm, pc, end); \
+        if (code) { \
+            SYNC_STATE(); \
+            if (jit_run(vm, code)) goto error; \
+            pc = vm->pc; \
+            LOAD_STACK(); \
+        } \
+    } while (FALSE)
+
+// NOTE: an integer too wide to tag is boxed, which may collect and move scopes, so the state is synced first
+#ifdef TAGGED_VALUES
+#define STORE_INT(dst, integer) do { \
+        i64 int_ = (integer); \
+        if (__builtin_expect(INT_FITS(int_), 1)) { \
+            (dst) = MAKE_INT(int_); \
+        } \
+        else { \
+            SYNC_STATE(); \
+            (dst) = MAKE_BOX(gc_alloc_box(&vm->gc, vm, int_)); \
+            scope = vm->scope; \
+        } \
+    } while (FALSE)
+#else
+#define STORE_INT(dst, integer) ((dst) = MAKE_INT(integer))
+#endif
+
+#define RESOLVE_SCOPE(target, depth) do { \
+        target = scope; \
+        for (u64 i = 0; i < depth; ++i) { \
+            target = target->parent; \
+            REQUIRE_SCOPE(target); \
+        } \
+    } while (FALSE)
+
+#define ARITHMETIC(op, cast, verb) do { \
+        REQUIRE(2); \
+        Object *rhs = --sp; \
+        Object *lhs = sp - 1; \
+        if (BOTH_INTEGERS(*lhs, *rhs)) { \
+            STORE_INT(*lhs, (cast) OBJ_INT(*lhs) op (cast) OBJ_INT(*rhs)); \
+        } \
+        else { \
+            DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to " verb " invalid types `%s` and `%s`", type_to_str(OBJ_TYPE(*lhs)), type_to_str(OBJ_TYPE(*rhs))); \
+            goto error; \
+        } \
+    } while (FALSE)
+
+#define SLOT_IMM_ARITHMETIC(op, verb) do { \
+        u64 ptr; \
+        u64 depth; \
+        i64 imm; \
+        VmScope *target; \
+        READ_UINT(ptr); \
+        READ_UINT(depth); \
+        READ_INT(imm); \
+        RESOLVE_SCOPE(target, depth); \
+        Object lhs = target->stack[ptr]; \
+        if (OBJ_TYPE(lhs) == obj_Integer) { \
+            Object obj; \
+            STORE_INT(obj, (u64) OBJ_INT(lhs) op (u64) imm); \
+            PUSH_OBJECT(obj); \
+        } \
+        else { \
+            DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to " verb " invalid types `%s` and `%s`", type_to_str(OBJ_TYPE(lhs)), type_to_str(obj_Integer)); \
+            goto error; \
+        } \
+    } while (FALSE)
+
+#ifdef EBUG_EXE
+#define TRACE(names) do { \
+        SYNC_STATE(); \
+        for (u64 i = 0; i < 4; ++i) { \
+            printf("%lld ", OBJ_INT(*(Object *) stack_index(&vm->op_stack, i))); \
+        } \
+        printf("\n[x] %hhu\t", program[pc]); \
+        printf("%s\n", names[program[pc]]); \
+        getchar(); \
+    } while (FALSE)
+#else
+#define TRACE(names)
+#endif
+
+#ifdef EBUG_PROFILE
+#define COUNT() ++executed
+#else
+#define COUNT()
+#endif
+
+#ifdef EBUG_PAIRS
+#define PAIR() do { if (last >= 0) ++pairs[last * NUM_OPCODES + program[pc]]; last = program[pc]; } while (FALSE)
+#else
+#define PAIR()
+#endif
 
+#ifdef THREADED_DISPATCH
+#define DISPATCH() do { TRACE(TRACE_NAMES); COUNT(); PAIR(); goto *dispatch_table[program[pc++]]; } while (FALSE)
+#define TARGET(inst) target_##inst
+#define FALLTHROUGH
+#else
+#define DISPATCH() continue
+#define TARGET(inst) case inst
+#define FALLTHROUGH __attribute__((fallthrough)) // NOTE: a comment isn't recognized before a case label from a macro
+#endif
+
+#define TRACE_NAMES inst_names
+#define NUM_OPCODES NUM_INSTRUCTIONS
+
+RESULT vm_run(Vm *vm) {
+    u8 *program = vm->program;
+    u64 pc = vm->pc;
+    VmScope *scope = vm->scope;
+    Object *base;
+    Object *sp;
+    bool jit = vm->jit.enabled;
+
+#ifdef EBUG_PROFILE
+    u64 executed = 0;
+    clock_t start = clock();
+#endif
 
-RESULT inst_add(Vm *vm) {
-    Object rhs;
-    stack_pop(&vm->op_stack, &rhs);
-    Object *lhs = stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1);
+#ifdef EBUG_PAIRS
+    u64 pairs[NUM_OPCODES * NUM_OPCODES] = { 0 };
+    int last = -1;
+#endif
+
+    // NOTE: the stack never grows past the depth the verifier found, so it's sized once and pushes don't check
+    stack_ensure(&vm->op_stack, vm->context->verified.max_stack);
+    LOAD_STACK();
+
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[NUM_INSTRUCTIONS] = {
+        &&TARGET(INST_PUSH_INT),
+        &&TARGET(INST_PUSH_NONE),
+        &&TARGET(INST_PUSH),
+        &&TARGET(INST_ADD),
+        &&TARGET(INST_SUB),
+        &&TARGET(INST_MUL),
+        &&TARGET(INST_DIV),
+        &&TARGET(INST_NEG),
+        &&TARGET(INST_POP),
+        &&TARGET(INST_PULL_TO),
+        &&TARGET(INST_HALT),
+        &&TARGET(INST_SCOPE),
+        &&TARGET(INST_EXIT),
+        &&TARGET(INST_PRINT),
+        &&TARGET(INST_JUMP),
+        &&TARGET(INST_BRANCH),
+        &&TARGET(INST_BRANCH_F),
+        &&TARGET(INST_SCOPE_HEAP),
+        &&TARGET(INST_STORE_POP),
+        &&TARGET(INST_ADD_SLOT_IMM),
+        &&TARGET(INST_SUB_SLOT_IMM),
+        &&TARGET(INST_MUL_SLOT_IMM),
+        &&TARGET(INST_EXIT_NONE),
+        &&TARGET(INST_BRANCH_F_SLOT),
+    };
+
+    DISPATCH();
+#else
+    for (;;) {
+        TRACE(TRACE_NAMES);
+        COUNT();
+        PAIR();
+
+        switch (program[pc++]) {
+#endif
 
-    i64 rdata = (i64) rhs.data;
-    i64 ldata = (i64) lhs->data;
+    TARGET(INST_PUSH_INT): {
+        i64 integer;
+        READ_INT(integer);
 
-    switch (((u16) lhs->type) << 8 | (u16) rhs.type) {
-    case obj_Integer << 8 | obj_Integer:
-        lhs->data = (u64) (ldata + rdata);
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to add invalid types `%s` and `%s`", type_to_str(lhs->type), type_to_str(rhs.type));
-        return TRUE;
+        Object obj;
+        STORE_INT(obj, integer);
+        PUSH_OBJECT(obj);
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(INST_PUSH_NONE): {
+        Object obj = MAKE_NONE();
+        PUSH_OBJECT(obj);
+        DISPATCH();
+    }
+
+    TARGET(INST_PUSH): {
+        u64 ptr;
+        u64 depth;
+        VmScope *target;
 
-RESULT inst_sub(Vm *vm) {
-    Object rhs;
-    stack_pop(&vm->op_stack, &rhs);
-    Object *lhs = stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1);
-
-    i64 rdata = (i64) rhs.data;
-    i64 ldata = (i64) lhs->data;
-
-    switch (((u16) lhs->type) << 8 | (u16) rhs.type) {
-    case obj_Integer << 8 | obj_Integer:
-        lhs->data = (u64) (ldata - rdata);
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to subtract invalid types `%s` and `%s`", type_to_str(lhs->type), type_to_str(rhs.type));
-        return TRUE;
+        READ_UINT(ptr);
+        READ_UINT(depth);
+        RESOLVE_SCOPE(target, depth);
+        PUSH_OBJECT(target->stack[ptr]);
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(INST_ADD):
+        ARITHMETIC(+, u64, "add");
+        DISPATCH();
+
+    TARGET(INST_SUB):
+        ARITHMETIC(-, u64, "subtract");
+        DISPATCH();
+
+    TARGET(INST_MUL):
+        ARITHMETIC(*, u64, "multiply");
+        DISPATCH();
+
+    TARGET(INST_DIV):
+        ARITHMETIC(/, i64, "divide");
+        DISPATCH();
+
+    TARGET(INST_NEG):
+        REQUIRE(1);
+
+        switch (OBJ_TYPE(sp[-1])) {
+        case obj_Integer:
+            STORE_INT(sp[-1], ~(u64) OBJ_INT(sp[-1]) + 1);
+            break;
+        default:
+            DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to negate an invalid type `%s`", type_to_str(OBJ_TYPE(sp[-1])));
+            goto error;
+        }
+
+        DISPATCH();
+
+    TARGET(INST_POP):
+        REQUIRE(1);
+        --sp;
+        DISPATCH();
+
+    TARGET(INST_PULL_TO):
+    TARGET(INST_STORE_POP): {
+        u64 ptr;
+        u64 depth;
+        VmScope *target;
+        bool pop = program[pc - 1] == INST_STORE_POP;
+
+        READ_UINT(ptr);
+        READ_UINT(depth);
+        RESOLVE_SCOPE(target, depth);
+        REQUIRE(1);
+        target->stack[ptr] = sp[-1];
+
+        if (OBJ_TYPE(sp[-1]) == obj_Scope && target->heap && !target->young && OBJ_SCOPE(sp[-1])->young) {
+            gc_write_barrier(&vm->gc, target);
+        }
 
-RESULT inst_mul(Vm *vm) {
-    Object rhs;
-    stack_pop(&vm->op_stack, &rhs);
-    Object *lhs = stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1);
-
-    i64 rdata = (i64) rhs.data;
-    i64 ldata = (i64) lhs->data;
-
-    switch (((u16) lhs->type) << 8 | (u16) rhs.type) {
-    case obj_Integer << 8 | obj_Integer:
-        lhs->data = (u64) (ldata * rdata);
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to multiply invalid types `%s` and `%s`", type_to_str(lhs->type), type_to_str(rhs.type));
-        return TRUE;
+        sp -= pop;
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(INST_ADD_SLOT_IMM):
+        SLOT_IMM_ARITHMETIC(+, "add");
+        DISPATCH();
+
+    TARGET(INST_SUB_SLOT_IMM):
+        SLOT_IMM_ARITHMETIC(-, "subtract");
+        DISPATCH();
 
-RESULT inst_div(Vm *vm) {
-    Object rhs;
-    stack_pop(&vm->op_stack, &rhs);
-    Object *lhs = stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1);
-
-    i64 rdata = (i64) rhs.data;
-    i64 ldata = (i64) lhs->data;
-
-    switch (((u16) lhs->type) << 8 | (u16) rhs.type) {
-    case obj_Integer << 8 | obj_Integer:
-        lhs->data = (u64) (ldata / rdata);
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to divide invalid types `%s` and `%s`", type_to_str(lhs->type), type_to_str(rhs.type));
-        return TRUE;
+    TARGET(INST_MUL_SLOT_IMM):
+        SLOT_IMM_ARITHMETIC(*, "multiply");
+        DISPATCH();
+
+    TARGET(INST_HALT):
+        vm->halted = TRUE;
+        goto done;
+
+    TARGET(INST_SCOPE): {
+        u64 size;
+        READ_UINT(size);
+        scope = vm_push_frame(vm, scope, size);
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(INST_SCOPE_HEAP): {
+        u64 size;
+        READ_UINT(size);
+        SYNC_STATE();
+        scope = vm_heap_scope(vm, size);
+        DISPATCH();
+    }
+
+    TARGET(INST_EXIT_NONE): {
+        Object obj = MAKE_NONE();
+        PUSH_OBJECT(obj);
+    }
+    FALLTHROUGH;
 
-RESULT inst_neg(Vm *vm) {
-    Object *oprand = stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1);
+    TARGET(INST_EXIT): {
+        VmScope *exited = scope;
+        scope = scope->parent;
+
+        if (!exited->heap) {
+            vm_pop_frame(vm, exited);
+        }
 
-    switch (oprand->type) {
-    case obj_Integer:
-        oprand->data = ~oprand->data + 1;
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to negate an invalid type `%s`", type_to_str(oprand->type));
-        return TRUE;
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(INST_PRINT):
+        REQUIRE(1);
+        --sp;
+
+        switch (OBJ_TYPE(*sp)) {
+        case obj_Integer:
+            printf("%lld\n", OBJ_INT(*sp));
+            break;
+        case obj_None:
+            printf("none\n");
+            break;
+        case obj_Scope:
+            fprintf(stderr, "Attempt to print scope");
+            exit(-1);
+        }
+
+        DISPATCH();
+
+    TARGET(INST_JUMP): {
+        i64 offset;
+        READ_INT(offset);
+        pc += offset;
+
+        if (jit && offset < 0) {
+            JIT_LOOP(pc - offset);
+        }
 
-RESULT inst_pop(Vm *vm) {
-    if (stack_len(&vm->op_stack) == 0) {
-        fprintf(stderr, FATAL "Stack underflow\n");
-        exit(-1);
+        DISPATCH();
     }
 
-    vm->op_stack.len -= sizeof (Object);
+    TARGET(INST_BRANCH):
+    TARGET(INST_BRANCH_F): {
+        i64 offset;
+        bool truth;
+        bool on_true = program[pc - 1] == INST_BRANCH;
+
+        REQUIRE(1);
+        --sp;
+        READ_INT(offset);
+
+        switch (OBJ_TYPE(*sp)) {
+        case obj_Integer:
+        case obj_None:
+            truth = OBJ_TRUTH(*sp);
+            break;
+        default:
+            DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(OBJ_TYPE(*sp)));
+            goto error;
+        }
 
-    return FALSE;
-}
+        if (truth == on_true) {
+            pc += offset;
 
-RESULT inst_pull_to(Vm *vm) {
-    u64 ptr;
-    u64 depth;
+            if (jit && offset < 0) {
+                JIT_LOOP(pc - offset);
+            }
+        }
 
-    memcpy(&ptr, vm->program + vm->pc, 8);
-    vm->pc += 8;
-    memcpy(&depth, vm->program + vm->pc, 8);
-    vm->pc += 8;
+        DISPATCH();
+    }
 
-    VmScope *scope = vm->scope;
+    TARGET(INST_BRANCH_F_SLOT): {
+        u64 ptr;
+        u64 depth;
+        i64 offset;
+        VmScope *target;
+        Object cond;
+
+        READ_UINT(ptr);
+        READ_UINT(depth);
+        RESOLVE_SCOPE(target, depth);
+        cond = target->stack[ptr];
+        READ_INT(offset);
+
+        switch (OBJ_TYPE(cond)) {
+        case obj_Integer:
+        case obj_None:
+            break;
+        default:
+            DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(OBJ_TYPE(cond)));
+            goto error;
+        }
 
-    for (u64 i = 0; i < depth; ++i) {
-        scope = scope->parent;
+        if (!OBJ_TRUTH(cond)) {
+            pc += offset;
 
-        if (scope == NULL) {
-            fprintf(stderr, FATAL "Depth too large\n");
-            exit(-1);
+            if (jit && offset < 0) {
+                JIT_LOOP(pc - offset);
+            }
+        }
+
+        DISPATCH();
+    }
+
+#ifndef THREADED_DISPATCH
+        default:
+            INVALID_OPCODE();
         }
     }
+#endif
 
-    memcpy(scope->stack + ptr, stack_index(&vm->op_stack, stack_len(&vm->op_stack) - 1), sizeof (Object));
+done:
+    SYNC_STATE();
 
-    return FALSE;
-}
+#ifdef EBUG_PROFILE
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    fprintf(stderr, "%llu instructions in %.3fs (%.1fM instructions/s)\n", executed, seconds, executed / seconds / 1e6);
+#endif
+
+#ifdef EBUG_PAIRS
+    dump_pairs(pairs, NUM_OPCODES, TRACE_NAMES);
+#endif
 
-RESULT inst_halt(Vm *vm) {
-    vm->halted = TRUE;
     return FALSE;
+
+error:
+    SYNC_STATE();
+    return TRUE;
 }
 
-RESULT inst_scope(Vm *vm) {
-    u64 size;
-    memcpy(&size, &vm->program[vm->pc], 8);
-    vm->pc += 8;
+#undef TRACE_NAMES
+#undef NUM_OPCODES
+#define TRACE_NAMES reg_inst_names
+#define NUM_OPCODES NUM_REG_INSTRUCTIONS
+
+#define READ_REG(reg) do { u64 index; READ_UINT(index); reg = slots + index; } while (FALSE)
+
+#define REG_ARITHMETIC(op, cast, verb) do { \
+        Object *dst; \
+        Object *lhs; \
+        Object *rhs; \
+        READ_REG(dst); \
+        READ_REG(lhs); \
+        READ_REG(rhs); \
+        if (BOTH_INTEGERS(*lhs, *rhs)) { \
+            STORE_INT(*dst, (cast) OBJ_INT(*lhs) op (cast) OBJ_INT(*rhs)); \
+        } \
+        else { \
+            DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to " verb " invalid types `%s` and `%s`", type_to_str(OBJ_TYPE(*lhs)), type_to_str(OBJ_TYPE(*rhs))); \
+            goto error; \
+        } \
+    } while (FALSE)
+
+// NOTE: operands are slot indices into the current frame, so nothing goes through the operand stack
+RESULT vm_run_registers(Vm *vm) {
+    u8 *program = vm->program;
+    u64 pc = vm->pc;
+    VmScope *scope = vm->scope;
+    Object *slots = scope ? scope->stack : NULL;
+    Object *base = (Object *) vm->op_stack.arr;
+    Object *sp = base + stack_len(&vm->op_stack);
 
-    Object *scope_obj = gc_alloc(&vm->gc);
-    VmScope *scope = heap_alloc(1, sizeof (VmScope));
+#ifdef EBUG_PROFILE
+    u64 executed = 0;
+    clock_t start = clock();
+#endif
 
-    scope_obj->type = obj_Scope;
-    scope_obj->data = (u64) scope;
+#ifdef EBUG_PAIRS
+    u64 pairs[NUM_OPCODES * NUM_OPCODES] = { 0 };
+    int last = -1;
+#endif
 
-    scope->parent = vm->scope;
-    scope->stack = heap_alloc(size, sizeof (Object));
-    vm->scope = scope;
+#ifdef THREADED_DISPATCH
+    static void *dispatch_table[NUM_REG_INSTRUCTIONS] = {
+        &&TARGET(RINST_LOAD_INT),
+        &&TARGET(RINST_LOAD_NONE),
+        &&TARGET(RINST_MOVE),
+        &&TARGET(RINST_ADD),
+        &&TARGET(RINST_SUB),
+        &&TARGET(RINST_MUL),
+        &&TARGET(RINST_DIV),
+        &&TARGET(RINST_NEG),
+        &&TARGET(RINST_HALT),
+        &&TARGET(RINST_SCOPE),
+        &&TARGET(RINST_EXIT),
+        &&TARGET(RINST_PRINT),
+        &&TARGET(RINST_JUMP),
+        &&TARGET(RINST_BRANCH),
+        &&TARGET(RINST_BRANCH_F),
+    };
+
+    DISPATCH();
+#else
+    for (;;) {
+        TRACE(TRACE_NAMES);
+        COUNT();
+        PAIR();
+
+        switch (program[pc++]) {
+#endif
 
-    return FALSE;
-}
+    TARGET(RINST_LOAD_INT): {
+        Object *dst;
+        i64 integer;
 
-RESULT inst_exit(Vm *vm) {
-    vm->scope = vm->scope->parent;
-    return FALSE;
-}
+        READ_REG(dst);
+        READ_INT(integer);
+        STORE_INT(*dst, integer);
+        DISPATCH();
+    }
+
+    TARGET(RINST_LOAD_NONE): {
+        Object *dst;
 
-RESULT inst_print(Vm *vm) {
-    Object obj;
-    stack_pop(&vm->op_stack, &obj);
-
-    switch (obj.type) {
-    case obj_Integer:
-        printf("%lld\n", obj.data);
-        break;
-    case obj_None:
-        printf("none\n");
-        break;
-    case obj_Scope:
-        fprintf(stderr, "Attempt to print scope");
-        exit(-1);
+        READ_REG(dst);
+        *dst = MAKE_NONE();
+        DISPATCH();
     }
 
-    return FALSE;
-}
+    TARGET(RINST_MOVE): {
+        Object *dst;
+        Object *src;
 
-RESULT inst_jump(Vm *vm) {
-    u64 addr;
-    memcpy(&addr, vm->program + vm->pc, 8);
-    vm->pc = addr;
-    return FALSE;
-}
+        READ_REG(dst);
+        READ_REG(src);
+        *dst = *src;
+        DISPATCH();
+    }
+
+    TARGET(RINST_ADD):
+        REG_ARITHMETIC(+, u64, "add");
+        DISPATCH();
+
+    TARGET(RINST_SUB):
+        REG_ARITHMETIC(-, u64, "subtract");
+        DISPATCH();
+
+    TARGET(RINST_MUL):
+        REG_ARITHMETIC(*, u64, "multiply");
+        DISPATCH();
+
+    TARGET(RINST_DIV):
+        REG_ARITHMETIC(/, i64, "divide");
+        DISPATCH();
+
+    TARGET(RINST_NEG): {
+        Object *dst;
+        Object *src;
 
-RESULT inst_branch(Vm *vm) {
-    u64 addr;
-    Object condition;
-    bool branch;
-
-    stack_pop(&vm->op_stack, &condition);
-    memcpy(&addr, vm->program + vm->pc, 8);
-
-    switch (condition.type) {
-    case obj_Integer:
-    case obj_None:
-        branch = condition.data;
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(condition.type));
-        return TRUE;
+        READ_REG(dst);
+        READ_REG(src);
+
+        switch (OBJ_TYPE(*src)) {
+        case obj_Integer:
+            STORE_INT(*dst, ~(u64) OBJ_INT(*src) + 1);
+            break;
+        default:
+            DISPATCH_ERROR_FMT(vm->context, -1, "Attempt to negate an invalid type `%s`", type_to_str(OBJ_TYPE(*src)));
+            goto error;
+        }
+
+        DISPATCH();
     }
 
-    vm->pc = branch ? addr : vm->pc + 8;
+    TARGET(RINST_HALT):
+        vm->halted = TRUE;
+        goto done;
 
-    return FALSE;
-}
+    TARGET(RINST_SCOPE): {
+        u64 size;
+        READ_UINT(size);
+        scope = vm_push_frame(vm, scope, size);
+        slots = scope->stack;
+        DISPATCH();
+    }
 
-RESULT inst_branch_f(Vm *vm) {
-    u64 addr;
-    Object condition;
-    bool nobranch;
-
-    stack_pop(&vm->op_stack, &condition);
-    memcpy(&addr, vm->program + vm->pc, 8);
-
-    switch (condition.type) {
-    case obj_Integer:
-    case obj_None:
-        nobranch = condition.data;
-        break;
-    default:
-        DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(condition.type));
-        return TRUE;
+    TARGET(RINST_EXIT): {
+        VmScope *exited = scope;
+        scope = scope->parent;
+        slots = scope ? scope->stack : NULL;
+
+        if (!exited->heap) {
+            vm_pop_frame(vm, exited);
+        }
+
+        DISPATCH();
     }
 
-    vm->pc = nobranch ? vm->pc + 8 : addr;
+    TARGET(RINST_PRINT): {
+        Object *src;
+        READ_REG(src);
+
+        switch (OBJ_TYPE(*src)) {
+        case obj_Integer:
+            printf("%lld\n", OBJ_INT(*src));
+            break;
+        case obj_None:
+            printf("none\n");
+            break;
+        case obj_Scope:
+            fprintf(stderr, "Attempt to print scope");
+            exit(-1);
+        }
 
-    return FALSE;
-}
+        DISPATCH();
+    }
 
-bool (*instructions[NUM_INSTRUCTIONS]) (Vm *vm) = {
-    inst_push_int,
-    inst_push_none,
-    inst_push,
-    inst_add,
-    inst_sub,
-    inst_mul,
-    inst_div,
-    inst_neg,
-    inst_pop,
-    inst_pull_to,
-    inst_halt,
-    inst_scope,
-    inst_exit,
-    inst_print,
-    inst_jump,
-    inst_branch,
-    inst_branch_f,
-};
+    TARGET(RINST_JUMP): {
+        i64 offset;
+        READ_INT(offset);
+        pc += offset;
+        DISPATCH();
+    }
 
-const char *inst_names[NUM_INSTRUCTIONS] = {
-    "push_int",
-    "push_none",
-    "push",
-    "add",
-    "sub",
-    "mul",
-    "div",
-    "neg",
-    "pop",
-    "pull_to",
-    "halt",
-    "scope",
-    "exit",
-    "print",
-    "jump",
-    "branch",
-    "branch_f",
-};
+    TARGET(RINST_BRANCH):
+    TARGET(RINST_BRANCH_F): {
+        Object *cond;
+        i64 offset;
+        bool truth;
+        bool on_true = program[pc - 1] == RINST_BRANCH;
+
+        READ_REG(cond);
+        READ_INT(offset);
+
+        switch (OBJ_TYPE(*cond)) {
+        case obj_Integer:
+        case obj_None:
+            truth = OBJ_TRUTH(*cond);
+            break;
+        default:
+            DISPATCH_ERROR_FMT(vm->context, -1, "Cannot determine truth value of object with type `%s`", type_to_str(OBJ_TYPE(*cond)));
+            goto error;
+        }
 
-RESULT vm_run(Vm *vm) {
-    while (!vm->halted) {
-        u8 opcode = vm->program[vm->pc++];
+        pc += truth == on_true ? offset : 0;
+        DISPATCH();
+    }
 
-#ifdef EBUG_EXE
-        for (u64 i = 0; i < 4; ++i) {
-            printf("%llu ", ((Object *) stack_index(&vm->op_stack, i))->data);
+#ifndef THREADED_DISPATCH
+        default:
+            INVALID_OPCODE();
         }
-        printf("\n[x] %hhu\t", opcode);
-        printf("%s\n", inst_names[opcode]);
-        getchar();
+    }
 #endif
 
-        CHECK(instructions[opcode](vm));
-    }
+done:
+    SYNC_STATE();
+
+#ifdef EBUG_PROFILE
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+    fprintf(stderr, "%llu instructions in %.3fs (%.1fM instructions/s)\n", executed, seconds, executed / seconds / 1e6);
+#endif
+
+#ifdef EBUG_PAIRS
+    dump_pairs(pairs, NUM_OPCODES, TRACE_NAMES);
+#endif
 
     return FALSE;
+
+error:
+    SYNC_STATE();
+    return TRUE;
 }
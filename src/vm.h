@@ -3,6 +3,7 @@
 #include "auxiliary.h"
 #include "compiling.h"
 #include "gc.h"
+#include "jit.h"
 
 typedef struct __Context__ Context;
 
@@ -13,31 +14,95 @@ typedef enum PACKED {
     obj_Scope,
 } ObjectType;
 
+// NOTE: only TAGGED_VALUES allocates these, for integers that don't fit in 63 bits
+typedef struct __IntBox__ {
+    i64 value;
+    u8 mark;
+} IntBox;
+
+#ifdef TAGGED_VALUES
+
+// NOTE: integers are shifted left, so a zeroed slot is 0 like it is untagged. None is 1, and anything else is an
+// aligned pointer with the low bit set: a scope, or with the next bit set too, an integer too wide to shift
+typedef struct __Object__ {
+    u64 bits;
+} Object;
+
+#define OBJ_BOXED(obj)          (((obj).bits & 3) == 3)
+#define OBJ_TYPE(obj)           (!((obj).bits & 1) || OBJ_BOXED(obj) ? obj_Integer : (obj).bits == 1 ? obj_None : obj_Scope)
+#define OBJ_INT(obj)            (((obj).bits & 1) ? OBJ_BOX(obj)->value : (i64) (obj).bits >> 1)
+#define OBJ_BOX(obj)            ((IntBox *) ((obj).bits & ~(u64) 3))
+#define OBJ_SCOPE(obj)          ((VmScope *) ((obj).bits & ~(u64) 1))
+#define OBJ_TRUTH(obj)          ((obj).bits > 1)
+#define BOTH_INTEGERS(a, b)     (!(((a).bits | (b).bits) & 1) || (OBJ_TYPE(a) == obj_Integer && OBJ_TYPE(b) == obj_Integer))
+
+#define INT_FITS(integer)       ((i64) ((u64) (integer) << 1) >> 1 == (i64) (integer))
+#define MAKE_INT(integer)       ((Object) { (u64) (integer) << 1 }) // NOTE: only where INT_FITS, the rest are boxed
+#define MAKE_BOX(box)           ((Object) { (u64) (box) | 3 })
+#define MAKE_NONE()             ((Object) { 1 })
+#define MAKE_SCOPE(scope)       ((Object) { (u64) (scope) | 1 })
+
+#define VALUE_SIZE 8
+
+#else
+
 typedef struct __Object__ {
     ObjectType type;
     u8 mark;
     u64 data;
 } Object;
 
+#define OBJ_TYPE(obj)           ((obj).type)
+#define OBJ_INT(obj)            ((i64) (obj).data)
+#define OBJ_SCOPE(obj)          ((VmScope *) (obj).data)
+#define OBJ_TRUTH(obj)          ((obj).data != 0)
+#define BOTH_INTEGERS(a, b)     ((a).type == obj_Integer && (b).type == obj_Integer)
+
+#define MAKE_INT(integer)       ((Object) { obj_Integer, 0, (u64) (integer) })
+#define MAKE_NONE()             ((Object) { obj_None, 0, 0 })
+#define MAKE_SCOPE(scope)       ((Object) { obj_Scope, 0, (u64) (scope) })
+
+#define VALUE_SIZE 16
+
+#endif
+
 typedef struct __VmScope__ {
     Object *stack;
     struct __VmScope__ *parent;
+    u64 size;
+    bool heap;
+    bool young;
+    bool remembered;
+    u8 mark;
+    struct __VmScope__ *forward;
 } VmScope;
 
+typedef struct __FrameChunk__ {
+    struct __FrameChunk__ *prev;
+    struct __FrameChunk__ *next;
+    u8 *top;
+    u8 *end;
+} FrameChunk;
+
 _Static_assert(sizeof (ObjectType) == 1, "ObjectType size");
-_Static_assert(sizeof (Object) == 16, "Object size");
+_Static_assert(sizeof (Object) == VALUE_SIZE, "Object size");
 
-typedef struct {
+typedef struct __Vm__ {
     Context *context;
     Stack op_stack;
     VmScope *scope;
+    FrameChunk *frames;
     Gc gc;
+    Jit jit;
 
     bool halted;
     u8 *program;
+    u64 program_len;
     u64 pc;
 } Vm;
 
+const char *type_to_str(ObjectType type);
 void vm_init(Vm *vm, Context *context);
 void vm_deinit(Vm *vm);
 RESULT vm_run(Vm *vm);
+RESULT vm_run_registers(Vm *vm);
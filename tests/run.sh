@@ -0,0 +1,56 @@
+#!/bin/sh
+# NOTE: runs every program here with each backend and compares what it prints, errors included, with the `.out` next
+# to it, and `-a` also translates each program to C and runs that
+# usage: run.sh <path to interpreter> [-a]
+
+JY="$1"
+shift
+AOT=
+for arg in "$@"; do
+    case "$arg" in
+    -a) AOT=1 ;;
+    esac
+done
+
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/jy_tests.$$
+FAILED=0
+
+# NOTE: stdout is buffered when it isn't a terminal, so it's compared before stderr rather than interleaved
+run() {
+    "$@" > "$TMP.out" 2> "$TMP.err"
+    cat "$TMP.out" "$TMP.err" | sed 's/\x1B\[[0-9;]*m//g'
+}
+
+for program in "$DIR"/*.jy; do
+    name=${program%.jy}
+    expected="$name.out"
+
+    for flags in "" -r -O -j; do
+        if ! run "$JY" $flags "$program" | cmp -s - "$expected"; then
+            echo "FAIL $program $flags"
+            FAILED=1
+        fi
+    done
+
+    if [ -n "$AOT" ]; then
+        if "$JY" -a "$program" > "$TMP.c" 2> "$TMP.err"; then
+            ${CC:-cc} -O1 -w -I"$DIR/../src" "$TMP.c" -o "$TMP" && run "$TMP" > "$TMP.txt"
+        else
+            sed 's/\x1B\[[0-9;]*m//g' "$TMP.err" > "$TMP.txt"
+        fi
+
+        if ! cmp -s "$TMP.txt" "$expected"; then
+            echo "FAIL $program -a"
+            FAILED=1
+        fi
+    fi
+done
+
+rm -f "$TMP" "$TMP.c" "$TMP.out" "$TMP.err" "$TMP.txt"
+
+if [ $FAILED -eq 0 ]; then
+    echo "ALL OK"
+fi
+
+exit $FAILED